@@ -0,0 +1,108 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+
+#include "nlohmann/json.hpp"
+#include "tops/coti/type_trait.h"
+#include "tops/coti/utils.h"
+
+/// Arena-backed decoding. While an ArenaScope is active on a thread, the pmr
+/// container TypeInfos of pmr.h move every container they decode into onto
+/// the scope's arena, so a decoded object graph lives in a few large blocks
+/// instead of one heap allocation per string, vector and map node.
+
+namespace tops {
+namespace coti {
+
+// A monotonic arena: allocation is a pointer bump, deallocation is a no-op,
+// and all memory is returned at once when the arena is released or
+// destroyed.
+class DecodeArena {
+ public:
+  explicit DecodeArena(size_t initialSize = 64 << 10)
+      : resource(initialSize) {}
+
+  std::pmr::memory_resource *getResource() { return &resource; }
+
+  // Frees all blocks. Objects still living in the arena are left dangling.
+  void release() { resource.release(); }
+
+ private:
+  std::pmr::monotonic_buffer_resource resource;
+};
+
+// Makes `arena` the decode arena of the current thread until destroyed.
+// Scopes nest, the previous arena is restored on exit.
+class ArenaScope {
+ public:
+  explicit ArenaScope(DecodeArena &arena);
+
+  ~ArenaScope();
+
+  ArenaScope(const ArenaScope &) = delete;
+  ArenaScope &operator=(const ArenaScope &) = delete;
+
+ private:
+  std::pmr::memory_resource *prevResource;
+};
+
+// The resource of the innermost ArenaScope of this thread, or nullptr.
+std::pmr::memory_resource *get_decode_resource();
+
+// An object allocated in its own arena, and destroyed in O(1) together with
+// it: the object's destructor is not run. So everything the object owns must
+// come from the arena, i.e. its containers are the pmr ones from pmr.h, or it
+// leaks.
+template <typename ObjT>
+class ArenaBox {
+ public:
+  explicit ArenaBox(size_t initialSize = 64 << 10)
+      : arena(std::make_unique<DecodeArena>(initialSize)) {
+    // Uses-allocator construction only puts ObjT itself on the arena when it
+    // is a pmr container. The pmr members of a struct start empty on the
+    // default resource, and decoding under an ArenaScope moves them over, see
+    // adopt_decode_resource().
+    std::pmr::polymorphic_allocator<ObjT> alloc(arena->getResource());
+    object = alloc.allocate(1);
+    alloc.construct(object);
+  }
+
+  ObjT &get() { return *object; }
+
+  const ObjT &get() const { return *object; }
+
+  ObjT &operator*() { return *object; }
+
+  const ObjT &operator*() const { return *object; }
+
+  ObjT *operator->() { return object; }
+
+  const ObjT *operator->() const { return object; }
+
+  DecodeArena &getArena() { return *arena; }
+
+ private:
+  std::unique_ptr<DecodeArena> arena;
+  ObjT *object;
+};
+
+template <typename ObjT>
+ArenaBox<ObjT> from_msgpack_arena(const msgpack_object &msg_obj) {
+  ArenaBox<ObjT> box;
+  ArenaScope scope(box.getArena());
+  from_msgpack(get_type_info<ObjT>(), &box.get(), msg_obj);
+  return box;
+}
+
+template <typename ObjT>
+ArenaBox<ObjT> from_json_arena(const nlohmann::json &json) {
+  ArenaBox<ObjT> box;
+  ArenaScope scope(box.getArena());
+  from_json(get_type_info<ObjT>(), &box.get(), json);
+  return box;
+}
+
+}  // namespace coti
+}  // namespace tops
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstddef>
+#include <string_view>
+#include <vector>
+
+#include "tops/coti/thread_pool.h"
+#include "tops/coti/type_info.h"
+#include "tops/coti/type_trait.h"
+
+class msgpack_packer;
+class msgpack_object;
+
+/// Batch msgpack encoding/decoding of many objects of one TypeInfo, split
+/// into slices that run on a ThreadPool. The result is the same as packing
+/// or unpacking the objects one by one as a msgpack array.
+
+namespace tops {
+namespace coti {
+
+// Packs `numObjects` objects, laid out `type_info.cppByteSize` apart from
+// `objects`, as one msgpack array. Every slice is encoded into its own buffer
+// and the buffers are written to `packer` in order.
+void to_msgpack_batch(const TypeInfo &type_info, const void *objects,
+                      size_t numObjects, msgpack_packer &packer,
+                      ThreadPool &pool = ThreadPool::getDefault());
+
+template <typename ObjT>
+void to_msgpack_batch(const ObjT *objects, size_t numObjects,
+                      msgpack_packer &packer,
+                      ThreadPool &pool = ThreadPool::getDefault()) {
+  return to_msgpack_batch(get_type_info<ObjT>(), objects, numObjects, packer,
+                          pool);
+}
+
+// Decodes a msgpack array into the array `object` described by `arrayInfo`,
+// e.g. a std::vector, resizing it to fit.
+void from_msgpack_batch(const ArrayInfo &arrayInfo, void *object,
+                        const msgpack_object &msg_obj,
+                        ThreadPool &pool = ThreadPool::getDefault());
+
+// Same, straight from msgpack bytes. Element boundaries are found by one
+// sequential skip over `data`, then slices are decoded in parallel. Returns
+// false on malformed input or trailing bytes.
+bool from_msgpack_batch(const ArrayInfo &arrayInfo, void *object,
+                        std::string_view data,
+                        ThreadPool &pool = ThreadPool::getDefault());
+
+template <typename ObjT>
+bool from_msgpack_batch(std::string_view data, std::vector<ObjT> &objects,
+                        ThreadPool &pool = ThreadPool::getDefault()) {
+  return from_msgpack_batch(
+      static_cast<const ArrayInfo &>(get_type_info<std::vector<ObjT>>()),
+      &objects, data, pool);
+}
+
+}  // namespace coti
+}  // namespace tops
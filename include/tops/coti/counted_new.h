@@ -0,0 +1,17 @@
+#pragma once
+
+#include <cstdint>
+
+/// A replacement of the global operator new that counts the heap allocations
+/// of every thread. It's part of coti built with TOPS_COTI_INSTRUMENT, where
+/// it feeds the allocation counters of instrument.h; other binaries get it by
+/// linking the coti_counted_new target.
+
+namespace tops {
+namespace coti {
+
+// Heap allocations made by this thread so far.
+uint64_t counted_new_thread_allocs();
+
+}  // namespace coti
+}  // namespace tops
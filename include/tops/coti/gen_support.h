@@ -0,0 +1,112 @@
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+#include "msgpack.h"
+#include "nlohmann/json.hpp"
+#include "tops/coti/hash.h"
+#include "tops/coti/type_trait.h"
+#include "tops/coti/utils.h"
+
+/// Building blocks of the serializers coti_gen emits for cpp structs. Fields
+/// of scalar and string type are encoded inline, with the same output as the
+/// generic TypeInfo walk; any other field goes through the generic functions,
+/// which in turn pick up the generated codecs of nested structs.
+
+namespace tops {
+namespace coti {
+namespace gen_support {
+
+template <typename T>
+constexpr bool is_int_field_v =
+    std::is_integral_v<T> && !std::is_same_v<T, bool>;
+
+template <typename T>
+constexpr bool is_string_field_v =
+    std::is_same_v<T, std::string> || std::is_same_v<T, std::string_view>;
+
+template <typename T>
+void pack(const T &val, msgpack_packer &packer) {
+  if constexpr (std::is_same_v<T, bool>) {
+    if (val) {
+      msgpack_pack_true(&packer);
+    } else {
+      msgpack_pack_false(&packer);
+    }
+  } else if constexpr (is_int_field_v<T> && std::is_signed_v<T>) {
+    msgpack_pack_int64(&packer, val);
+  } else if constexpr (is_int_field_v<T>) {
+    msgpack_pack_uint64(&packer, val);
+  } else if constexpr (std::is_floating_point_v<T>) {
+    msgpack_pack_double(&packer, val);
+  } else if constexpr (is_string_field_v<T>) {
+    msgpack_pack_str_with_body(&packer, val.data(), val.size());
+  } else {
+    to_msgpack(get_type_info<T>(), &val, packer);
+  }
+}
+
+template <typename T>
+void unpack(T &val, const msgpack_object &msg_obj) {
+  if constexpr (std::is_same_v<T, bool>) {
+    assert(msg_obj.type == MSGPACK_OBJECT_BOOLEAN);
+    val = msg_obj.via.boolean;
+  } else if constexpr (is_int_field_v<T>) {
+    assert(msg_obj.type == MSGPACK_OBJECT_POSITIVE_INTEGER ||
+           msg_obj.type == MSGPACK_OBJECT_NEGATIVE_INTEGER);
+    val = static_cast<T>(msg_obj.via.i64);
+  } else if constexpr (std::is_floating_point_v<T>) {
+    assert(msg_obj.type == MSGPACK_OBJECT_FLOAT32 ||
+           msg_obj.type == MSGPACK_OBJECT_FLOAT64);
+    val = static_cast<T>(msg_obj.via.f64);
+  } else if constexpr (is_string_field_v<T>) {
+    assert(msg_obj.type == MSGPACK_OBJECT_STR);
+    val = T(msg_obj.via.str.ptr, msg_obj.via.str.size);
+  } else {
+    from_msgpack(get_type_info<T>(), &val, msg_obj);
+  }
+}
+
+template <typename T>
+nlohmann::json to_json_value(const T &val) {
+  if constexpr (std::is_same_v<T, bool>) {
+    return val;
+  } else if constexpr (is_int_field_v<T>) {
+    return static_cast<int64_t>(val);
+  } else if constexpr (std::is_floating_point_v<T>) {
+    return static_cast<double>(val);
+  } else if constexpr (is_string_field_v<T>) {
+    return std::string_view(val);
+  } else {
+    return to_json(get_type_info<T>(), &val);
+  }
+}
+
+// Mirrors Hash<T> in hash.cpp: a kind tag, then the value.
+template <typename T>
+void hash_value(const T &val, Hasher &hasher) {
+  if constexpr (std::is_same_v<T, bool>) {
+    hasher.update(static_cast<uint8_t>(OK_Bool));
+    hasher.update(static_cast<uint8_t>(val));
+  } else if constexpr (is_int_field_v<T>) {
+    hasher.update(static_cast<uint8_t>(OK_Int));
+    hasher.update(static_cast<int64_t>(val));
+  } else if constexpr (std::is_floating_point_v<T>) {
+    hasher.update(static_cast<uint8_t>(OK_Float));
+    hasher.update(static_cast<double>(val));
+  } else if constexpr (is_string_field_v<T>) {
+    hasher.update(static_cast<uint8_t>(OK_String));
+    hasher.update(static_cast<uint64_t>(val.size()));
+    hasher.update(val.data(), val.size());
+  } else {
+    hash(get_type_info<T>(), &val, hasher);
+  }
+}
+
+}  // namespace gen_support
+}  // namespace coti
+}  // namespace tops
@@ -1,131 +1,180 @@
 #pragma once
 
 #include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+#include "tops/coti/type_info.h"
+#include "tops/coti/type_trait.h"
+
+struct evp_md_ctx_st;
+struct XXH3_state_s;
 
 namespace tops {
 namespace coti {
-using SHA3_256DigestTy = std::array<unsigned char, 64>;
-class Hasher;
-// namespace {
-// class SHA3_256Hasher {
-//   OSSL_LIB_CTX *ctx;
-//   EVP_MD *md;
-//   EVP_MD_CTX *mdctx;
-//
-// public:
-//   SHA3_256Hasher() {
-//     ctx = OSSL_LIB_CTX_new();
-//     md = EVP_MD_fetch(ctx, "SHA3-256", nullptr);
-//     assert(md);
-//     mdctx = EVP_MD_CTX_new();
-//   }
-//
-//   void reinit() {
-//     auto res = EVP_DigestInit_ex2(mdctx, md, nullptr);
-//     (void)res;
-//     assert(res);
-//   }
-//
-//   template <typename T> void update(const T &val) {
-//     update((const char *)&val, sizeof(T));
-//   }
-//
-//   void update(const char *data, size_t cnt) {
-//     auto res = EVP_DigestUpdate(mdctx, data, cnt);
-//     (void)res;
-//     assert(res);
-//   }
-//
-//   SHA3_256DigestTy finalize() {
-//     SHA3_256DigestTy digest;
-//     unsigned mdLen;
-//     auto res = EVP_DigestFinal_ex(mdctx, digest.data(), &mdLen);
-//     (void)mdLen;
-//     assert(mdLen == digest.size());
-//     return digest;
-//   }
-//
-//   ~SHA3_256Hasher() {
-//     EVP_MD_CTX_free(mdctx);
-//     EVP_MD_free(md);
-//     OSSL_LIB_CTX_free(ctx);
-//   }
-// };
-//
-// void hash(const TypeInfo &type_info, const char *object,
-//           SHA3_256Hasher &hasher);
-// void hash_array(const ArrayInfo &array_info, const char *object,
-//                 SHA3_256Hasher &hasher);
-//
-// template <typename T> struct Hash {
-//   static void run(const T &type_info, const char *object,
-//                   SHA3_256Hasher &hasher) {
-//     if constexpr (std::is_same_v<T, BoolInfo>) {
-//       char val = type_info.getVal(object) ? '1' : '0';
-//       hasher.update(val);
-//     }
-//     if constexpr (std::is_same_v<T, IntegerInfo>) {
-//       if (type_info.isSigned()) {
-//         int64_t val = type_info.getSignedVal(object);
-//         hasher.update(val);
-//       } else {
-//         uint64_t val = type_info.getUnsignedVal(object);
-//         hasher.update(val);
-//       }
-//     }
-//     if constexpr (std::is_same_v<T, FloatInfo>) {
-//       double val = type_info.getVal(object);
-//       hasher.update(val);
-//     }
-//     if constexpr (std::is_same_v<T, StringInfo>) {
-//       auto val = type_info.getVal(object);
-//       hasher.update(val.data(), val.size());
-//     }
-//     if constexpr (std::is_same_v<T, ArrayInfo>) {
-//       hash_array(type_info, object, hasher);
-//     }
-//     if constexpr (std::is_same_v<T, DictInfo>) {
-//       for (uint32_t i = 0; i < type_info.numChilds; ++i) {
-//         auto name = type_info.names[i];
-//         hasher.update(name.data(), name.size());
-//         hash(type_info.elems[i], object + type_info.offsets[i], hasher);
-//       }
-//     }
-//   }
-// };
-//
-// void hash(const TypeInfo &type_info, const char *object,
-//           SHA3_256Hasher &hasher) {
-//   return type_info_dispatch<Hash>(type_info, object, hasher);
-// }
-//
-// template <typename T> struct HashArray {
-//   static void run(const T &type_info, const ArrayInfo &array_info,
-//                   const char *object, SHA3_256Hasher &hasher) {
-//     uint32_t size = array_info.size;
-//     hasher.update(size);
-//     uint32_t elemSize = type_info.sizeInBytes;
-//     for (uint32_t idx = 0; idx < size; ++idx) {
-//       Hash<T>::run(type_info, object + idx * elemSize, hasher);
-//     }
-//   }
-// };
-//
-// void hash_array(const ArrayInfo &array_info, const char *object,
-//                 SHA3_256Hasher &hasher) {
-//   return type_info_dispatch<HashArray>(array_info.elem, array_info, object,
-//                                        hasher);
-// }
-//
-// thread_local SHA3_256Hasher hasher;
-//
-// } // namespace
-//
-//
-// SHA3_256DigestTy hash(const TypeInfo &type_info, const void *object) {
-//   hasher.reinit();
-//   hash(type_info, object, hasher);
-//   return hasher.finalize();
+using SHA3_256DigestTy = std::array<unsigned char, 32>;
+using XXH3_128DigestTy = std::array<unsigned char, 16>;
+
+/// Hashing encoding, fed to the digest in this order:
+/// - Every value starts with its TypeKind as one byte.
+/// - Bool: one byte 0/1. Int: int64_t. Float: the bits of a double.
+/// - String: uint64_t byte size, then the bytes.
+/// - Array: uint64_t number of children. If the child is a Bool/Int/Float,
+///   then the child bit width as uint32_t and the raw child storage follow;
+///   otherwise each child is encoded in order.
+/// - List: uint64_t number of children, then each child in order.
+/// - Dict: uint64_t number of items, then for each item sorted by key the
+///   uint64_t key size, the key bytes and the value. The digest therefore
+///   doesn't depend on the iteration order of the container.
+/// All fixed-size integers are in host byte order, which is little-endian on
+/// every platform we support.
+///
+/// Hasher is the backend-independent part: it collects small updates into a
+/// buffer, so hashing a struct of ints doesn't become one backend call per
+/// field. Backends derive from it and provide `finalize()`.
+class Hasher {
+ public:
+  Hasher(const Hasher &) = delete;
+  Hasher &operator=(const Hasher &) = delete;
+
+  virtual ~Hasher();
+
+  // Starts a new digest.
+  void reinit() {
+    bufferUsed = 0;
+    reset();
+  }
+
+  void update(const void *data, size_t size) {
+    if (size > buffer.size() - bufferUsed) {
+      return updateSlow(data, size);
+    }
+    std::memcpy(buffer.data() + bufferUsed, data, size);
+    bufferUsed += size;
+  }
+
+  template <typename T>
+  void update(const T &val) {
+    static_assert(std::is_trivially_copyable_v<T>);
+    update(&val, sizeof(T));
+  }
+
+  // Hands a large contiguous block to the backend in one call, without
+  // copying it through the buffer. Blocks smaller than the buffer go through
+  // update(), so that small arrays don't flush it. `data` may be null for an
+  // empty block.
+  void updateBulk(const void *data, size_t size) {
+    if (size == 0) {
+      return;
+    }
+    if (size < buffer.size()) {
+      return update(data, size);
+    }
+    flush();
+    consume(data, size);
+  }
+
+ protected:
+  Hasher() = default;
+
+  virtual void reset() = 0;
+
+  virtual void consume(const void *data, size_t size) = 0;
+
+  // Must be called by the backend before producing the digest.
+  void flush() {
+    if (bufferUsed != 0) {
+      consume(buffer.data(), bufferUsed);
+      bufferUsed = 0;
+    }
+  }
+
+ private:
+  void updateSlow(const void *data, size_t size);
+
+  size_t bufferUsed = 0;
+  std::array<char, 4096> buffer;
+};
+
+// OpenSSL SHA3-256. Use it for digests that are persisted or compared across
+// processes.
+class SHA3_256Hasher final : public Hasher {
+ public:
+  using DigestTy = SHA3_256DigestTy;
+
+  SHA3_256Hasher();
+  ~SHA3_256Hasher() override;
+
+  DigestTy finalize();
+
+ private:
+  void reset() override;
+  void consume(const void *data, size_t size) override;
+
+  evp_md_ctx_st *mdctx;
+};
+
+// Non-cryptographic XXH3, 64-bit. Meant for in-process dedup and hash-map
+// keys, where SHA3 is much more than needed.
+class XXH3_64Hasher final : public Hasher {
+ public:
+  using DigestTy = uint64_t;
+
+  XXH3_64Hasher();
+  ~XXH3_64Hasher() override;
+
+  DigestTy finalize();
+
+ private:
+  void reset() override;
+  void consume(const void *data, size_t size) override;
+
+  XXH3_state_s *state;
+};
+
+// Non-cryptographic XXH3, 128-bit, canonical (big-endian) byte order.
+class XXH3_128Hasher final : public Hasher {
+ public:
+  using DigestTy = XXH3_128DigestTy;
+
+  XXH3_128Hasher();
+  ~XXH3_128Hasher() override;
+
+  DigestTy finalize();
+
+ private:
+  void reset() override;
+  void consume(const void *data, size_t size) override;
+
+  XXH3_state_s *state;
+};
+
+void hash(const TypeInfo &type_info, const void *object, Hasher &hasher);
+
+// Hashes `object` with a thread-local hasher of the selected backend.
+template <typename HasherT>
+typename HasherT::DigestTy hash_with(const TypeInfo &type_info,
+                                     const void *object) {
+  thread_local HasherT hasher;
+  hasher.reinit();
+  hash(type_info, object, hasher);
+  return hasher.finalize();
+}
+
+template <typename HasherT, typename ObjT>
+typename HasherT::DigestTy hash_with(const ObjT &object) {
+  return hash_with<HasherT>(get_type_info(object), &object);
+}
+
+// SHA3-256 digest of `object`.
+SHA3_256DigestTy hash(const TypeInfo &type_info, const void *object);
+
+template <typename ObjT>
+SHA3_256DigestTy hash(const ObjT &object) {
+  return hash(get_type_info(object), &object);
+}
 
 }  // namespace coti
 }  // namespace tops
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+
+#include "nlohmann/json.hpp"
+#include "tops/coti/type_info.h"
+
+/// Per-TypeInfo counters of to_json, from_json, to_msgpack and from_msgpack,
+/// collected when the library is built with TOPS_COTI_INSTRUMENT (the CMake
+/// option of the same name). Without it nothing is recorded and the hot paths
+/// are compiled exactly as before; the functions below still exist and report
+/// nothing.
+///
+/// Every type_info_dispatch() inside one of those calls counts as a call on
+/// its TypeInfo, so the elements of an Array are one call on the element
+/// TypeInfo. Time and allocations include nested values; self time doesn't.
+/// Bytes are those packed by to_msgpack and read by the MsgPackReader based
+/// from_msgpack, the other calls report none. Allocations are counted by
+/// replacing the global operator new in instrumented builds, see counted_new.h.
+///
+/// Counters are kept per thread and merged by instrument_snapshot().
+
+namespace tops {
+namespace coti {
+
+#ifdef TOPS_COTI_INSTRUMENT
+constexpr bool kInstrumentEnabled = true;
+#else
+constexpr bool kInstrumentEnabled = false;
+#endif
+
+enum class InstrumentOp : uint8_t {
+  ToJson,
+  FromJson,
+  ToMsgPack,
+  FromMsgPack,
+  NumOps,
+};
+
+struct InstrumentCounters {
+  uint64_t calls = 0;
+  uint64_t bytes = 0;
+  uint64_t nanos = 0;
+  uint64_t selfNanos = 0;
+  uint64_t allocs = 0;
+
+  InstrumentCounters &operator+=(const InstrumentCounters &other) {
+    calls += other.calls;
+    bytes += other.bytes;
+    nanos += other.nanos;
+    selfNanos += other.selfNanos;
+    allocs += other.allocs;
+    return *this;
+  }
+};
+
+// Names `type_info` in snapshots, which otherwise show its kind and address.
+void instrument_set_name(const TypeInfo &type_info, std::string_view name);
+
+// {"to_json": [...], "from_json": [...], "to_msgpack": [...],
+//  "from_msgpack": [...]}, each an array of {"type", "kind", "calls", "bytes",
+// "nanos", "self_nanos", "allocs"} sorted by self_nanos, largest first.
+nlohmann::json instrument_snapshot();
+
+// Zeroes the counters of all threads.
+void instrument_reset();
+
+// Heap allocations made by this thread so far; 0 without TOPS_COTI_INSTRUMENT.
+uint64_t instrument_thread_allocs();
+
+}  // namespace coti
+}  // namespace tops
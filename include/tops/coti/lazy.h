@@ -0,0 +1,133 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+#include "tops/coti/path.h"
+#include "tops/coti/type_info.h"
+#include "tops/coti/type_trait.h"
+
+/// On-access decoding of a msgpack value. Opening only checks that the buffer
+/// holds one well-formed value. A container's children are indexed the first
+/// time a path goes through it, and the value at a Path is decoded with
+/// from_msgpack() the first time it is accessed. Reading a few fields of a
+/// large blob then costs one scan plus decoding just those fields, and the
+/// index only holds the containers on accessed paths. Arrays of scalars aren't
+/// indexed, accessing an element decodes the whole array.
+
+namespace tops {
+namespace coti {
+
+class MsgPackReader;
+
+// Decodes a msgpack buffer into an object piece by piece. Not thread-safe.
+class LazyMsgPack {
+ public:
+  // Opens `buffer`, to be decoded into `object` of `type_info`. `buffer` must
+  // outlive the LazyMsgPack, views (Span, std::string_view) decoded from it
+  // point into it. Returns nullptr on malformed input, nesting deeper than
+  // kMaxDepth, or trailing bytes.
+  static std::unique_ptr<LazyMsgPack> open(const TypeInfo &type_info,
+                                           void *object,
+                                           std::string_view buffer);
+
+  // Returns the value at `path`, decoding it on first access. Containers on
+  // the way are only sized, their other children stay default until accessed.
+  // Returns {nullptr, nullptr} if `path` isn't in the buffer or doesn't fit
+  // the TypeInfo, or the value doesn't decode.
+  TypedPtr get(const Path &path);
+
+  // Whether the value at `path` has already been decoded.
+  bool isDecoded(const Path &path) const;
+
+  // Deeper values are rejected by open(), which also bounds the recursion of
+  // from_msgpack() on the buffer.
+  static constexpr size_t kMaxDepth = 512;
+
+ private:
+  struct Node {
+    enum Kind : uint8_t { Leaf, Array, Map };
+
+    // Byte range of the value in the buffer.
+    size_t begin;
+    size_t end;
+    Kind kind;
+    // Range in `childs` once expanded; map children are sorted by key.
+    size_t firstChild = 0;
+    uint32_t numChilds = 0;
+    // Whether the children have been indexed, see expand().
+    bool isExpanded = false;
+    // An Array without container elements, whose elements aren't indexed.
+    bool isFlat = false;
+    bool isDecoded = false;
+    // Whether the Array/List object has been resized to numChilds.
+    bool isSized = false;
+  };
+
+  struct Child {
+    // Empty for array elements.
+    std::string_view key;
+    size_t node;
+  };
+
+  LazyMsgPack(const TypeInfo &type_info, void *object, std::string_view buffer)
+      : type_info(type_info), object(object), buffer(buffer) {}
+
+  // The kind of the value starting at `offset`, from its first byte.
+  Node::Kind kindAt(size_t offset) const;
+
+  // Indexes the children of a container node, once. Returns false on
+  // malformed input.
+  bool expand(size_t nodeIdx);
+
+  // Decodes the value of `nodeIdx` into `value`.
+  bool decode(size_t nodeIdx, TypedPtr value);
+
+  // Returns the child of `node` named by `elem`, or -1.
+  int64_t findChild(const Node &node, const PathElem &elem) const;
+
+  const TypeInfo &type_info;
+  void *object;
+  std::string_view buffer;
+  std::vector<Node> nodes;
+  std::vector<Child> childs;
+};
+
+// An ObjT decoded on access from a msgpack buffer.
+template <typename ObjT>
+class LazyObject {
+ public:
+  static std::unique_ptr<LazyObject> open(std::string_view buffer) {
+    std::unique_ptr<LazyObject> res(new LazyObject());
+    res->lazy = LazyMsgPack::open(get_type_info<ObjT>(), &res->object, buffer);
+    if (!res->lazy) {
+      return nullptr;
+    }
+    return res;
+  }
+
+  // Returns nullptr if the value at `path` can't be decoded or isn't a T.
+  template <typename T>
+  const T *get(const Path &path) {
+    auto value = lazy->get(path);
+    if (value.type_info != &get_type_info<T>()) {
+      return nullptr;
+    }
+    return static_cast<const T *>(value.ptr);
+  }
+
+  // The object with only the accessed values decoded.
+  const ObjT &getPartial() const { return object; }
+
+ private:
+  LazyObject() = default;
+
+  ObjT object{};
+  std::unique_ptr<LazyMsgPack> lazy;
+};
+
+}  // namespace coti
+}  // namespace tops
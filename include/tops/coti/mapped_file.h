@@ -0,0 +1,95 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+
+#include "tops/coti/arena.h"
+#include "tops/coti/type_info.h"
+#include "tops/coti/type_trait.h"
+
+/// Zero-copy loading of msgpack files. The file is mapped read-only and
+/// shared, so processes loading the same file share its pages, and
+/// std::string_view and Span fields of the decoded object point into the
+/// mapping instead of owning copies.
+
+namespace tops {
+namespace coti {
+
+// A whole file mapped read-only. Held through shared_ptr, objects decoded
+// from it keep a reference for as long as they view its bytes.
+class MappedFile {
+ public:
+  // Returns nullptr if the file can't be opened or mapped.
+  static std::shared_ptr<const MappedFile> open(const std::string &path);
+
+  ~MappedFile();
+
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  std::string_view getData() const { return {data, size}; }
+
+ private:
+  MappedFile(const char *data, size_t size) : data(data), size(size) {}
+
+  const char *data;
+  size_t size;
+};
+
+// Decodes the single msgpack value in `file` into `object`, with views
+// pointing into the mapping. Span payloads that aren't aligned for their
+// element type are copied into the current ArenaScope's arena. Returns false
+// on malformed input, trailing bytes, or such a payload without an
+// ArenaScope.
+bool from_msgpack_view(const TypeInfo &type_info, void *object,
+                       const MappedFile &file);
+
+// An object decoded by from_msgpack_view() together with the mapping its
+// views point into, and the arena its misaligned Spans were copied into.
+template <typename ObjT>
+class MappedObject {
+ public:
+  MappedObject(std::shared_ptr<const MappedFile> file,
+               std::unique_ptr<DecodeArena> arena, ObjT object)
+      : file(std::move(file)),
+        arena(std::move(arena)),
+        object(std::move(object)) {}
+
+  const ObjT &get() const { return object; }
+
+  const ObjT &operator*() const { return object; }
+
+  const ObjT *operator->() const { return &object; }
+
+  const std::shared_ptr<const MappedFile> &getFile() const { return file; }
+
+ private:
+  std::shared_ptr<const MappedFile> file;
+  // Declared before `object`, which may use it.
+  std::unique_ptr<DecodeArena> arena;
+  ObjT object;
+};
+
+template <typename ObjT>
+std::optional<MappedObject<ObjT>> load_msgpack_view(const std::string &path) {
+  auto file = MappedFile::open(path);
+  if (!file) {
+    return std::nullopt;
+  }
+  // Also takes the object's pmr containers, which live as long as it does.
+  auto arena = std::make_unique<DecodeArena>(4 << 10);
+  ArenaScope scope(*arena);
+  ObjT object{};
+  if (!from_msgpack_view(get_type_info<ObjT>(), &object, *file)) {
+    return std::nullopt;
+  }
+  return MappedObject<ObjT>(std::move(file), std::move(arena),
+                            std::move(object));
+}
+
+}  // namespace coti
+}  // namespace tops
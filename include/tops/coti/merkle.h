@@ -0,0 +1,165 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "tops/coti/hash.h"
+#include "tops/coti/path.h"
+#include "tops/coti/thread_pool.h"
+#include "tops/coti/type_info.h"
+#include "tops/coti/type_trait.h"
+
+/// Merkle-tree hashing. Large containers are split into nodes that are hashed
+/// in parallel and combined upward, every digest being SHA3-256.
+///
+/// The weight of a value is 1 for a Bool/Int/Float, 1 + size / 64 for a
+/// String, 1 + numChilds for an Array of Bool/Int/Float, 1 + the weights of
+/// the children for any other Array or a List, and 1 + (1 + value weight) per
+/// item for a Dict. L is the leaf weight, kDefaultMerkleLeafWeight unless
+/// given.
+///
+/// The node of a value is
+/// - if it isn't an Array/List/Dict or weighs less than L, a Value node:
+///   SHA3(0x00 || flat encoding of the value as in hash.h);
+/// - otherwise an Interior node: SHA3(0x02 || TypeKind as one byte || uint64_t
+///   number of children/items || for an Array of Bool/Int/Float the child bit
+///   width as uint32_t || uint64_t number of child nodes || their digests).
+///
+/// The child nodes of an Interior node are, in order:
+/// - for an Array of Bool/Int/Float, runs of L elements (the last one may be
+///   shorter): SHA3(0x01 || uint64_t number of elements || raw storage);
+/// - for another Array or a List, the children in order, where a child
+///   weighing at least L is its own node, and maximal stretches of lighter
+///   children are cut greedily into runs weighing at most L in total:
+///   SHA3(0x01 || uint64_t number of children || flat encoding of each);
+/// - for a Dict, the items sorted by key, cut the same way by value weight + 1.
+///   A heavy item is an Item node, SHA3(0x03 || uint64_t key size || key ||
+///   digest of the value's node), and a run of light items is
+///   SHA3(0x01 || uint64_t number of items || for each the uint64_t key size,
+///   the key and the flat encoding of the value).
+/// Integers are little-endian, as in hash.h. The leading tag bytes keep
+/// leaves, runs and inner nodes apart, and keep every Merkle digest distinct
+/// from the flat hash() digest of the same value.
+///
+/// A value's node doesn't depend on where the value sits, so a subtree can be
+/// re-hashed or verified on its own with merkle_hash() and the same L.
+///
+/// HashedObject keeps the tree of one object and, after edits reported with
+/// markDirty(), re-hashes only the nodes on the dirty paths.
+
+namespace tops {
+namespace coti {
+
+constexpr size_t kDefaultMerkleLeafWeight = 1 << 16;
+
+struct MerkleNode {
+  enum Kind : uint8_t {
+    Value,
+    Run,
+    Interior,
+    Item,
+  };
+
+  Kind kind;
+  SHA3_256DigestTy digest;
+  // The children (Array/List) or sorted items (Dict) of the parent Interior
+  // node that this node covers.
+  size_t begin = 0;
+  size_t end = 0;
+  // The child nodes of an Interior node, or the value node of an Item.
+  std::vector<MerkleNode> children;
+  // Only kept by HashedObject, on Interior nodes other than of an Array of
+  // Bool/Int/Float: the weight of every child/item, and the sorted Dict keys.
+  std::vector<size_t> childWeights;
+  std::vector<std::string> keys;
+};
+
+struct MerkleTree {
+  MerkleNode root;
+  size_t leafWeight;
+
+  const SHA3_256DigestTy &getDigest() const { return root.digest; }
+};
+
+MerkleTree merkle_hash(const TypeInfo &type_info, const void *object,
+                       WorkStealingPool &pool = WorkStealingPool::getDefault(),
+                       size_t leafWeight = kDefaultMerkleLeafWeight);
+
+template <typename ObjT>
+MerkleTree merkle_hash(const ObjT &object,
+                       WorkStealingPool &pool = WorkStealingPool::getDefault(),
+                       size_t leafWeight = kDefaultMerkleLeafWeight) {
+  return merkle_hash(get_type_info(object), &object, pool, leafWeight);
+}
+
+// Re-hashes `object` and compares it with `node`, which must be the Value or
+// Interior node built for it with the same leaf weight.
+bool merkle_verify(const MerkleNode &node, const TypeInfo &type_info,
+                   const void *object,
+                   WorkStealingPool &pool = WorkStealingPool::getDefault(),
+                   size_t leafWeight = kDefaultMerkleLeafWeight);
+
+template <typename ObjT>
+bool merkle_verify(const MerkleNode &node, const ObjT &object,
+                   WorkStealingPool &pool = WorkStealingPool::getDefault(),
+                   size_t leafWeight = kDefaultMerkleLeafWeight) {
+  return merkle_verify(node, get_type_info(object), &object, pool, leafWeight);
+}
+
+namespace impl {
+struct DirtyPaths;
+}  // namespace impl
+
+// Merkle digest of one object, kept up to date incrementally. After the
+// first hash(), only nodes on paths passed to markDirty() are re-hashed, so
+// small edits cost about the depth times the size of the changed values
+// instead of the whole object. Resizing an Array/List re-hashes all of it,
+// and a dirty Dict is iterated to find inserted and erased keys.
+//
+// The object must not change between markDirty() calls and hash() in ways
+// that aren't reported, nor be changed while hash() runs.
+class HashedObject {
+ public:
+  HashedObject(const TypeInfo &type_info, const void *object,
+               WorkStealingPool &pool = WorkStealingPool::getDefault(),
+               size_t leafWeight = kDefaultMerkleLeafWeight);
+
+  template <typename ObjT>
+  explicit HashedObject(const ObjT &object,
+                        WorkStealingPool &pool = WorkStealingPool::getDefault(),
+                        size_t leafWeight = kDefaultMerkleLeafWeight)
+      : HashedObject(get_type_info(object), &object, pool, leafWeight) {}
+
+  ~HashedObject();
+
+  HashedObject(const HashedObject &) = delete;
+  HashedObject &operator=(const HashedObject &) = delete;
+
+  // The value at `path`, and everything under it, may have changed. This
+  // covers inserting or erasing the dict key / list element at `path`. The
+  // empty path marks the whole object. Inserting or erasing an element also
+  // moves the ones after it, which hash() only notices from the changed size:
+  // if an Array/List gets as many elements inserted as erased between two
+  // hash() calls, mark the Array/List itself.
+  void markDirty(const Path &path);
+
+  // Equal to merkle_hash(...).getDigest() of the current object.
+  const SHA3_256DigestTy &hash();
+
+  // The tree as of the last hash().
+  const MerkleTree &getTree() const { return tree; }
+
+ private:
+  const TypeInfo &type_info;
+  const void *object;
+  WorkStealingPool &pool;
+  MerkleTree tree;
+  bool hashed = false;
+  std::unique_ptr<impl::DirtyPaths> dirty;
+};
+
+}  // namespace coti
+}  // namespace tops
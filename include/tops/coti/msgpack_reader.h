@@ -0,0 +1,130 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string_view>
+#include <vector>
+
+#include "tops/coti/type_info.h"
+#include "tops/coti/type_trait.h"
+
+namespace tops {
+namespace coti {
+
+// One msgpack header. The payload of Str/Bin/Ext is not consumed by
+// MsgPackReader::next(), call MsgPackReader::readBytes() to get it.
+struct MsgPackToken {
+  enum Kind : uint8_t {
+    Nil,
+    Bool,
+    PosInt,
+    NegInt,
+    Float,
+    Str,
+    Bin,
+    Ext,
+    Array,
+    Map,
+  };
+
+  Kind kind;
+  bool boolean;
+  int8_t extType;
+  // Number of payload bytes for Str/Bin/Ext, number of elements for Array and
+  // number of key-value pairs for Map.
+  uint32_t size;
+  // Raw bits of PosInt/NegInt, read as int64_t for NegInt.
+  uint64_t u64;
+  double f64;
+
+  int64_t getInt() const { return static_cast<int64_t>(u64); }
+};
+
+// Pull-based msgpack tokenizer. It reads either from a byte buffer held by the
+// caller, from chunks handed out by a NextChunkFn, or pulls bytes from a
+// ReadFn into an internal window. Values that straddle chunks or ReadFn reads
+// are gathered in the window, which only grows to fit the largest single
+// string/binary payload.
+class MsgPackReader {
+ public:
+  // Copies up to `size` bytes into `buf` and returns the number of bytes
+  // copied. Returning 0 signals end of input.
+  using ReadFn = std::function<size_t(char *buf, size_t size)>;
+
+  // Returns the next chunk of input, or an empty one at the end. Chunks are
+  // read in place; the previous one may be reused once this is called.
+  using NextChunkFn = std::function<std::string_view()>;
+
+  explicit MsgPackReader(std::string_view buffer);
+
+  explicit MsgPackReader(ReadFn read, size_t chunkSize = 1 << 20);
+
+  explicit MsgPackReader(NextChunkFn nextChunk);
+
+  // Reads the next header. Returns false on end of input or malformed data.
+  bool next(MsgPackToken &token);
+
+  // Reads `size` payload bytes. In buffer mode `bytes` points into the
+  // caller's buffer; otherwise it is only valid until the next call on this
+  // reader.
+  bool readBytes(size_t size, std::string_view &bytes);
+
+  // Skips one complete value, including all nested children.
+  bool skip();
+
+  // Returns true if there is no more input.
+  bool atEnd();
+
+  // Number of bytes consumed since construction.
+  size_t getOffset() const { return consumedBefore + (cur - windowBegin); }
+
+  // Whether views returned by readBytes() stay valid as long as the buffer
+  // passed to the constructor does.
+  bool isBorrowed() const { return !read && !nextChunk; }
+
+  // Upper bound on the number of values left, as each takes at least a byte.
+  // Only known in buffer mode, SIZE_MAX otherwise.
+  size_t getMaxNumValues() const {
+    return isBorrowed() ? static_cast<size_t>(end - cur) : SIZE_MAX;
+  }
+
+ private:
+  // Makes sure at least `size` bytes are available at `cur`.
+  bool ensure(size_t size) {
+    return static_cast<size_t>(end - cur) >= size || refill(size);
+  }
+
+  bool refill(size_t size);
+
+  bool refillFromChunks(size_t size);
+
+  bool skipBytes(size_t size);
+
+  const char *windowBegin;
+  const char *cur;
+  const char *end;
+  size_t consumedBefore = 0;
+  ReadFn read;
+  size_t chunkSize = 0;
+  NextChunkFn nextChunk;
+  // What is left of the current chunk while `cur` is in the window.
+  const char *chunkCur = nullptr;
+  const char *chunkEnd = nullptr;
+  std::vector<char> window;
+};
+
+// Decodes one value from `reader` straight into `object`, without building a
+// msgpack_object tree. Produces the same result as the msgpack_object based
+// from_msgpack() on well-formed input; returns false when the input ends early
+// or a token doesn't match the TypeInfo.
+bool from_msgpack(const TypeInfo &type_info, void *object,
+                  MsgPackReader &reader);
+
+template <typename ObjT>
+bool from_msgpack(MsgPackReader &reader, ObjT &object) {
+  return from_msgpack(get_type_info(object), &object, reader);
+}
+
+}  // namespace coti
+}  // namespace tops
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstddef>
+
+#include "tops/coti/type_info.h"
+#include "tops/coti/type_trait.h"
+
+/// Exact size of the to_msgpack() encoding, for writing it into one
+/// preallocated buffer (a single allocation, or shared memory) instead of a
+/// msgpack_sbuffer that reallocates as it grows.
+
+namespace tops {
+namespace coti {
+
+// The number of bytes to_msgpack() produces for `object`. Reads string
+// lengths, integer values and container sizes, no payload bytes.
+size_t msgpack_size(const TypeInfo &type_info, const void *object);
+
+template <typename ObjT>
+size_t msgpack_size(const ObjT &object) {
+  return msgpack_size(get_type_info(object), &object);
+}
+
+// Packs `object` as to_msgpack() does into `buf`. Returns the number of bytes
+// written, or 0 if `size` is less than msgpack_size(), in which case `buf`
+// holds a truncated encoding.
+size_t to_msgpack_into(const TypeInfo &type_info, const void *object,
+                       char *buf, size_t size);
+
+template <typename ObjT>
+size_t to_msgpack_into(const ObjT &object, char *buf, size_t size) {
+  return to_msgpack_into(get_type_info(object), &object, buf, size);
+}
+
+}  // namespace coti
+}  // namespace tops
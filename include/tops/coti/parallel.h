@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstddef>
+
+#include "nlohmann/json.hpp"
+#include "tops/coti/thread_pool.h"
+#include "tops/coti/type_info.h"
+#include "tops/coti/type_trait.h"
+
+class msgpack_packer;
+
+/// Serialization of one large object with its big Array/List/Dict subtrees
+/// split into tasks on a WorkStealingPool, to cut the latency of exporting it.
+/// The output is the same as the sequential to_msgpack/to_json.
+
+namespace tops {
+namespace coti {
+
+// Subtrees with fewer leaf values than this (estimated, see parallel.cpp) are
+// encoded sequentially by one task.
+constexpr size_t kDefaultSplitThreshold = 1 << 16;
+
+// Encodes into per-task buffers that are written to `packer` in order once
+// all tasks are done. Objects under `splitThreshold` take the sequential
+// path directly.
+void to_msgpack_parallel(
+    const TypeInfo &type_info, const void *object, msgpack_packer &packer,
+    WorkStealingPool &pool = WorkStealingPool::getDefault(),
+    size_t splitThreshold = kDefaultSplitThreshold);
+
+template <typename ObjT>
+void to_msgpack_parallel(
+    const ObjT &object, msgpack_packer &packer,
+    WorkStealingPool &pool = WorkStealingPool::getDefault(),
+    size_t splitThreshold = kDefaultSplitThreshold) {
+  return to_msgpack_parallel(get_type_info(object), &object, packer, pool,
+                             splitThreshold);
+}
+
+// Tasks fill disjoint elements of arrays and values of objects whose slots
+// were created up front.
+nlohmann::json to_json_parallel(
+    const TypeInfo &type_info, const void *object,
+    WorkStealingPool &pool = WorkStealingPool::getDefault(),
+    size_t splitThreshold = kDefaultSplitThreshold);
+
+template <typename ObjT>
+nlohmann::json to_json_parallel(
+    const ObjT &object, WorkStealingPool &pool = WorkStealingPool::getDefault(),
+    size_t splitThreshold = kDefaultSplitThreshold) {
+  return to_json_parallel(get_type_info(object), &object, pool,
+                          splitThreshold);
+}
+
+}  // namespace coti
+}  // namespace tops
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <string_view>
+
+#include "tops/coti/type_info.h"
+#include "tops/coti/type_trait.h"
+
+class msgpack_packer;
+
+/// Structural diff between two objects of one TypeInfo, as a msgpack patch:
+///
+///   patch := array of op, applied in order
+///   op    := [0, path, value]   set: replace the value at path with `value`
+///          | [1, path, size]    resize the Array/List at path
+///          | [2, path]          erase the Dict item whose key ends the path
+///   path  := array of str (Dict key) / uint (Array/List index) from the root
+///
+/// `value` is encoded as to_msgpack() does. Setting a missing Dict key
+/// inserts it; every other path element, and the key of an erase, must
+/// exist. A changed container is sent as one set whenever that is
+/// shorter than the ops inside it.
+
+namespace tops {
+namespace coti {
+
+// Packs the patch that turns `a` into `b`.
+void diff(const TypeInfo &type_info, const void *a, const void *b,
+          msgpack_packer &packer);
+
+template <typename ObjT>
+void diff(const ObjT &a, const ObjT &b, msgpack_packer &packer) {
+  return diff(get_type_info(a), &a, &b, packer);
+}
+
+// Applies `patch` to `object` in place. Returns false on malformed input or a
+// path that doesn't exist in `object`; the ops before the failing one stay
+// applied. Views (std::string_view, Span) set by the patch point into
+// `patch`, which has to outlive them.
+bool apply_patch(const TypeInfo &type_info, void *object,
+                 std::string_view patch);
+
+template <typename ObjT>
+bool apply_patch(ObjT &object, std::string_view patch) {
+  return apply_patch(get_type_info(object), &object, patch);
+}
+
+}  // namespace coti
+}  // namespace tops
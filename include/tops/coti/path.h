@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <variant>
+#include <vector>
+
+/// Location of a value inside an object: the dict keys and array/list indices
+/// leading to it from the root.
+
+namespace tops {
+namespace coti {
+
+using PathElem = std::variant<std::string, size_t>;
+
+class Path {
+ public:
+  Path() = default;
+
+  Path &key(std::string_view key) {
+    elems.emplace_back(std::string(key));
+    return *this;
+  }
+
+  Path &index(size_t index) {
+    elems.emplace_back(index);
+    return *this;
+  }
+
+  // Drops the last element.
+  void pop() { elems.pop_back(); }
+
+  const std::vector<PathElem> &getElems() const { return elems; }
+
+  size_t size() const { return elems.size(); }
+
+  bool empty() const { return elems.empty(); }
+
+  bool operator==(const Path &other) const { return elems == other.elems; }
+
+  bool operator!=(const Path &other) const { return elems != other.elems; }
+
+ private:
+  std::vector<PathElem> elems;
+};
+
+}  // namespace coti
+}  // namespace tops
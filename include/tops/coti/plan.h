@@ -0,0 +1,59 @@
+#pragma once
+
+#include "nlohmann/json.hpp"
+#include "tops/coti/type_info.h"
+#include "tops/coti/type_trait.h"
+
+class msgpack_packer;
+class msgpack_object;
+
+/// Serialization plans: a TypeInfo tree compiled once into a flat op program
+/// that a small interpreter runs per object. Scalars become loads at fixed
+/// offsets, struct fields are inlined into their parent with precomputed
+/// key bytes, and only arrays re-enter the program per element. Lists,
+/// non-struct dicts and recursive types are left to the generic functions.
+/// The output is the same as to_msgpack/to_json in utils.h.
+
+namespace tops {
+namespace coti {
+
+class SerializationPlan;
+
+// Compiles the plan of `type_info` on first use. Plans are cached per TypeInfo
+// in its registry entry (see registry.h) for the lifetime of the process,
+// without a lock on hits.
+const SerializationPlan &get_plan(const TypeInfo &type_info);
+
+template <typename ObjT>
+const SerializationPlan &get_plan() {
+  static const SerializationPlan &plan = get_plan(get_type_info<ObjT>());
+  return plan;
+}
+
+void to_msgpack(const SerializationPlan &plan, const void *object,
+                msgpack_packer &packer);
+
+nlohmann::json to_json(const SerializationPlan &plan, const void *object);
+
+// Struct fields are matched in declaration order first, out of order keys
+// fall back to the struct's perfect hash.
+void from_msgpack(const SerializationPlan &plan, void *object,
+                  const msgpack_object &msg_obj);
+
+template <typename ObjT>
+void to_msgpack_planned(const ObjT &object, msgpack_packer &packer) {
+  return to_msgpack(get_plan<ObjT>(), &object, packer);
+}
+
+template <typename ObjT>
+nlohmann::json to_json_planned(const ObjT &object) {
+  return to_json(get_plan<ObjT>(), &object);
+}
+
+template <typename ObjT>
+void from_msgpack_planned(ObjT &object, const msgpack_object &msg_obj) {
+  return from_msgpack(get_plan<ObjT>(), &object, msg_obj);
+}
+
+}  // namespace coti
+}  // namespace tops
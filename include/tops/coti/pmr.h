@@ -0,0 +1,168 @@
+#pragma once
+
+#include <map>
+#include <memory>
+#include <memory_resource>
+#include <new>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "tops/coti/arena.h"
+#include "tops/coti/type_info.h"
+#include "tops/coti/type_trait.h"
+
+/// TypeInfos of std::pmr::string, std::pmr::vector<T> and
+/// std::pmr::map<std::pmr::string, T> (with std::less<> or the default
+/// comparator). Decoding into them under an ArenaScope allocates from the
+/// scope's arena, see arena.h.
+
+namespace tops {
+namespace coti {
+namespace impl {
+
+// Rebuilds `container` in place on the decode arena of this thread if there
+// is one and the container uses another resource. Its elements are moved
+// over; nested pmr containers follow through uses-allocator construction.
+template <typename ContainerT>
+ContainerT &adopt_decode_resource(const void *object) {
+  auto &container = *const_cast<ContainerT *>(
+      static_cast<const ContainerT *>(object));
+  auto *resource = get_decode_resource();
+  if (resource && container.get_allocator().resource() != resource) {
+    ContainerT moved(std::move(container), resource);
+    std::destroy_at(&container);
+    new (&container) ContainerT(std::move(moved));
+  }
+  return container;
+}
+
+struct PmrStringInfo : StringInfo {
+  PmrStringInfo() : StringInfo(sizeof(std::pmr::string)) {}
+
+  std::string_view get(const void *object) const override {
+    return *static_cast<const std::pmr::string *>(object);
+  }
+
+  void set(void *object, std::string_view val) const override {
+    adopt_decode_resource<std::pmr::string>(object).assign(val);
+  }
+};
+
+template <typename T>
+struct PmrVectorInfo : VectorInfo<std::pmr::vector<T>> {
+  void resize(const void *object, size_t newNumChild) const override {
+    adopt_decode_resource<std::pmr::vector<T>>(object).resize(newNumChild);
+  }
+};
+
+// Dict over a std::pmr::map with string keys, iterated in key order. The
+// iterator is heap allocated by beginIter() and freed by finishIter().
+template <typename MapT>
+struct PmrMapInfo : DictInfo {
+  PmrMapInfo()
+      : DictInfo(sizeof(MapT)),
+        valueInfo(get_type_info<typename MapT::mapped_type>()) {}
+
+  size_t getNumItems(const void *object) const override {
+    return asMap(object).size();
+  }
+
+  const void *beginIter(const void *object) const override {
+    return new typename MapT::iterator(asMap(object).begin());
+  }
+
+  bool isEndIter(const void *object, const void *iter) const override {
+    return asIter(iter) == asMap(object).end();
+  }
+
+  const void *nextIter(const void *, const void *iter) const override {
+    ++asIter(iter);
+    return iter;
+  }
+
+  std::string_view getKeyAtIter(const void *,
+                                const void *iter) const override {
+    return asIter(iter)->first;
+  }
+
+  TypedPtr getValueAtIter(const void *, const void *iter) const override {
+    return {&asIter(iter)->second, &valueInfo};
+  }
+
+  void finishIter(const void *, const void *iter) const override {
+    delete &asIter(iter);
+  }
+
+  TypedPtr getValueAt(const void *object,
+                      std::string_view key) const override {
+    auto &map = adopt_decode_resource<MapT>(object);
+    auto found = findKey(map, key);
+    if (found == map.end()) {
+      found = map.try_emplace(std::pmr::string(key, map.get_allocator()))
+                  .first;
+    }
+    return {&found->second, &valueInfo};
+  }
+
+  void eraseValueAt(const void *object, std::string_view key) const override {
+    auto &map = asMap(object);
+    auto found = findKey(map, key);
+    if (found != map.end()) {
+      map.erase(found);
+    }
+  }
+
+  const TypeInfo &valueInfo;
+
+ private:
+  static typename MapT::iterator findKey(MapT &map, std::string_view key) {
+    if constexpr (std::is_same_v<typename MapT::key_compare, std::less<>>) {
+      return map.find(key);
+    } else {
+      return map.find(std::pmr::string(key, map.get_allocator()));
+    }
+  }
+
+  static MapT &asMap(const void *object) {
+    return *const_cast<MapT *>(static_cast<const MapT *>(object));
+  }
+
+  static typename MapT::iterator &asIter(const void *iter) {
+    return *const_cast<typename MapT::iterator *>(
+        static_cast<const typename MapT::iterator *>(iter));
+  }
+};
+
+}  // namespace impl
+
+template <>
+struct TypeTrait<std::pmr::string> {
+  static const StringInfo &type_info() {
+    static const impl::PmrStringInfo info;
+    return info;
+  }
+};
+
+template <typename T>
+struct TypeTrait<std::pmr::vector<T>> {
+  static const ArrayInfo &type_info() {
+    static const impl::PmrVectorInfo<T> info;
+    return info;
+  }
+};
+
+template <typename T, typename CompareT>
+struct TypeTrait<std::pmr::map<std::pmr::string, T, CompareT>> {
+  static const DictInfo &type_info() {
+    static const impl::PmrMapInfo<
+        std::pmr::map<std::pmr::string, T, CompareT>>
+        info;
+    return info;
+  }
+};
+
+}  // namespace coti
+}  // namespace tops
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string>
+
+#include "tops/coti/type_info.h"
+#include "tops/coti/type_trait.h"
+
+/// Reading files of back-to-back msgpack records. A background I/O thread
+/// reads the file ahead in large chunks, and a decoder thread decodes objects
+/// straight out of them, so reading, decoding and the consumer's own work
+/// overlap. Both hand-offs are bounded queues: memory stays at numChunks
+/// chunks plus maxQueuedRecords decoded objects, however large the file.
+///
+/// The chunks are reused as soon as they are decoded, so views (Span,
+/// std::string_view) can't be decoded: a record holding one fails, see
+/// MsgPackRecordStream::isOk().
+
+namespace tops {
+namespace coti {
+
+struct RecordReaderOptions {
+  // Bytes per read.
+  size_t chunkSize = 4 << 20;
+  // Chunks in flight between the I/O and the decoder thread.
+  size_t numChunks = 4;
+  // Decoded objects waiting for the consumer.
+  size_t maxQueuedRecords = 256;
+};
+
+namespace impl {
+class RecordPipeline;
+}  // namespace impl
+
+// Reads records of one TypeInfo. Objects are made and freed through
+// ObjectOps, which the TypeInfo can't do itself.
+class MsgPackRecordStream {
+ public:
+  struct ObjectOps {
+    // Returns a new default-constructed object.
+    void *(*create)();
+    void (*destroy)(void *object);
+  };
+
+  // Starts reading `path`. Returns nullptr if it can't be opened.
+  static std::unique_ptr<MsgPackRecordStream> open(
+      const TypeInfo &type_info, ObjectOps ops, const std::string &path,
+      const RecordReaderOptions &options = {});
+
+  // Stops both threads; objects not taken yet are destroyed.
+  ~MsgPackRecordStream();
+
+  MsgPackRecordStream(const MsgPackRecordStream &) = delete;
+  MsgPackRecordStream &operator=(const MsgPackRecordStream &) = delete;
+
+  // Blocks for the next object, which the caller frees with
+  // ObjectOps::destroy. Returns nullptr after the last record, or on an
+  // error, see isOk().
+  void *next();
+
+  // False if reading the file failed or a record was malformed or truncated.
+  // The records before it have still been returned.
+  bool isOk() const;
+
+ private:
+  explicit MsgPackRecordStream(std::unique_ptr<impl::RecordPipeline> pipeline);
+
+  std::unique_ptr<impl::RecordPipeline> pipeline;
+};
+
+template <typename ObjT>
+class MsgPackRecordReader {
+ public:
+  static std::unique_ptr<MsgPackRecordReader> open(
+      const std::string &path, const RecordReaderOptions &options = {}) {
+    auto stream = MsgPackRecordStream::open(
+        get_type_info<ObjT>(), {&create, &destroy}, path, options);
+    if (!stream) {
+      return nullptr;
+    }
+    return std::unique_ptr<MsgPackRecordReader>(
+        new MsgPackRecordReader(std::move(stream)));
+  }
+
+  // Moves the next record into `object`. Returns false after the last
+  // record, or on an error, see isOk().
+  bool next(ObjT &object) {
+    auto *record = static_cast<ObjT *>(stream->next());
+    if (!record) {
+      return false;
+    }
+    object = std::move(*record);
+    delete record;
+    return true;
+  }
+
+  bool isOk() const { return stream->isOk(); }
+
+ private:
+  explicit MsgPackRecordReader(std::unique_ptr<MsgPackRecordStream> stream)
+      : stream(std::move(stream)) {}
+
+  static void *create() { return new ObjT{}; }
+
+  static void destroy(void *object) { delete static_cast<ObjT *>(object); }
+
+  std::unique_ptr<MsgPackRecordStream> stream;
+};
+
+}  // namespace coti
+}  // namespace tops
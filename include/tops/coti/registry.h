@@ -0,0 +1,56 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+#include "tops/coti/type_info.h"
+
+/// Process-wide registry of TypeInfos. A TypeInfo is registered on its first
+/// lookup with a 64-bit structural fingerprint; TypeInfos with equal
+/// fingerprints describe the same schema, so schema checks compare integers
+/// instead of walking TypeInfo graphs. The entry also caches data derived from
+/// its TypeInfo. Lookups of registered TypeInfos are lock-free, registration
+/// takes a lock.
+///
+/// The fingerprint hashes the byte order and, recursively, the kind, cpp size,
+/// bit width and sign of every TypeInfo reachable through Array children and
+/// struct fields, with struct field names and offsets. Strings, Lists and
+/// other Dicts don't describe their children statically and are told apart by
+/// their cpp TypeInfo class instead, e.g. a VectorInfo<...> instantiation, as
+/// are Arrays. Class names differ between builds, so fingerprints are only
+/// meaningful within one process.
+///
+/// Equal fingerprints mean the same data layout, not the same behavior:
+/// field defaults and Dict codecs aren't covered. Anything that calls into a
+/// TypeInfo, like a SerializationPlan, is cached per TypeInfo.
+///
+/// TypeInfos are expected to live until exit, as the TypeTrait singletons do.
+
+namespace tops {
+namespace coti {
+
+class SerializationPlan;
+
+struct TypeEntry {
+  const TypeInfo *type_info;
+  uint64_t fingerprint;
+  // Entry of the first registered TypeInfo with this fingerprint.
+  const TypeEntry *canonical;
+
+  // See get_plan().
+  mutable std::atomic<const SerializationPlan *> plan{nullptr};
+};
+
+// Returns the entry of `type_info`, registering it on first call.
+const TypeEntry &intern_type_info(const TypeInfo &type_info);
+
+inline uint64_t type_fingerprint(const TypeInfo &type_info) {
+  return intern_type_info(type_info).fingerprint;
+}
+
+inline bool same_schema(const TypeInfo &lhs, const TypeInfo &rhs) {
+  return &lhs == &rhs || type_fingerprint(lhs) == type_fingerprint(rhs);
+}
+
+}  // namespace coti
+}  // namespace tops
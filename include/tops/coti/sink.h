@@ -0,0 +1,96 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <ostream>
+#include <string>
+
+namespace tops {
+namespace coti {
+
+// Byte sink the streaming serializers write into. Writers batch their output,
+// so `write` is called with reasonably large blocks.
+class Sink {
+ public:
+  virtual ~Sink() = default;
+
+  virtual void write(const char *data, size_t size) = 0;
+};
+
+// Appends to a caller-owned std::string.
+class StringSink : public Sink {
+ public:
+  explicit StringSink(std::string &out) : out(out) {}
+
+  void write(const char *data, size_t size) override { out.append(data, size); }
+
+ private:
+  std::string &out;
+};
+
+class OStreamSink : public Sink {
+ public:
+  explicit OStreamSink(std::ostream &os) : os(os) {}
+
+  void write(const char *data, size_t size) override {
+    os.write(data, static_cast<std::streamsize>(size));
+  }
+
+ private:
+  std::ostream &os;
+};
+
+struct FileSinkOptions {
+  // Bytes per buffer. A full buffer is handed to the writer thread.
+  size_t bufferSize = 1 << 20;
+  // Buffers in total, at least 2: one being filled, the others queued or
+  // being written.
+  size_t numBuffers = 2;
+};
+
+namespace impl {
+class FileWriter;
+}  // namespace impl
+
+// Writes to a file from a background thread. Output is copied into a fixed
+// size buffer; full buffers are queued to the writer thread, which writes
+// everything queued with one writev() while the serializer fills the next
+// buffer. write() only blocks when all buffers are queued, so memory stays
+// at numBuffers * bufferSize.
+class FileSink : public Sink {
+ public:
+  // Creates or truncates `path`. Returns nullptr if it can't be opened.
+  static std::unique_ptr<FileSink> open(const std::string &path,
+                                        const FileSinkOptions &options = {});
+
+  // Calls close().
+  ~FileSink() override;
+
+  FileSink(const FileSink &) = delete;
+  FileSink &operator=(const FileSink &) = delete;
+
+  void write(const char *data, size_t size) override;
+
+  // Waits until everything written so far is in the file. Returns isOk().
+  bool flush();
+
+  // Flushes, stops the writer thread and closes the file. Returns isOk().
+  // Nothing may be written afterwards.
+  bool close();
+
+  // False once writing to the file failed. Output after the failure is
+  // dropped.
+  bool isOk() const;
+
+ private:
+  explicit FileSink(std::unique_ptr<impl::FileWriter> writer);
+
+  std::unique_ptr<impl::FileWriter> writer;
+  bool closedOk = true;
+  char *buf;
+  size_t bufPos = 0;
+  size_t bufSize;
+};
+
+}  // namespace coti
+}  // namespace tops
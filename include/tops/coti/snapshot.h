@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+
+#include "tops/coti/type_info.h"
+#include "tops/coti/type_trait.h"
+
+class msgpack_packer;
+
+/// Binary snapshots that copy fixed-layout data as raw memory. Only loadable
+/// into the same TypeInfo schema on a machine with the same byte order:
+///
+///   snapshot := "COTISNAP" || uint64_t schema fingerprint || value
+///
+/// A TypeInfo is raw if it is a Bool, an Int, a Float of any kind (a BFloat is
+/// copied as its 16 bits), an Array with isInline (std::array) of a raw
+/// child, or a StructInfo whose fields are all raw. A raw value is written as the bytes of its scalars, in memory order,
+/// with struct padding and unreflected members skipped; when nothing is
+/// skipped that is one memcpy of cppByteSize bytes. Everything else uses
+/// msgpack headers:
+/// - String: msgpack str.
+/// - Array of a raw child: msgpack array header, then the children as raw
+///   values back to back, i.e. one block for a vector of scalars or of
+///   padding-free structs. A view Array (Span) is a msgpack bin.
+/// - Any other Array, or a List: msgpack array header, then each child.
+/// - StructInfo: each field in declaration order, no keys.
+/// - Any other Dict: msgpack map header, then each key as a msgpack str
+///   followed by its value.
+///
+/// The fingerprint hashes a format version, the byte order and, recursively,
+/// the kind, cpp size, bit width and sign of every TypeInfo reachable through
+/// Array children and struct fields, with struct field names and offsets. The
+/// children of Lists and other Dicts aren't known without an object and
+/// aren't covered. Unlike type_fingerprint() in registry.h it is stable
+/// across builds.
+
+namespace tops {
+namespace coti {
+
+uint64_t snapshot_fingerprint(const TypeInfo &type_info);
+
+void save_snapshot(const TypeInfo &type_info, const void *object,
+                   msgpack_packer &packer);
+
+template <typename ObjT>
+void save_snapshot(const ObjT &object, msgpack_packer &packer) {
+  return save_snapshot(get_type_info(object), &object, packer);
+}
+
+// Returns false if `snapshot` is truncated, malformed or of another schema;
+// `object` may then be partially loaded. Views (Span) point into `snapshot`;
+// misaligned ones are copied into the current ArenaScope's arena, or fail to
+// load without one.
+bool load_snapshot(const TypeInfo &type_info, void *object,
+                   std::string_view snapshot);
+
+template <typename ObjT>
+bool load_snapshot(std::string_view snapshot, ObjT &object) {
+  return load_snapshot(get_type_info(object), &object, snapshot);
+}
+
+}  // namespace coti
+}  // namespace tops
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <type_traits>
+
+#include "tops/coti/type_info.h"
+#include "tops/coti/type_trait.h"
+
+/// Read-only arrays of scalars that point into a buffer owned by someone
+/// else, typically a MappedFile. A Span is packed as one msgpack bin of the
+/// raw little-endian elements, and decoding it from a borrowed buffer
+/// (MsgPackReader in buffer mode, or a msgpack_object over the input) points
+/// it at the payload without copying. The bin header doesn't align the
+/// payload, so a misaligned one is copied into the decode arena (arena.h).
+/// Other decoders, like from_json(), reject Spans.
+
+namespace tops {
+namespace coti {
+namespace impl {
+
+struct SpanRep {
+  const void *data;
+  size_t size;
+};
+
+}  // namespace impl
+
+template <typename T>
+class Span {
+  static_assert(std::is_arithmetic_v<T>, "Span elements are raw scalars");
+
+ public:
+  Span() : rep{nullptr, 0} {}
+
+  Span(const T *data, size_t size) : rep{data, size} {}
+
+  const T *data() const { return static_cast<const T *>(rep.data); }
+
+  size_t size() const { return rep.size; }
+
+  bool empty() const { return rep.size == 0; }
+
+  const T *begin() const { return data(); }
+
+  const T *end() const { return data() + rep.size; }
+
+  const T &operator[](size_t idx) const { return data()[idx]; }
+
+ private:
+  // First member so SpanInfo can access any Span<T> as an impl::SpanRep.
+  impl::SpanRep rep;
+};
+
+// ArrayInfo of Span<T>. It can't resize, only be pointed at existing
+// elements.
+class SpanInfo : public ArrayInfo {
+ public:
+  explicit SpanInfo(const TypeInfo &childInfo)
+      : ArrayInfo(sizeof(impl::SpanRep), childInfo) {
+    isView = true;
+  }
+
+  size_t getNumChilds(const void *object) const override {
+    return asRep(object).size;
+  }
+
+  void resize(const void *object, size_t newNumChild) const override {
+    assert(newNumChild == getNumChilds(object) && "a Span can't own elements");
+  }
+
+  const void *getChildBegin(const void *object) const override {
+    return asRep(object).data;
+  }
+
+  // Points the span at the raw elements in `bytes`. A payload that is not
+  // aligned for the element type is copied into the arena of the current
+  // ArenaScope instead. Returns false if the size is not a multiple of the
+  // element size, or the payload is misaligned and there is no ArenaScope.
+  bool setView(void *object, std::string_view bytes) const;
+
+ private:
+  static const impl::SpanRep &asRep(const void *object) {
+    return *static_cast<const impl::SpanRep *>(object);
+  }
+};
+
+template <typename T>
+struct TypeTrait<Span<T>> {
+  static const SpanInfo &type_info() {
+    static_assert(sizeof(Span<T>) == sizeof(impl::SpanRep) &&
+                  std::is_standard_layout_v<Span<T>>);
+    static const SpanInfo info(get_type_info<T>());
+    return info;
+  }
+};
+
+}  // namespace coti
+}  // namespace tops
@@ -0,0 +1,206 @@
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#include "tops/coti/type_info.h"
+
+/// Runtime support for the DictInfo tables coti_gen emits for cpp structs.
+
+namespace tops {
+namespace coti {
+
+struct FieldInfo {
+  std::string_view name;
+  uint32_t offset;
+  uint32_t size;
+  // A function rather than a reference, so the tables don't depend on the
+  // initialization order of the child TypeInfo singletons.
+  const TypeInfo &(*getTypeInfo)();
+  // Resets the field to its value in a default-constructed struct. Decoders
+  // call it for fields missing from the input, so that objects written by an
+  // older schema decode to defaults; when null the field is left untouched.
+  void (*setDefault)(void *field) = nullptr;
+};
+
+// A default-constructed T, the source of FieldInfo::setDefault.
+template <typename T>
+const T &get_default() {
+  static const T value{};
+  return value;
+}
+
+// FieldInfo::setDefault of `Member`, as coti_gen emits it. A no-op when there
+// is no default to copy.
+template <typename StructT, typename FieldT, FieldT StructT::*Member>
+void set_default_field(void *field) {
+  if constexpr (std::is_default_constructible_v<StructT> &&
+                std::is_copy_assignable_v<FieldT>) {
+    *static_cast<FieldT *>(field) = get_default<StructT>().*Member;
+  }
+}
+
+// set_default_field(), or null when it would be a no-op, so that structs that
+// can't be default-constructed still serialize.
+template <typename StructT, typename FieldT, FieldT StructT::*Member>
+constexpr auto get_set_default_field() -> void (*)(void *) {
+  if constexpr (std::is_default_constructible_v<StructT> &&
+                std::is_copy_assignable_v<FieldT>) {
+    return &set_default_field<StructT, FieldT, Member>;
+  } else {
+    return nullptr;
+  }
+}
+
+// Which fields of one struct object a decoder has set.
+class SeenFields {
+ public:
+  explicit SeenFields(uint32_t numFields) {
+    if (numFields > 64) {
+      large.resize(numFields);
+    }
+  }
+
+  void set(uint32_t idx) {
+    if (large.empty()) {
+      small |= uint64_t(1) << idx;
+    } else {
+      large[idx] = true;
+    }
+  }
+
+  bool test(uint32_t idx) const {
+    return large.empty() ? (small >> idx) & 1 : bool(large[idx]);
+  }
+
+ private:
+  uint64_t small = 0;
+  std::vector<bool> large;
+};
+
+// Seeded FNV-1a with a final avalanche. coti_gen searches for a seed with
+// which every field name of a struct lands in its own slot; the same function
+// is evaluated on incoming keys at runtime.
+constexpr uint32_t struct_key_hash(std::string_view key, uint32_t seed) {
+  uint32_t hash = 2166136261u ^ (seed * 0x9e3779b9u);
+  for (char c : key) {
+    hash ^= static_cast<uint8_t>(c);
+    hash *= 16777619u;
+  }
+  hash ^= hash >> 16;
+  hash *= 0x85ebca6bu;
+  hash ^= hash >> 13;
+  return hash;
+}
+
+// DictInfo of a cpp struct with a fixed set of fields. Items are iterated in
+// declaration order, the iterator is a pointer into the field table.
+class StructInfo : public DictInfo {
+ public:
+  // `slots` has `numSlots` (a power of 2) entries, each the index of the field
+  // whose name hashes there under `seed`, or -1.
+  StructInfo(uint32_t cppByteSize, const FieldInfo *fields, uint32_t numFields,
+             const int32_t *slots, uint32_t numSlots, uint32_t seed)
+      : DictInfo(cppByteSize),
+        fields(fields),
+        numFields(numFields),
+        slots(slots),
+        slotMask(numSlots - 1),
+        seed(seed) {
+    assert((numSlots & slotMask) == 0);
+    isStruct = true;
+    for (uint32_t idx = 0; idx < numFields; ++idx) {
+      hasDefaults = hasDefaults || fields[idx].setDefault;
+    }
+  }
+
+  const FieldInfo *getFields() const { return fields; }
+
+  uint32_t getNumFields() const { return numFields; }
+
+  // Index of the field named `key`, or -1. One hash, one table load and one
+  // string compare.
+  int32_t findField(std::string_view key) const {
+    auto slot = slots[struct_key_hash(key, seed) & slotMask];
+    if (slot < 0 || fields[slot].name != key) {
+      return -1;
+    }
+    return slot;
+  }
+
+  TypedPtr getFieldAt(const void *object, uint32_t idx) const {
+    return getFieldPtr(object, fields[idx]);
+  }
+
+  // Whether any field has a setDefault; decoders only track the fields they
+  // have seen if so.
+  bool getHasDefaults() const { return hasDefaults; }
+
+  // Default-fills the fields not in `seen`.
+  void fillMissing(void *object, const SeenFields &seen) const {
+    for (uint32_t idx = 0; idx < numFields; ++idx) {
+      if (!seen.test(idx) && fields[idx].setDefault) {
+        fields[idx].setDefault(static_cast<char *>(object) +
+                               fields[idx].offset);
+      }
+    }
+  }
+
+  size_t getNumItems(const void *) const override { return numFields; }
+
+  const void *beginIter(const void *) const override { return fields; }
+
+  bool isEndIter(const void *, const void *iter) const override {
+    return iter == fields + numFields;
+  }
+
+  const void *nextIter(const void *, const void *iter) const override {
+    return asField(iter) + 1;
+  }
+
+  std::string_view getKeyAtIter(const void *,
+                                const void *iter) const override {
+    return asField(iter)->name;
+  }
+
+  TypedPtr getValueAtIter(const void *object,
+                          const void *iter) const override {
+    return getFieldPtr(object, *asField(iter));
+  }
+
+  void finishIter(const void *, const void *) const override {}
+
+  TypedPtr getValueAt(const void *object, std::string_view key) const override {
+    auto idx = findField(key);
+    assert(idx >= 0 && "unknown struct field");
+    return getFieldPtr(object, fields[idx]);
+  }
+
+  void eraseValueAt(const void *, std::string_view) const override {
+    assert(false && "struct fields can't be erased");
+  }
+
+ private:
+  static const FieldInfo *asField(const void *iter) {
+    return static_cast<const FieldInfo *>(iter);
+  }
+
+  static TypedPtr getFieldPtr(const void *object, const FieldInfo &field) {
+    auto *ptr = static_cast<const char *>(object) + field.offset;
+    return {const_cast<char *>(ptr), &field.getTypeInfo()};
+  }
+
+  const FieldInfo *fields;
+  uint32_t numFields;
+  const int32_t *slots;
+  uint32_t slotMask;
+  uint32_t seed;
+  bool hasDefaults = false;
+};
+
+}  // namespace coti
+}  // namespace tops
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace tops {
+namespace coti {
+
+// Fixed set of worker threads running queued tasks in FIFO order.
+class ThreadPool {
+ public:
+  explicit ThreadPool(size_t numThreads);
+
+  // Finishes the queued tasks, then joins the workers.
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  size_t getNumThreads() const { return threads.size(); }
+
+  void submit(std::function<void()> task);
+
+  // Runs `fn(0)` .. `fn(numTasks - 1)` on the workers and the calling thread,
+  // and returns once all of them have finished. The caller takes part, so
+  // calling this from inside a task can't deadlock.
+  void parallelFor(size_t numTasks, const std::function<void(size_t)> &fn);
+
+  // Process-wide pool with one thread per hardware thread.
+  static ThreadPool &getDefault();
+
+ private:
+  void workerLoop();
+
+  std::mutex mutex;
+  std::condition_variable cv;
+  std::deque<std::function<void()>> tasks;
+  bool stopping = false;
+  std::vector<std::thread> threads;
+};
+
+class TaskGroup;
+
+// Pool for fork-join work: every worker has its own deque, pushes and pops
+// spawned tasks at the back, and steals from the front of the others when it
+// runs dry. Tasks are spawned and waited for through a TaskGroup.
+class WorkStealingPool {
+ public:
+  explicit WorkStealingPool(size_t numThreads);
+
+  ~WorkStealingPool();
+
+  WorkStealingPool(const WorkStealingPool &) = delete;
+  WorkStealingPool &operator=(const WorkStealingPool &) = delete;
+
+  size_t getNumThreads() const { return threads.size(); }
+
+  // Process-wide pool with one thread per hardware thread.
+  static WorkStealingPool &getDefault();
+
+ private:
+  friend class TaskGroup;
+
+  struct Task {
+    const TaskGroup *group;
+    std::function<void()> fn;
+  };
+
+  struct Worker {
+    std::mutex mutex;
+    std::deque<Task> tasks;
+  };
+
+  // Onto the calling worker's own deque, or round-robin from other threads.
+  void push(const TaskGroup *group, std::function<void()> fn);
+
+  // Runs one task, the newest of the calling worker's own deque or else the
+  // oldest stolen from another. With `onlyGroup`, only the newest task of the
+  // own deque is taken, and only if it belongs to that group. Returns false
+  // if nothing was run.
+  bool runOne(const TaskGroup *onlyGroup = nullptr);
+
+  void workerLoop(size_t workerIdx);
+
+  std::vector<std::unique_ptr<Worker>> workers;
+  std::vector<std::thread> threads;
+  std::atomic<size_t> numQueued{0};
+  std::atomic<size_t> nextWorker{0};
+  std::mutex sleepMutex;
+  std::condition_variable sleepCv;
+  bool stopping = false;
+};
+
+// A set of tasks spawned on a WorkStealingPool. wait() runs queued tasks until
+// all of the group's tasks are done, so tasks may spawn and wait for nested
+// groups. Waits nested deeper than kMaxStealDepth on one thread only run
+// their own group's tasks, which bounds the stack growth from stealing.
+class TaskGroup {
+ public:
+  explicit TaskGroup(WorkStealingPool &pool) : pool(pool) {}
+
+  ~TaskGroup() { wait(); }
+
+  TaskGroup(const TaskGroup &) = delete;
+  TaskGroup &operator=(const TaskGroup &) = delete;
+
+  void spawn(std::function<void()> task);
+
+  void wait();
+
+  static constexpr size_t kMaxStealDepth = 8;
+
+ private:
+  WorkStealingPool &pool;
+  std::atomic<size_t> numPending{0};
+};
+
+}  // namespace coti
+}  // namespace tops
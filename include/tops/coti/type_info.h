@@ -11,6 +11,11 @@
 #include <cstdint>
 #include <string_view>
 
+#include "nlohmann/json_fwd.hpp"
+
+class msgpack_packer;
+class msgpack_object;
+
 namespace tops {
 namespace coti {
 class Hasher;
@@ -148,6 +153,11 @@ struct StringInfo : TypeInfo {
   virtual void set(void *object, std::string_view val) const = 0;
 
   using JsonValType = std::string_view;
+
+  // Set by the std::string_view TypeInfo: set() keeps the view itself, so it
+  // is only decoded from input that outlives the object, i.e. a msgpack_object
+  // or a borrowed MsgPackReader buffer, and rejected by every other decoder.
+  bool isView = false;
 };
 
 // LLimitation: child elements are assumed to have contiguous storage.
@@ -161,10 +171,20 @@ struct ArrayInfo : TypeInfo {
   virtual const void *getChildBegin(const void *object) const = 0;
 
   void *getChildBegin(void *object) const {
-    return const_cast<void *>(getChildBegin(object));
+    return const_cast<void *>(
+        getChildBegin(static_cast<const void *>(object)));
   }
 
   const TypeInfo &childInfo;
+
+  // Set by SpanInfo: the elements are viewed, not owned, and packed as one
+  // msgpack bin.
+  bool isView = false;
+
+  // Set by StdArrayInfo: the object is its elements, i.e. getChildBegin()
+  // returns the object itself and there are always cppByteSize /
+  // childInfo.cppByteSize of them.
+  bool isInline = false;
 };
 
 struct TypedPtr {
@@ -181,9 +201,26 @@ struct ListInfo : TypeInfo {
   virtual TypedPtr getChildAt(const void *object, size_t childIdx) const = 0;
 };
 
+// Serializers specialized for one concrete dict type, e.g. the straight-line
+// functions coti_gen emits for a struct. When set, the generic to_msgpack,
+// from_msgpack, to_json and hash call them instead of walking the items.
+struct DictCodecs {
+  void (*toMsgPack)(const void *object, msgpack_packer &packer);
+  void (*fromMsgPack)(void *object, const msgpack_object &msg_obj);
+  nlohmann::json (*toJson)(const void *object);
+  void (*hash)(const void *object, Hasher &hasher);
+};
+
 struct DictInfo : TypeInfo {
   DictInfo(uint32_t cppByteSize) : TypeInfo(OK_Dict, cppByteSize) {}
 
+  const DictCodecs *codecs = nullptr;
+
+  // Set by StructInfo, whose items are a fixed set of fields at fixed offsets.
+  bool isStruct = false;
+
+  void setCodecs(const DictCodecs *newCodecs) { codecs = newCodecs; }
+
   virtual size_t getNumItems(const void *object) const = 0;
 
   virtual const void *beginIter(const void *object) const = 0;
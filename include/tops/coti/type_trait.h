@@ -1,6 +1,7 @@
 #pragma once
 
 #include <array>
+#include <cassert>
 #include <string>
 #include <string_view>
 #include <type_traits>
@@ -13,8 +14,6 @@ namespace coti {
 namespace impl {
 const StringInfo& getStdStrigTypeInfo();
 const StringInfo& getStdStrigViewTypeInfo();
-const ArrayInfo& getStdVectorTypeInfo();
-const ArrayInfo& getStdArrayTypeInfo();
 }  // namespace impl
 
 template <typename ObjT, typename = void>
@@ -32,12 +31,12 @@ const TypeInfo& get_type_info(const ObjT&) {
 
 template <>
 struct TypeTrait<bool> {
-  const BoolInfo& type_info() { return BoolInfo::getSingleton(); }
+  static const BoolInfo& type_info() { return BoolInfo::getSingleton(); }
 };
 
 template <typename T>
 struct TypeTrait<T, std::enable_if_t<std::is_integral_v<T>>> {
-  const IntegerInfo& type_info() {
+  static const IntegerInfo& type_info() {
     if constexpr (std::is_signed_v<T>) {
       return IntegerInfo::getSBitIntInfo(sizeof(T) * CHAR_BIT);
     } else {
@@ -49,29 +48,85 @@ struct TypeTrait<T, std::enable_if_t<std::is_integral_v<T>>> {
 template <typename T>
 struct TypeTrait<T, std::enable_if_t<std::is_same_v<T, double> ||
                                      std::is_same_v<T, float>>> {
-  const FloatInfo& type_info() {
+  static const FloatInfo& type_info() {
     return FloatInfo::getSingleton(sizeof(T) * CHAR_BIT, FloatInfo::IEEE);
   }
 };
 
 template <>
 struct TypeTrait<std::string> {
-  const StringInfo& type_info() { return impl::getStdStrigTypeInfo(); }
+  static const StringInfo& type_info() { return impl::getStdStrigTypeInfo(); }
 };
 
 template <>
 struct TypeTrait<std::string_view> {
-  const StringInfo& type_info() { return impl::getStdStrigViewTypeInfo(); }
+  static const StringInfo& type_info() {
+    return impl::getStdStrigViewTypeInfo();
+  }
+};
+
+namespace impl {
+
+// ArrayInfo of a contiguous container with data(), size() and resize(), e.g.
+// std::vector and std::pmr::vector.
+template <typename VectorT>
+struct VectorInfo : ArrayInfo {
+  using ElemT = typename VectorT::value_type;
+  static_assert(!std::is_same_v<ElemT, bool>,
+                "std::vector<bool> has no contiguous storage");
+
+  VectorInfo() : ArrayInfo(sizeof(VectorT), get_type_info<ElemT>()) {}
+
+  size_t getNumChilds(const void* object) const override {
+    return asVector(object).size();
+  }
+
+  void resize(const void* object, size_t newNumChild) const override {
+    asVector(object).resize(newNumChild);
+  }
+
+  const void* getChildBegin(const void* object) const override {
+    return asVector(object).data();
+  }
+
+  static VectorT& asVector(const void* object) {
+    return *const_cast<VectorT*>(static_cast<const VectorT*>(object));
+  }
 };
 
+template <typename T, size_t N>
+struct StdArrayInfo : ArrayInfo {
+  StdArrayInfo() : ArrayInfo(sizeof(std::array<T, N>), get_type_info<T>()) {
+    isInline = sizeof(std::array<T, N>) == N * sizeof(T);
+  }
+
+  size_t getNumChilds(const void*) const override { return N; }
+
+  void resize(const void*, size_t newNumChild) const override {
+    assert(newNumChild == N && "std::array has a fixed size");
+  }
+
+  const void* getChildBegin(const void* object) const override {
+    return static_cast<const std::array<T, N>*>(object)->data();
+  }
+};
+
+}  // namespace impl
+
 template <typename T>
 struct TypeTrait<std::vector<T>> {
-  const ArrayInfo& type_info() { return impl::getStdVectorTypeInfo(); }
+  static const ArrayInfo& type_info() {
+    static const impl::VectorInfo<std::vector<T>> info;
+    return info;
+  }
 };
 
 template <typename T, size_t N>
 struct TypeTrait<std::array<T, N>> {
-  const ArrayInfo& type_info() { return impl::getStdArrayTypeInfo(); }
+  static const ArrayInfo& type_info() {
+    static const impl::StdArrayInfo<T, N> info;
+    return info;
+  }
 };
 
 }  // namespace coti
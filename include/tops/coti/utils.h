@@ -2,9 +2,12 @@
 
 #include <array>
 #include <cstdint>
+#include <istream>
 #include <ostream>
+#include <string_view>
 
 #include "nlohmann/json.hpp"
+#include "tops/coti/sink.h"
 #include "tops/coti/type_info.h"
 #include "tops/coti/type_trait.h"
 
@@ -24,6 +27,16 @@ nlohmann::json to_json(const ObjT &object) {
   return to_json(get_type_info(object), &object);
 }
 
+// Writes compact json text to `sink` without building a nlohmann::json tree.
+// Same as to_json(...).dump(), except that dict keys aren't sorted and floats
+// are printed in the shortest form that round-trips through their own width.
+void to_json_stream(const TypeInfo &type_info, const void *object, Sink &sink);
+
+template <typename ObjT>
+void to_json_stream(const ObjT &object, Sink &sink) {
+  return to_json_stream(get_type_info(object), &object, sink);
+}
+
 void from_json(const TypeInfo &type_info, void *object,
                const nlohmann::json &json);
 
@@ -34,6 +47,19 @@ ObjT from_json(const nlohmann::json &json) {
   return object;
 }
 
+// Parses json text straight into `object`, without building a nlohmann::json
+// tree. Returns false on malformed text or a value that doesn't match the
+// TypeInfo; `object` may be partially filled in that case.
+bool from_json_sax(const TypeInfo &type_info, void *object,
+                   std::string_view json);
+
+bool from_json_sax(const TypeInfo &type_info, void *object, std::istream &json);
+
+template <typename ObjT>
+bool from_json_sax(std::string_view json, ObjT &object) {
+  return from_json_sax(get_type_info(object), &object, json);
+}
+
 void to_msgpack(const TypeInfo &type_info, const void *object,
                 msgpack_packer &packer);
 
@@ -42,8 +68,22 @@ void to_msgpack(const ObjT &object, msgpack_packer &packer) {
   return to_msgpack(get_type_info(object), &object, packer);
 }
 
-// TODO: improve the implementation such that we don't have to construct a full
-// msgpack_object in memory.
+// Writes msgpack to `sink` in blocks, without building it in memory first.
+void to_msgpack_stream(const TypeInfo &type_info, const void *object,
+                       Sink &sink);
+
+template <typename ObjT>
+void to_msgpack_stream(const ObjT &object, Sink &sink) {
+  return to_msgpack_stream(get_type_info(object), &object, sink);
+}
+
+// Packer callback writing to the Sink in the packer's data, e.g.
+// `msgpack_packer packer{&sink, &sink_packer_write}`. The packer writes each
+// token separately, so the sink should buffer, as FileSink does.
+int sink_packer_write(void *sink, const char *data, size_t size);
+
+// Requires the whole payload to be unpacked into a msgpack_object first. See
+// msgpack_reader.h for a decoder that reads straight from the encoded bytes.
 void from_msgpack(const TypeInfo &type_info, void *object,
                   const msgpack_object &msg_obj);
 
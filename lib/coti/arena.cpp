@@ -0,0 +1,20 @@
+#include "tops/coti/arena.h"
+
+namespace tops {
+namespace coti {
+namespace {
+
+thread_local std::pmr::memory_resource *decodeResource = nullptr;
+
+}  // namespace
+
+ArenaScope::ArenaScope(DecodeArena &arena) : prevResource(decodeResource) {
+  decodeResource = arena.getResource();
+}
+
+ArenaScope::~ArenaScope() { decodeResource = prevResource; }
+
+std::pmr::memory_resource *get_decode_resource() { return decodeResource; }
+
+}  // namespace coti
+}  // namespace tops
@@ -0,0 +1,127 @@
+#include "tops/coti/batch.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <string>
+
+#include "msgpack.h"
+#include "tops/coti/msgpack_reader.h"
+#include "tops/coti/plan.h"
+
+namespace tops {
+namespace coti {
+namespace {
+
+// Fewer objects than this per slice cost more in scheduling and stitching
+// than they gain.
+constexpr size_t kMinSliceObjects = 64;
+
+// A few slices per thread, so threads that finish early pick up the rest.
+constexpr size_t kSlicesPerThread = 4;
+
+size_t get_num_slices(size_t numObjects, const ThreadPool &pool) {
+  size_t maxSlices = (pool.getNumThreads() + 1) * kSlicesPerThread;
+  return std::clamp<size_t>(numObjects / kMinSliceObjects, 1, maxSlices);
+}
+
+size_t get_slice_begin(size_t numObjects, size_t numSlices, size_t slice) {
+  return numObjects * slice / numSlices;
+}
+
+int append_to_string(void *data, const char *buf, size_t len) {
+  static_cast<std::string *>(data)->append(buf, len);
+  return 0;
+}
+
+}  // namespace
+
+void to_msgpack_batch(const TypeInfo &type_info, const void *objects,
+                      size_t numObjects, msgpack_packer &packer,
+                      ThreadPool &pool) {
+  auto &plan = get_plan(type_info);
+  auto *begin = static_cast<const char *>(objects);
+  auto objSize = type_info.cppByteSize;
+  size_t numSlices = get_num_slices(numObjects, pool);
+  std::vector<std::string> buffers(numSlices);
+  pool.parallelFor(numSlices, [&](size_t slice) {
+    msgpack_packer slicePacker{&buffers[slice], append_to_string};
+    size_t sliceEnd = get_slice_begin(numObjects, numSlices, slice + 1);
+    for (size_t idx = get_slice_begin(numObjects, numSlices, slice);
+         idx < sliceEnd; ++idx) {
+      to_msgpack(plan, begin + idx * objSize, slicePacker);
+    }
+  });
+  msgpack_pack_array(&packer, numObjects);
+  for (auto &buffer : buffers) {
+    packer.callback(packer.data, buffer.data(), buffer.size());
+  }
+}
+
+void from_msgpack_batch(const ArrayInfo &arrayInfo, void *object,
+                        const msgpack_object &msg_obj, ThreadPool &pool) {
+  assert(msg_obj.type == MSGPACK_OBJECT_ARRAY);
+  auto array = msg_obj.via.array;
+  arrayInfo.resize(object, array.size);
+  auto &plan = get_plan(arrayInfo.childInfo);
+  auto *begin = static_cast<char *>(arrayInfo.getChildBegin(object));
+  auto objSize = arrayInfo.childInfo.cppByteSize;
+  size_t numSlices = get_num_slices(array.size, pool);
+  pool.parallelFor(numSlices, [&](size_t slice) {
+    size_t sliceEnd = get_slice_begin(array.size, numSlices, slice + 1);
+    for (size_t idx = get_slice_begin(array.size, numSlices, slice);
+         idx < sliceEnd; ++idx) {
+      from_msgpack(plan, begin + idx * objSize, array.ptr[idx]);
+    }
+  });
+}
+
+bool from_msgpack_batch(const ArrayInfo &arrayInfo, void *object,
+                        std::string_view data, ThreadPool &pool) {
+  MsgPackReader reader(data);
+  MsgPackToken token;
+  if (!reader.next(token) || token.kind != MsgPackToken::Array) {
+    return false;
+  }
+  size_t numObjects = token.size;
+  size_t numSlices = get_num_slices(numObjects, pool);
+  // Byte offset of the first element of each slice, and of the end.
+  std::vector<size_t> sliceOffsets;
+  sliceOffsets.reserve(numSlices + 1);
+  for (size_t slice = 0; slice < numSlices; ++slice) {
+    sliceOffsets.push_back(reader.getOffset());
+    size_t sliceSize = get_slice_begin(numObjects, numSlices, slice + 1) -
+                       get_slice_begin(numObjects, numSlices, slice);
+    for (size_t idx = 0; idx < sliceSize; ++idx) {
+      if (!reader.skip()) {
+        return false;
+      }
+    }
+  }
+  sliceOffsets.push_back(reader.getOffset());
+  if (!reader.atEnd()) {
+    return false;
+  }
+
+  arrayInfo.resize(object, numObjects);
+  auto &childInfo = arrayInfo.childInfo;
+  auto *begin = static_cast<char *>(arrayInfo.getChildBegin(object));
+  std::atomic<bool> failed{false};
+  pool.parallelFor(numSlices, [&](size_t slice) {
+    MsgPackReader sliceReader(data.substr(
+        sliceOffsets[slice], sliceOffsets[slice + 1] - sliceOffsets[slice]));
+    size_t sliceEnd = get_slice_begin(numObjects, numSlices, slice + 1);
+    for (size_t idx = get_slice_begin(numObjects, numSlices, slice);
+         idx < sliceEnd; ++idx) {
+      if (!from_msgpack(childInfo, begin + idx * childInfo.cppByteSize,
+                        sliceReader)) {
+        failed = true;
+        return;
+      }
+    }
+  });
+  return !failed;
+}
+
+}  // namespace coti
+}  // namespace tops
@@ -0,0 +1,107 @@
+#include "tops/coti/counted_new.h"
+
+#include <cstdlib>
+#include <new>
+
+namespace {
+
+// Plain thread_local, so it can be bumped from operator new at any time.
+thread_local uint64_t threadAllocs = 0;
+
+void *counted_alloc(size_t size) {
+  ++threadAllocs;
+  if (size == 0) {
+    size = 1;
+  }
+  for (;;) {
+    if (void *ptr = std::malloc(size)) {
+      return ptr;
+    }
+    auto handler = std::get_new_handler();
+    if (!handler) {
+      throw std::bad_alloc();
+    }
+    handler();
+  }
+}
+
+void *counted_alloc_nothrow(size_t size) noexcept {
+  try {
+    return counted_alloc(size);
+  } catch (const std::bad_alloc &) {
+    return nullptr;
+  }
+}
+
+void *counted_aligned_alloc(size_t size, std::align_val_t align) {
+  ++threadAllocs;
+  auto alignment = static_cast<size_t>(align);
+  size = (size + alignment - 1) / alignment * alignment;
+  if (size == 0) {
+    size = alignment;
+  }
+  if (void *ptr = std::aligned_alloc(alignment, size)) {
+    return ptr;
+  }
+  throw std::bad_alloc();
+}
+
+}  // namespace
+
+namespace tops {
+namespace coti {
+
+uint64_t counted_new_thread_allocs() { return threadAllocs; }
+
+}  // namespace coti
+}  // namespace tops
+
+void *operator new(size_t size) { return counted_alloc(size); }
+
+void *operator new[](size_t size) { return counted_alloc(size); }
+
+void *operator new(size_t size, std::align_val_t align) {
+  return counted_aligned_alloc(size, align);
+}
+
+void *operator new[](size_t size, std::align_val_t align) {
+  return counted_aligned_alloc(size, align);
+}
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept {
+  return counted_alloc_nothrow(size);
+}
+
+void *operator new[](size_t size, const std::nothrow_t &) noexcept {
+  return counted_alloc_nothrow(size);
+}
+
+void operator delete(void *ptr) noexcept { std::free(ptr); }
+
+void operator delete[](void *ptr) noexcept { std::free(ptr); }
+
+void operator delete(void *ptr, size_t) noexcept { std::free(ptr); }
+
+void operator delete[](void *ptr, size_t) noexcept { std::free(ptr); }
+
+void operator delete(void *ptr, std::align_val_t) noexcept { std::free(ptr); }
+
+void operator delete[](void *ptr, std::align_val_t) noexcept {
+  std::free(ptr);
+}
+
+void operator delete(void *ptr, const std::nothrow_t &) noexcept {
+  std::free(ptr);
+}
+
+void operator delete[](void *ptr, const std::nothrow_t &) noexcept {
+  std::free(ptr);
+}
+
+void operator delete(void *ptr, size_t, std::align_val_t) noexcept {
+  std::free(ptr);
+}
+
+void operator delete[](void *ptr, size_t, std::align_val_t) noexcept {
+  std::free(ptr);
+}
@@ -0,0 +1,95 @@
+#include "fingerprint.h"
+
+#include <algorithm>
+#include <typeinfo>
+
+#include "tops/coti/struct_info.h"
+
+namespace tops {
+namespace coti {
+namespace impl {
+
+uint64_t Fingerprinter::run(const TypeInfo &type_info,
+                            std::string_view header) {
+  hasher.reinit();
+  if (!header.empty()) {
+    hasher.update(header.data(), header.size());
+  }
+  // Differs between byte orders.
+  hasher.update(uint32_t(0x01020304));
+  add(type_info);
+  return hasher.finalize();
+}
+
+void Fingerprinter::add(const TypeInfo &type_info) {
+  // A struct reached again through one of its own fields' children.
+  auto iter = std::find(stack.begin(), stack.end(), &type_info);
+  if (iter != stack.end()) {
+    hasher.update(uint8_t(0xff));
+    hasher.update(uint64_t(iter - stack.begin()));
+    return;
+  }
+  stack.push_back(&type_info);
+  hasher.update(uint8_t(type_info.kind));
+  hasher.update(uint32_t(type_info.cppByteSize));
+  switch (type_info.kind) {
+    case OK_Int: {
+      auto &intInfo = static_cast<const IntegerInfo &>(type_info);
+      hasher.update(uint8_t(intInfo.isSigned()));
+      hasher.update(uint32_t(intInfo.getBitWidth()));
+      break;
+    }
+    case OK_Float: {
+      auto &floatInfo = static_cast<const FloatInfo &>(type_info);
+      hasher.update(uint8_t(floatInfo.getKind()));
+      hasher.update(uint32_t(floatInfo.getBitWidth()));
+      break;
+    }
+    case OK_String:
+    case OK_List:
+      addClassName(type_info);
+      break;
+    case OK_Array: {
+      auto &arrayInfo = static_cast<const ArrayInfo &>(type_info);
+      addClassName(type_info);
+      hasher.update(uint8_t(arrayInfo.isView));
+      hasher.update(uint8_t(arrayInfo.isInline));
+      add(arrayInfo.childInfo);
+      break;
+    }
+    case OK_Dict: {
+      auto &dictInfo = static_cast<const DictInfo &>(type_info);
+      hasher.update(uint8_t(dictInfo.isStruct));
+      if (!dictInfo.isStruct) {
+        addClassName(type_info);
+        break;
+      }
+      auto &structInfo = static_cast<const StructInfo &>(dictInfo);
+      hasher.update(uint32_t(structInfo.getNumFields()));
+      for (uint32_t idx = 0; idx < structInfo.getNumFields(); ++idx) {
+        auto &field = structInfo.getFields()[idx];
+        hasher.update(uint64_t(field.name.size()));
+        hasher.update(field.name.data(), field.name.size());
+        hasher.update(uint32_t(field.offset));
+        add(field.getTypeInfo());
+      }
+      break;
+    }
+    default:
+      break;
+  }
+  stack.pop_back();
+}
+
+void Fingerprinter::addClassName(const TypeInfo &type_info) {
+  if (!withClassNames) {
+    return;
+  }
+  std::string_view name = typeid(type_info).name();
+  hasher.update(uint64_t(name.size()));
+  hasher.update(name.data(), name.size());
+}
+
+}  // namespace impl
+}  // namespace coti
+}  // namespace tops
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+#include "tops/coti/hash.h"
+#include "tops/coti/type_info.h"
+
+namespace tops {
+namespace coti {
+namespace impl {
+
+// Hashes the byte order and, recursively, the kind, cpp size, bit width and
+// sign of every TypeInfo reachable through Array children and struct fields,
+// with struct field names and offsets. Shared by type_fingerprint() and
+// snapshot_fingerprint(), which differ only in the options.
+class Fingerprinter {
+ public:
+  // `withClassNames` also hashes the TypeInfo class of every String, List,
+  // Array and non-struct Dict, which tells containers with the same shape
+  // apart but differs between builds.
+  explicit Fingerprinter(bool withClassNames)
+      : withClassNames(withClassNames) {}
+
+  // `header` is hashed first, e.g. a format version.
+  uint64_t run(const TypeInfo &type_info, std::string_view header = {});
+
+ private:
+  void add(const TypeInfo &type_info);
+
+  void addClassName(const TypeInfo &type_info);
+
+  bool withClassNames;
+  XXH3_64Hasher hasher;
+  // Structs being walked, to cut cycles through their fields.
+  std::vector<const TypeInfo *> stack;
+};
+
+}  // namespace impl
+}  // namespace coti
+}  // namespace tops
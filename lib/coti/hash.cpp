@@ -0,0 +1,219 @@
+#include "tops/coti/hash.h"
+
+#include <algorithm>
+#include <cassert>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "openssl/evp.h"
+#include "tops/coti/utils.h"
+#include "type_info_dispatch.h"
+
+// Compile xxHash into this translation unit only.
+#define XXH_STATIC_LINKING_ONLY
+#define XXH_IMPLEMENTATION
+#include "xxhash.h"
+
+static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__,
+              "hash encoding assumes a little-endian host");
+
+namespace tops {
+namespace coti {
+namespace {
+
+using impl::type_info_dispatch;
+
+const EVP_MD *getSHA3_256() {
+  // Fetched once per process, EVP_MD objects are safe to share.
+  static EVP_MD *md = EVP_MD_fetch(nullptr, "SHA3-256", nullptr);
+  assert(md);
+  return md;
+}
+
+template <typename T>
+constexpr bool is_scalar_info_v =
+    std::is_same_v<T, BoolInfo> || std::is_same_v<T, IntegerInfo> ||
+    std::is_same_v<T, FloatInfo>;
+
+template <typename T>
+struct HashArray;
+
+template <typename T>
+struct Hash {
+  static void run(const T &type_info, const void *object, Hasher &hasher) {
+    if constexpr (std::is_same_v<T, DictInfo>) {
+      if (type_info.codecs && type_info.codecs->hash) {
+        return type_info.codecs->hash(object, hasher);
+      }
+    }
+    hasher.update(static_cast<uint8_t>(type_info.kind));
+    if constexpr (std::is_same_v<T, BoolInfo>) {
+      hasher.update(static_cast<uint8_t>(type_info.get(object)));
+    }
+    if constexpr (std::is_same_v<T, IntegerInfo>) {
+      hasher.update(type_info.get(object));
+    }
+    if constexpr (std::is_same_v<T, FloatInfo>) {
+      hasher.update(type_info.get(object));
+    }
+    if constexpr (std::is_same_v<T, StringInfo>) {
+      auto val = type_info.get(object);
+      hasher.update(static_cast<uint64_t>(val.size()));
+      hasher.update(val.data(), val.size());
+    }
+    if constexpr (std::is_same_v<T, ArrayInfo>) {
+      type_info_dispatch<HashArray>(type_info.childInfo, type_info, object,
+                                    hasher);
+    }
+    if constexpr (std::is_same_v<T, ListInfo>) {
+      auto numChilds = type_info.getNumChilds(object);
+      hasher.update(static_cast<uint64_t>(numChilds));
+      for (size_t idx = 0; idx < numChilds; ++idx) {
+        auto child = type_info.getChildAt(object, idx);
+        hash(*child.type_info, child.ptr, hasher);
+      }
+    }
+    if constexpr (std::is_same_v<T, DictInfo>) {
+      std::vector<std::pair<std::string_view, TypedPtr>> items;
+      items.reserve(type_info.getNumItems(object));
+      auto *iter = type_info.beginIter(object);
+      while (!type_info.isEndIter(object, iter)) {
+        items.emplace_back(type_info.getKeyAtIter(object, iter),
+                           type_info.getValueAtIter(object, iter));
+        iter = type_info.nextIter(object, iter);
+      }
+      type_info.finishIter(object, iter);
+      std::sort(items.begin(), items.end(),
+                [](const auto &lhs, const auto &rhs) {
+                  return lhs.first < rhs.first;
+                });
+      hasher.update(static_cast<uint64_t>(items.size()));
+      for (auto &[key, value] : items) {
+        hasher.update(static_cast<uint64_t>(key.size()));
+        hasher.update(key.data(), key.size());
+        hash(*value.type_info, value.ptr, hasher);
+      }
+    }
+  }
+};
+
+template <typename T>
+struct HashArray {
+  static void run(const T &elemInfo, const ArrayInfo &arrayInfo,
+                  const void *object, Hasher &hasher) {
+    auto numChilds = arrayInfo.getNumChilds(object);
+    hasher.update(static_cast<uint64_t>(numChilds));
+    auto *childBegin =
+        reinterpret_cast<const char *>(arrayInfo.getChildBegin(object));
+    uint32_t elemSize = elemInfo.cppByteSize;
+    if constexpr (is_scalar_info_v<T>) {
+      hasher.update(static_cast<uint32_t>(elemSize * CHAR_BIT));
+      hasher.updateBulk(childBegin, numChilds * elemSize);
+    } else {
+      for (size_t idx = 0; idx < numChilds; ++idx) {
+        Hash<T>::run(elemInfo, childBegin + idx * elemSize, hasher);
+      }
+    }
+  }
+};
+
+}  // namespace
+
+Hasher::~Hasher() = default;
+
+void Hasher::updateSlow(const void *data, size_t size) {
+  flush();
+  if (size < buffer.size()) {
+    std::memcpy(buffer.data(), data, size);
+    bufferUsed = size;
+    return;
+  }
+  consume(data, size);
+}
+
+SHA3_256Hasher::SHA3_256Hasher() : mdctx(EVP_MD_CTX_new()) {
+  assert(mdctx);
+  reset();
+}
+
+SHA3_256Hasher::~SHA3_256Hasher() { EVP_MD_CTX_free(mdctx); }
+
+void SHA3_256Hasher::reset() {
+  auto res = EVP_DigestInit_ex2(mdctx, getSHA3_256(), nullptr);
+  (void)res;
+  assert(res);
+}
+
+void SHA3_256Hasher::consume(const void *data, size_t size) {
+  auto res = EVP_DigestUpdate(mdctx, data, size);
+  (void)res;
+  assert(res);
+}
+
+SHA3_256DigestTy SHA3_256Hasher::finalize() {
+  flush();
+  SHA3_256DigestTy digest;
+  unsigned mdLen;
+  auto res = EVP_DigestFinal_ex(mdctx, digest.data(), &mdLen);
+  (void)res;
+  (void)mdLen;
+  assert(res && mdLen == digest.size());
+  return digest;
+}
+
+XXH3_64Hasher::XXH3_64Hasher() : state(XXH3_createState()) {
+  assert(state);
+  reset();
+}
+
+XXH3_64Hasher::~XXH3_64Hasher() { XXH3_freeState(state); }
+
+void XXH3_64Hasher::reset() { XXH3_64bits_reset(state); }
+
+void XXH3_64Hasher::consume(const void *data, size_t size) {
+  XXH3_64bits_update(state, data, size);
+}
+
+uint64_t XXH3_64Hasher::finalize() {
+  flush();
+  return XXH3_64bits_digest(state);
+}
+
+XXH3_128Hasher::XXH3_128Hasher() : state(XXH3_createState()) {
+  assert(state);
+  reset();
+}
+
+XXH3_128Hasher::~XXH3_128Hasher() { XXH3_freeState(state); }
+
+void XXH3_128Hasher::reset() { XXH3_128bits_reset(state); }
+
+void XXH3_128Hasher::consume(const void *data, size_t size) {
+  XXH3_128bits_update(state, data, size);
+}
+
+XXH3_128DigestTy XXH3_128Hasher::finalize() {
+  flush();
+  XXH128_canonical_t canonical;
+  XXH128_canonicalFromHash(&canonical, XXH3_128bits_digest(state));
+  XXH3_128DigestTy digest;
+  static_assert(sizeof(canonical.digest) == sizeof(digest));
+  std::memcpy(digest.data(), canonical.digest, digest.size());
+  return digest;
+}
+
+void TypeInfo::hash(const void *object, Hasher &hasher) {
+  coti::hash(*this, object, hasher);
+}
+
+void hash(const TypeInfo &type_info, const void *object, Hasher &hasher) {
+  return type_info_dispatch<Hash>(type_info, object, hasher);
+}
+
+SHA3_256DigestTy hash(const TypeInfo &type_info, const void *object) {
+  return hash_with<SHA3_256Hasher>(type_info, object);
+}
+
+}  // namespace coti
+}  // namespace tops
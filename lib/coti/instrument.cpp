@@ -0,0 +1,223 @@
+#include "tops/coti/instrument.h"
+
+#ifdef TOPS_COTI_INSTRUMENT
+
+#include <algorithm>
+#include <array>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "fmt/format.h"
+#include "instrument_scope.h"
+#include "tops/coti/counted_new.h"
+
+namespace tops {
+namespace coti {
+namespace {
+
+constexpr size_t kNumOps = static_cast<size_t>(InstrumentOp::NumOps);
+
+using CounterMap =
+    std::unordered_map<const TypeInfo *,
+                       std::array<InstrumentCounters, kNumOps>>;
+
+void merge_into(CounterMap &dst, const CounterMap &src) {
+  for (auto &[typeInfo, counters] : src) {
+    auto &dstCounters = dst[typeInfo];
+    for (size_t op = 0; op < kNumOps; ++op) {
+      dstCounters[op] += counters[op];
+    }
+  }
+}
+
+// The counters of one thread. The thread only contends for `mutex` with
+// instrument_snapshot() and instrument_reset().
+struct ThreadCounters {
+  ThreadCounters();
+  ~ThreadCounters();
+
+  std::mutex mutex;
+  CounterMap counters;
+};
+
+struct Registry {
+  std::mutex mutex;
+  std::vector<ThreadCounters *> threads;
+  // Counters of threads that have exited.
+  CounterMap retired;
+  std::unordered_map<const TypeInfo *, std::string> names;
+};
+
+Registry &get_registry() {
+  // Leaked, threads may exit after static destruction.
+  static auto *registry = new Registry();
+  return *registry;
+}
+
+ThreadCounters::ThreadCounters() {
+  auto &registry = get_registry();
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  registry.threads.push_back(this);
+}
+
+ThreadCounters::~ThreadCounters() {
+  auto &registry = get_registry();
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  merge_into(registry.retired, counters);
+  registry.threads.erase(
+      std::find(registry.threads.begin(), registry.threads.end(), this));
+}
+
+ThreadCounters &get_thread_counters() {
+  thread_local ThreadCounters threadCounters;
+  return threadCounters;
+}
+
+const char *get_op_name(size_t op) {
+  switch (static_cast<InstrumentOp>(op)) {
+    case InstrumentOp::ToJson:
+      return "to_json";
+    case InstrumentOp::FromJson:
+      return "from_json";
+    case InstrumentOp::ToMsgPack:
+      return "to_msgpack";
+    case InstrumentOp::FromMsgPack:
+      return "from_msgpack";
+    default:
+      __builtin_unreachable();
+  }
+}
+
+const char *get_kind_name(TypeKind kind) {
+  switch (kind) {
+    case OK_Bool:
+      return "Bool";
+    case OK_Int:
+      return "Int";
+    case OK_Float:
+      return "Float";
+    case OK_String:
+      return "String";
+    case OK_Array:
+      return "Array";
+    case OK_List:
+      return "List";
+    case OK_Dict:
+      return "Dict";
+  }
+  __builtin_unreachable();
+}
+
+}  // namespace
+
+namespace impl {
+
+void InstrumentScope::finish() {
+  uint64_t nanos = instrument_now() - startNanos;
+  InstrumentCounters delta;
+  delta.calls = 1;
+  delta.bytes = instrumentState.getBytePos() - startBytePos;
+  delta.nanos = nanos;
+  delta.selfNanos = nanos - childNanos;
+  delta.allocs = instrument_thread_allocs() - startAllocs;
+  instrumentState.top = parent;
+  if (parent) {
+    parent->childNanos += nanos;
+  }
+  auto &threadCounters = get_thread_counters();
+  std::lock_guard<std::mutex> lock(threadCounters.mutex);
+  threadCounters.counters[type_info][static_cast<size_t>(
+      instrumentState.op)] += delta;
+}
+
+}  // namespace impl
+
+void instrument_set_name(const TypeInfo &type_info, std::string_view name) {
+  auto &registry = get_registry();
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  registry.names[&type_info] = std::string(name);
+}
+
+nlohmann::json instrument_snapshot() {
+  auto &registry = get_registry();
+  CounterMap merged;
+  std::unordered_map<const TypeInfo *, std::string> names;
+  {
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    merged = registry.retired;
+    for (auto *thread : registry.threads) {
+      std::lock_guard<std::mutex> threadLock(thread->mutex);
+      merge_into(merged, thread->counters);
+    }
+    names = registry.names;
+  }
+  nlohmann::json snapshot(nlohmann::json::value_t::object);
+  for (size_t op = 0; op < kNumOps; ++op) {
+    std::vector<std::pair<const TypeInfo *, InstrumentCounters>> entries;
+    for (auto &[typeInfo, counters] : merged) {
+      if (counters[op].calls != 0) {
+        entries.emplace_back(typeInfo, counters[op]);
+      }
+    }
+    std::sort(entries.begin(), entries.end(),
+              [](const auto &lhs, const auto &rhs) {
+                return lhs.second.selfNanos > rhs.second.selfNanos;
+              });
+    auto &opJson = snapshot[get_op_name(op)];
+    opJson = nlohmann::json::array();
+    for (auto &[typeInfo, counters] : entries) {
+      auto nameIt = names.find(typeInfo);
+      opJson.push_back({
+          {"type", nameIt != names.end()
+                       ? nameIt->second
+                       : fmt::format("{}@{}", get_kind_name(typeInfo->kind),
+                                     static_cast<const void *>(typeInfo))},
+          {"kind", get_kind_name(typeInfo->kind)},
+          {"calls", counters.calls},
+          {"bytes", counters.bytes},
+          {"nanos", counters.nanos},
+          {"self_nanos", counters.selfNanos},
+          {"allocs", counters.allocs},
+      });
+    }
+  }
+  return snapshot;
+}
+
+void instrument_reset() {
+  auto &registry = get_registry();
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  registry.retired.clear();
+  for (auto *thread : registry.threads) {
+    std::lock_guard<std::mutex> threadLock(thread->mutex);
+    thread->counters.clear();
+  }
+}
+
+uint64_t instrument_thread_allocs() { return counted_new_thread_allocs(); }
+
+}  // namespace coti
+}  // namespace tops
+
+#else  // TOPS_COTI_INSTRUMENT
+
+namespace tops {
+namespace coti {
+
+void instrument_set_name(const TypeInfo &, std::string_view) {}
+
+nlohmann::json instrument_snapshot() {
+  return nlohmann::json(nlohmann::json::value_t::object);
+}
+
+void instrument_reset() {}
+
+uint64_t instrument_thread_allocs() { return 0; }
+
+}  // namespace coti
+}  // namespace tops
+
+#endif  // TOPS_COTI_INSTRUMENT
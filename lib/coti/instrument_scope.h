@@ -0,0 +1,127 @@
+#pragma once
+
+#ifdef TOPS_COTI_INSTRUMENT
+
+#include <chrono>
+#include <cstdint>
+
+#include "msgpack.h"
+#include "tops/coti/instrument.h"
+#include "tops/coti/msgpack_reader.h"
+#include "tops/coti/type_info.h"
+
+namespace tops {
+namespace coti {
+namespace impl {
+
+class InstrumentScope;
+
+// The operation running on this thread, see InstrumentOpScope.
+struct InstrumentState {
+  InstrumentOp op = InstrumentOp::NumOps;
+  // Where the bytes of the operation go or come from.
+  uint64_t packedBytes = 0;
+  MsgPackReader *reader = nullptr;
+  InstrumentScope *top = nullptr;
+
+  bool isActive() const { return op != InstrumentOp::NumOps; }
+
+  uint64_t getBytePos() const {
+    return reader ? reader->getOffset() : packedBytes;
+  }
+};
+
+inline thread_local InstrumentState instrumentState;
+
+inline uint64_t instrument_now() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+// Wraps a top-level to_json/from_json/to_msgpack/from_msgpack. Only the
+// outermost one on a thread takes effect; nested ones are part of it.
+class InstrumentOpScope {
+ public:
+  explicit InstrumentOpScope(InstrumentOp op, MsgPackReader *reader = nullptr)
+      : outermost(!instrumentState.isActive()) {
+    if (outermost) {
+      instrumentState.op = op;
+      instrumentState.reader = reader;
+    }
+  }
+
+  ~InstrumentOpScope() {
+    if (outermost) {
+      instrumentState.op = InstrumentOp::NumOps;
+      instrumentState.reader = nullptr;
+    }
+  }
+
+  InstrumentOpScope(const InstrumentOpScope &) = delete;
+  InstrumentOpScope &operator=(const InstrumentOpScope &) = delete;
+
+  // The packer to encode with: for the outermost scope, `packer` behind a
+  // callback that counts the bytes.
+  msgpack_packer &countBytes(msgpack_packer &packer) {
+    if (!outermost) {
+      return packer;
+    }
+    inner = &packer;
+    counting = {this, count};
+    return counting;
+  }
+
+ private:
+  static int count(void *data, const char *buf, size_t len) {
+    auto *inner = static_cast<InstrumentOpScope *>(data)->inner;
+    instrumentState.packedBytes += len;
+    return inner->callback(inner->data, buf, len);
+  }
+
+  bool outermost;
+  msgpack_packer *inner = nullptr;
+  msgpack_packer counting;
+};
+
+// One type_info_dispatch() call. Does nothing outside an InstrumentOpScope.
+class InstrumentScope {
+ public:
+  explicit InstrumentScope(const TypeInfo &type_info)
+      : type_info(instrumentState.isActive() ? &type_info : nullptr) {
+    if (!this->type_info) {
+      return;
+    }
+    parent = instrumentState.top;
+    instrumentState.top = this;
+    startAllocs = instrument_thread_allocs();
+    startBytePos = instrumentState.getBytePos();
+    startNanos = instrument_now();
+  }
+
+  ~InstrumentScope() {
+    if (type_info) {
+      finish();
+    }
+  }
+
+  InstrumentScope(const InstrumentScope &) = delete;
+  InstrumentScope &operator=(const InstrumentScope &) = delete;
+
+ private:
+  // Adds this call to the counters of the thread.
+  void finish();
+
+  const TypeInfo *type_info;
+  InstrumentScope *parent = nullptr;
+  uint64_t startNanos = 0;
+  uint64_t childNanos = 0;
+  uint64_t startBytePos = 0;
+  uint64_t startAllocs = 0;
+};
+
+}  // namespace impl
+}  // namespace coti
+}  // namespace tops
+
+#endif  // TOPS_COTI_INSTRUMENT
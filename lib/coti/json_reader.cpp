@@ -0,0 +1,267 @@
+#include <istream>
+#include <vector>
+
+#include "tops/coti/struct_info.h"
+#include "tops/coti/utils.h"
+
+namespace tops {
+namespace coti {
+namespace {
+
+// Fills an object from nlohmann's SAX events. `frames` holds the containers
+// that are currently open; each scalar or container event first resolves the
+// slot it has to be stored into from the innermost frame.
+class FromJsonSax {
+ public:
+  FromJsonSax(const TypeInfo &type_info, void *object)
+      : root{object, &type_info} {}
+
+  bool null() { return skipped(0); }
+
+  bool boolean(bool val) {
+    if (skipped(0)) {
+      return true;
+    }
+    TypedPtr slot;
+    if (!nextSlot(slot) || slot.type_info->kind != OK_Bool) {
+      return false;
+    }
+    static_cast<const BoolInfo *>(slot.type_info)->set(slot.ptr, val);
+    return true;
+  }
+
+  bool number_integer(nlohmann::json::number_integer_t val) {
+    return number(val);
+  }
+
+  bool number_unsigned(nlohmann::json::number_unsigned_t val) {
+    return number(static_cast<int64_t>(val));
+  }
+
+  bool number_float(nlohmann::json::number_float_t val,
+                    const nlohmann::json::string_t &) {
+    return number(val);
+  }
+
+  bool string(nlohmann::json::string_t &val) {
+    if (skipped(0)) {
+      return true;
+    }
+    TypedPtr slot;
+    // `val` is a temporary, a std::string_view can't keep it.
+    if (!nextSlot(slot) || slot.type_info->kind != OK_String ||
+        static_cast<const StringInfo *>(slot.type_info)->isView) {
+      return false;
+    }
+    static_cast<const StringInfo *>(slot.type_info)->set(slot.ptr, val);
+    return true;
+  }
+
+  bool binary(nlohmann::json::binary_t &) { return skipped(0); }
+
+  bool start_object(size_t) {
+    if (skipped(1)) {
+      return true;
+    }
+    TypedPtr slot;
+    if (!nextSlot(slot) || slot.type_info->kind != OK_Dict) {
+      return false;
+    }
+    auto &dictInfo = static_cast<const DictInfo &>(*slot.type_info);
+    uint32_t numFields =
+        dictInfo.isStruct
+            ? static_cast<const StructInfo &>(dictInfo).getNumFields()
+            : 0;
+    frames.push_back({slot, 0, SeenFields(numFields)});
+    return true;
+  }
+
+  bool key(nlohmann::json::string_t &val) {
+    if (skipped(0)) {
+      return true;
+    }
+    auto &frame = frames.back();
+    auto &dictInfo = static_cast<const DictInfo &>(*frame.obj.type_info);
+    if (!dictInfo.isStruct) {
+      pendingValue = dictInfo.getValueAt(frame.obj.ptr, val);
+      return true;
+    }
+    // Unknown keys are skipped, their value included.
+    auto &structInfo = static_cast<const StructInfo &>(dictInfo);
+    auto idx = structInfo.findField(val);
+    if (idx < 0) {
+      isSkipping = true;
+      return true;
+    }
+    frame.seen.set(idx);
+    pendingValue = structInfo.getFieldAt(frame.obj.ptr, idx);
+    return true;
+  }
+
+  bool end_object() {
+    if (skipped(-1)) {
+      return true;
+    }
+    auto &frame = frames.back();
+    auto &dictInfo = static_cast<const DictInfo &>(*frame.obj.type_info);
+    if (dictInfo.isStruct) {
+      auto &structInfo = static_cast<const StructInfo &>(dictInfo);
+      if (structInfo.getHasDefaults()) {
+        structInfo.fillMissing(frame.obj.ptr, frame.seen);
+      }
+    }
+    frames.pop_back();
+    return true;
+  }
+
+  bool start_array(size_t) {
+    if (skipped(1)) {
+      return true;
+    }
+    TypedPtr slot;
+    if (!nextSlot(slot) || (slot.type_info->kind != OK_Array &&
+                            slot.type_info->kind != OK_List)) {
+      return false;
+    }
+    // A Span can't own elements.
+    if (slot.type_info->kind == OK_Array &&
+        static_cast<const ArrayInfo *>(slot.type_info)->isView) {
+      return false;
+    }
+    frames.push_back({slot, 0, SeenFields(0)});
+    return true;
+  }
+
+  bool end_array() {
+    if (skipped(-1)) {
+      return true;
+    }
+    // Trims elements left over from the previous content of the object.
+    auto &frame = frames.back();
+    if (frame.obj.type_info->kind == OK_Array) {
+      static_cast<const ArrayInfo *>(frame.obj.type_info)
+          ->resize(frame.obj.ptr, frame.numChilds);
+    } else {
+      static_cast<const ListInfo *>(frame.obj.type_info)
+          ->resize(frame.obj.ptr, frame.numChilds);
+    }
+    frames.pop_back();
+    return true;
+  }
+
+  bool parse_error(size_t, const std::string &,
+                   const nlohmann::json::exception &) {
+    return false;
+  }
+
+ private:
+  struct Frame {
+    TypedPtr obj;
+    // Number of elements seen so far, for Array/List frames.
+    size_t numChilds;
+    // The fields seen so far, for struct frames.
+    SeenFields seen;
+  };
+
+  // Whether the event is part of the value of an unknown struct key, which
+  // is dropped. `depthDelta` is 1 for the start of a container, -1 for its end
+  // and 0 otherwise.
+  bool skipped(int depthDelta) {
+    if (!isSkipping) {
+      return false;
+    }
+    skipDepth += depthDelta;
+    isSkipping = skipDepth != 0;
+    return true;
+  }
+
+  template <typename NumT>
+  bool number(NumT val) {
+    if (skipped(0)) {
+      return true;
+    }
+    TypedPtr slot;
+    if (!nextSlot(slot)) {
+      return false;
+    }
+    // Same conversions as nlohmann::json::get<int64_t/double>().
+    if (slot.type_info->kind == OK_Int) {
+      static_cast<const IntegerInfo *>(slot.type_info)
+          ->set(slot.ptr, static_cast<int64_t>(val));
+      return true;
+    }
+    if (slot.type_info->kind == OK_Float) {
+      static_cast<const FloatInfo *>(slot.type_info)
+          ->set(slot.ptr, static_cast<double>(val));
+      return true;
+    }
+    return false;
+  }
+
+  // Resolves where the next value goes.
+  bool nextSlot(TypedPtr &slot) {
+    if (frames.empty()) {
+      if (!root.ptr) {
+        // Trailing values after the root are rejected by the parser already.
+        return false;
+      }
+      slot = root;
+      root.ptr = nullptr;
+      return true;
+    }
+    auto &frame = frames.back();
+    switch (frame.obj.type_info->kind) {
+      case OK_Array: {
+        auto &arrayInfo = static_cast<const ArrayInfo &>(*frame.obj.type_info);
+        auto idx = frame.numChilds++;
+        if (idx >= arrayInfo.getNumChilds(frame.obj.ptr)) {
+          arrayInfo.resize(frame.obj.ptr, idx + 1);
+        }
+        // Resizing may move the storage, so the child has to be looked up
+        // again for every element.
+        auto *childBegin =
+            reinterpret_cast<char *>(arrayInfo.getChildBegin(frame.obj.ptr));
+        slot = {childBegin + idx * arrayInfo.childInfo.cppByteSize,
+                &arrayInfo.childInfo};
+        return true;
+      }
+      case OK_List: {
+        auto &listInfo = static_cast<const ListInfo &>(*frame.obj.type_info);
+        auto idx = frame.numChilds++;
+        if (idx >= listInfo.getNumChilds(frame.obj.ptr)) {
+          listInfo.resize(frame.obj.ptr, idx + 1);
+        }
+        slot = listInfo.getChildAt(frame.obj.ptr, idx);
+        return true;
+      }
+      case OK_Dict:
+        slot = pendingValue;
+        return true;
+      default:
+        return false;
+    }
+  }
+
+  TypedPtr root;
+  TypedPtr pendingValue{nullptr, nullptr};
+  std::vector<Frame> frames;
+  bool isSkipping = false;
+  int64_t skipDepth = 0;
+};
+
+}  // namespace
+
+bool from_json_sax(const TypeInfo &type_info, void *object,
+                   std::string_view json) {
+  FromJsonSax handler(type_info, object);
+  return nlohmann::json::sax_parse(json.begin(), json.end(), &handler);
+}
+
+bool from_json_sax(const TypeInfo &type_info, void *object,
+                   std::istream &json) {
+  FromJsonSax handler(type_info, object);
+  return nlohmann::json::sax_parse(json, &handler);
+}
+
+}  // namespace coti
+}  // namespace tops
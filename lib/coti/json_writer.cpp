@@ -0,0 +1,188 @@
+#include "json_writer.h"
+
+#include "scalar_array.h"
+#include "tops/coti/utils.h"
+#include "type_info_dispatch.h"
+
+namespace tops {
+namespace coti {
+namespace impl {
+
+void JsonWriter::writeString(std::string_view str) {
+  static constexpr char kHex[] = "0123456789abcdef";
+  put('"');
+  const char *runBegin = str.data();
+  const char *ptr = runBegin;
+  const char *strEnd = str.data() + str.size();
+  for (; ptr != strEnd; ++ptr) {
+    auto c = static_cast<unsigned char>(*ptr);
+    if (c >= 0x20 && c != '"' && c != '\\') {
+      continue;
+    }
+    buf.append(runBegin, ptr);
+    runBegin = ptr + 1;
+    switch (c) {
+      case '"':
+        put("\\\"");
+        break;
+      case '\\':
+        put("\\\\");
+        break;
+      case '\b':
+        put("\\b");
+        break;
+      case '\f':
+        put("\\f");
+        break;
+      case '\n':
+        put("\\n");
+        break;
+      case '\r':
+        put("\\r");
+        break;
+      case '\t':
+        put("\\t");
+        break;
+      default: {
+        char escaped[] = {'\\', 'u', '0', '0', kHex[c >> 4], kHex[c & 0xf]};
+        put(std::string_view(escaped, sizeof(escaped)));
+        break;
+      }
+    }
+  }
+  buf.append(runBegin, strEnd);
+  put('"');
+}
+
+}  // namespace impl
+
+namespace {
+
+using impl::JsonWriter;
+using impl::type_info_dispatch;
+
+void to_json_stream(const TypeInfo &type_info, const void *object,
+                    JsonWriter &writer);
+
+template <typename T>
+struct ToJsonStreamArray;
+
+template <typename T>
+void write_scalar_array(const T *data, size_t numChilds, JsonWriter &writer) {
+  writer.put('[');
+  for (size_t idx = 0; idx < numChilds; ++idx) {
+    if (idx != 0) {
+      writer.put(',');
+    }
+    if constexpr (std::is_floating_point_v<T>) {
+      writer.writeFloat(data[idx]);
+    } else {
+      // IntegerInfo::get() reads every width as int64_t, so does to_json().
+      writer.writeInt(static_cast<int64_t>(data[idx]));
+    }
+    writer.maybeFlush();
+  }
+  writer.put(']');
+}
+
+template <typename T>
+struct ToJsonStream {
+  static void run(const T &type_info, const void *object,
+                  JsonWriter &writer) {
+    if constexpr (std::is_same_v<T, BoolInfo>) {
+      writer.writeBool(type_info.get(object));
+    }
+    if constexpr (std::is_same_v<T, IntegerInfo>) {
+      writer.writeInt(type_info.get(object));
+    }
+    if constexpr (std::is_same_v<T, FloatInfo>) {
+      if (type_info.getKind() == FloatInfo::IEEE &&
+          type_info.getBitWidth() == 32) {
+        writer.writeFloat(static_cast<float>(type_info.get(object)));
+      } else {
+        writer.writeFloat(type_info.get(object));
+      }
+    }
+    if constexpr (std::is_same_v<T, StringInfo>) {
+      writer.writeString(type_info.get(object));
+    }
+    if constexpr (std::is_same_v<T, ArrayInfo>) {
+      if (impl::with_scalar_type(type_info.childInfo, [&](auto tag) {
+            using ElemT = typename decltype(tag)::type;
+            write_scalar_array(reinterpret_cast<const ElemT *>(
+                                   type_info.getChildBegin(object)),
+                               type_info.getNumChilds(object), writer);
+          })) {
+        return;
+      }
+      type_info_dispatch<ToJsonStreamArray>(type_info.childInfo, type_info,
+                                            object, writer);
+    }
+    if constexpr (std::is_same_v<T, ListInfo>) {
+      writer.put('[');
+      for (size_t idx = 0, numChilds = type_info.getNumChilds(object);
+           idx < numChilds; ++idx) {
+        if (idx != 0) {
+          writer.put(',');
+        }
+        auto child = type_info.getChildAt(object, idx);
+        to_json_stream(*child.type_info, child.ptr, writer);
+        writer.maybeFlush();
+      }
+      writer.put(']');
+    }
+    if constexpr (std::is_same_v<T, DictInfo>) {
+      writer.put('{');
+      bool first = true;
+      auto *iter = type_info.beginIter(object);
+      while (!type_info.isEndIter(object, iter)) {
+        if (!first) {
+          writer.put(',');
+        }
+        first = false;
+        writer.writeKey(type_info.getKeyAtIter(object, iter));
+        auto value = type_info.getValueAtIter(object, iter);
+        to_json_stream(*value.type_info, value.ptr, writer);
+        writer.maybeFlush();
+        iter = type_info.nextIter(object, iter);
+      }
+      type_info.finishIter(object, iter);
+      writer.put('}');
+    }
+  }
+};
+
+template <typename T>
+struct ToJsonStreamArray {
+  static void run(const T &elemInfo, const ArrayInfo &arrayInfo,
+                  const void *object, JsonWriter &writer) {
+    uint32_t elemSize = elemInfo.cppByteSize;
+    auto childBegin =
+        reinterpret_cast<const char *>(arrayInfo.getChildBegin(object));
+    writer.put('[');
+    for (size_t idx = 0, numChild = arrayInfo.getNumChilds(object);
+         idx < numChild; ++idx) {
+      if (idx != 0) {
+        writer.put(',');
+      }
+      ToJsonStream<T>::run(elemInfo, childBegin + elemSize * idx, writer);
+      writer.maybeFlush();
+    }
+    writer.put(']');
+  }
+};
+
+void to_json_stream(const TypeInfo &type_info, const void *object,
+                    JsonWriter &writer) {
+  return type_info_dispatch<ToJsonStream>(type_info, object, writer);
+}
+
+}  // namespace
+
+void to_json_stream(const TypeInfo &type_info, const void *object, Sink &sink) {
+  JsonWriter writer(sink);
+  to_json_stream(type_info, object, writer);
+}
+
+}  // namespace coti
+}  // namespace tops
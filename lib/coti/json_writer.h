@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <string_view>
+
+#include "fmt/format.h"
+#include "tops/coti/sink.h"
+
+namespace tops {
+namespace coti {
+namespace impl {
+
+// Formats JSON tokens into a local buffer and hands full blocks to a Sink.
+// Output matches to_json() followed by nlohmann::json::dump() without
+// indentation, except that dict keys come in the dict's iteration order
+// rather than sorted, and floats are printed with the shortest representation
+// that round-trips through their own width.
+class JsonWriter {
+ public:
+  explicit JsonWriter(Sink &sink) : sink(sink) { buf.reserve(kFlushSize); }
+
+  JsonWriter(const JsonWriter &) = delete;
+  JsonWriter &operator=(const JsonWriter &) = delete;
+
+  ~JsonWriter() { flush(); }
+
+  void put(char c) { buf.push_back(c); }
+
+  void put(std::string_view str) {
+    buf.append(str.data(), str.data() + str.size());
+  }
+
+  void writeBool(bool val) { put(val ? std::string_view("true") : "false"); }
+
+  void writeInt(int64_t val) {
+    fmt::format_int str(val);
+    buf.append(str.data(), str.data() + str.size());
+  }
+
+  template <typename FloatT>
+  void writeFloat(FloatT val) {
+    if (!std::isfinite(val)) {
+      // Same as nlohmann::json, json has no representation for inf/nan.
+      put("null");
+      return;
+    }
+    auto begin = buf.size();
+    fmt::format_to(fmt::appender(buf), "{}", val);
+    // Keep the number a float when read back.
+    std::string_view str(buf.data() + begin, buf.size() - begin);
+    if (str.find_first_of(".e") == std::string_view::npos) {
+      put(".0");
+    }
+  }
+
+  void writeString(std::string_view str);
+
+  void writeKey(std::string_view key) {
+    writeString(key);
+    put(':');
+  }
+
+  // Called between values; hands the buffer to the sink once it is large
+  // enough.
+  void maybeFlush() {
+    if (buf.size() >= kFlushSize) {
+      flush();
+    }
+  }
+
+  void flush() {
+    if (buf.size() != 0) {
+      sink.write(buf.data(), buf.size());
+      buf.clear();
+    }
+  }
+
+ private:
+  static constexpr size_t kFlushSize = 64 * 1024;
+
+  Sink &sink;
+  fmt::memory_buffer buf;
+};
+
+}  // namespace impl
+}  // namespace coti
+}  // namespace tops
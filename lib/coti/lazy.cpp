@@ -0,0 +1,310 @@
+#include "tops/coti/lazy.h"
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "tops/coti/msgpack_reader.h"
+#include "tops/coti/struct_info.h"
+
+namespace tops {
+namespace coti {
+
+namespace {
+
+// Skips the value at `reader` like MsgPackReader::skip(), failing on nesting
+// deeper than `maxDepth`.
+bool skip_value(MsgPackReader &reader, size_t maxDepth) {
+  // Values left per open container.
+  std::vector<uint64_t> remain{1};
+  MsgPackToken token;
+  while (!remain.empty()) {
+    if (remain.back() == 0) {
+      remain.pop_back();
+      continue;
+    }
+    --remain.back();
+    if (!reader.next(token)) {
+      return false;
+    }
+    switch (token.kind) {
+      case MsgPackToken::Str:
+      case MsgPackToken::Bin:
+      case MsgPackToken::Ext: {
+        std::string_view bytes;
+        if (!reader.readBytes(token.size, bytes)) {
+          return false;
+        }
+        break;
+      }
+      case MsgPackToken::Array:
+        remain.push_back(token.size);
+        break;
+      case MsgPackToken::Map:
+        remain.push_back(uint64_t(token.size) * 2);
+        break;
+      default:
+        break;
+    }
+    if (remain.size() > maxDepth) {
+      return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace
+
+std::unique_ptr<LazyMsgPack> LazyMsgPack::open(const TypeInfo &type_info,
+                                               void *object,
+                                               std::string_view buffer) {
+  std::unique_ptr<LazyMsgPack> lazy(
+      new LazyMsgPack(type_info, object, buffer));
+  MsgPackReader reader(buffer);
+  if (!skip_value(reader, kMaxDepth) || !reader.atEnd()) {
+    return nullptr;
+  }
+  lazy->nodes.push_back({0, buffer.size(), lazy->kindAt(0)});
+  return lazy;
+}
+
+LazyMsgPack::Node::Kind LazyMsgPack::kindAt(size_t offset) const {
+  auto byte = static_cast<uint8_t>(buffer[offset]);
+  if ((byte & 0xf0) == 0x90 || byte == 0xdc || byte == 0xdd) {
+    return Node::Array;
+  }
+  if ((byte & 0xf0) == 0x80 || byte == 0xde || byte == 0xdf) {
+    return Node::Map;
+  }
+  return Node::Leaf;
+}
+
+bool LazyMsgPack::expand(size_t nodeIdx) {
+  if (nodes[nodeIdx].isExpanded) {
+    return true;
+  }
+  auto kind = nodes[nodeIdx].kind;
+  auto begin = nodes[nodeIdx].begin;
+  auto value = buffer.substr(begin, nodes[nodeIdx].end - begin);
+  if (kind == Node::Leaf) {
+    nodes[nodeIdx].isExpanded = true;
+    return true;
+  }
+  MsgPackToken token;
+  if (kind == Node::Array) {
+    // Scanned first, so that arrays of scalars add nothing to the index.
+    MsgPackReader reader(value);
+    if (!reader.next(token)) {
+      return false;
+    }
+    bool isFlat = true;
+    for (uint32_t idx = 0; idx < token.size && isFlat; ++idx) {
+      isFlat = kindAt(begin + reader.getOffset()) == Node::Leaf;
+      if (!reader.skip()) {
+        return false;
+      }
+    }
+    if (isFlat) {
+      auto &node = nodes[nodeIdx];
+      node.numChilds = token.size;
+      node.isFlat = true;
+      node.isExpanded = true;
+      return true;
+    }
+  }
+  MsgPackReader reader(value);
+  if (!reader.next(token)) {
+    return false;
+  }
+  size_t numNodes = nodes.size();
+  size_t firstChild = childs.size();
+  auto fail = [&] {
+    nodes.resize(numNodes);
+    childs.resize(firstChild);
+    return false;
+  };
+  for (uint32_t idx = 0; idx < token.size; ++idx) {
+    std::string_view key;
+    if (kind == Node::Map) {
+      MsgPackToken keyToken;
+      if (!reader.next(keyToken) || keyToken.kind != MsgPackToken::Str ||
+          !reader.readBytes(keyToken.size, key)) {
+        return fail();
+      }
+    }
+    size_t childBegin = begin + reader.getOffset();
+    if (!reader.skip()) {
+      return fail();
+    }
+    nodes.push_back(
+        {childBegin, begin + reader.getOffset(), kindAt(childBegin)});
+    childs.push_back({key, nodes.size() - 1});
+  }
+  if (kind == Node::Map) {
+    // Stable, so that findChild() can pick the last of duplicate keys as
+    // from_msgpack() does.
+    std::stable_sort(childs.begin() + firstChild, childs.end(),
+                     [](const Child &lhs, const Child &rhs) {
+                       return lhs.key < rhs.key;
+                     });
+  }
+  auto &node = nodes[nodeIdx];
+  node.firstChild = firstChild;
+  node.numChilds = token.size;
+  node.isExpanded = true;
+  return true;
+}
+
+bool LazyMsgPack::decode(size_t nodeIdx, TypedPtr value) {
+  auto &node = nodes[nodeIdx];
+  MsgPackReader reader(buffer.substr(node.begin, node.end - node.begin));
+  if (!from_msgpack(*value.type_info, value.ptr, reader)) {
+    return false;
+  }
+  node.isDecoded = true;
+  return true;
+}
+
+int64_t LazyMsgPack::findChild(const Node &node, const PathElem &elem) const {
+  auto begin = childs.begin() + node.firstChild;
+  auto end = begin + node.numChilds;
+  if (auto *key = std::get_if<std::string>(&elem)) {
+    if (node.kind != Node::Map) {
+      return -1;
+    }
+    auto iter = std::upper_bound(
+        begin, end, std::string_view(*key),
+        [](std::string_view lhs, const Child &rhs) { return lhs < rhs.key; });
+    if (iter == begin || (--iter)->key != *key) {
+      return -1;
+    }
+    return iter->node;
+  }
+  auto index = std::get<size_t>(elem);
+  if (node.kind != Node::Array || index >= node.numChilds) {
+    return -1;
+  }
+  return begin[index].node;
+}
+
+TypedPtr LazyMsgPack::get(const Path &path) {
+  TypedPtr cur{object, &type_info};
+  size_t nodeIdx = 0;
+  // Whether `cur` or one of its parents has been decoded whole.
+  bool wasDecoded = nodes[0].isDecoded;
+  auto &elems = path.getElems();
+  for (size_t depth = 0; depth < elems.size(); ++depth) {
+    auto &elem = elems[depth];
+    if (!expand(nodeIdx)) {
+      return {nullptr, nullptr};
+    }
+    int64_t childIdx = -1;
+    if (nodes[nodeIdx].isFlat) {
+      // The elements are scalars, one of them ends the path.
+      auto *index = std::get_if<size_t>(&elem);
+      if (!index || *index >= nodes[nodeIdx].numChilds ||
+          depth + 1 != elems.size()) {
+        return {nullptr, nullptr};
+      }
+      if (!wasDecoded) {
+        if (!decode(nodeIdx, cur)) {
+          return {nullptr, nullptr};
+        }
+        wasDecoded = true;
+      }
+    } else {
+      childIdx = findChild(nodes[nodeIdx], elem);
+      if (childIdx < 0) {
+        return {nullptr, nullptr};
+      }
+    }
+    auto &node = nodes[nodeIdx];
+    auto *key = std::get_if<std::string>(&elem);
+    switch (cur.type_info->kind) {
+      case OK_Dict: {
+        auto &dictInfo = static_cast<const DictInfo &>(*cur.type_info);
+        if (!key || (dictInfo.isStruct &&
+                     static_cast<const StructInfo &>(dictInfo).findField(
+                         *key) < 0)) {
+          return {nullptr, nullptr};
+        }
+        cur = dictInfo.getValueAt(cur.ptr, *key);
+        break;
+      }
+      case OK_Array: {
+        auto &arrayInfo = static_cast<const ArrayInfo &>(*cur.type_info);
+        // Views can only be decoded whole.
+        if (key || arrayInfo.isView) {
+          return {nullptr, nullptr};
+        }
+        if (!wasDecoded && !node.isSized) {
+          if (arrayInfo.isInline) {
+            if (arrayInfo.getNumChilds(cur.ptr) != node.numChilds) {
+              return {nullptr, nullptr};
+            }
+          } else {
+            arrayInfo.resize(cur.ptr, node.numChilds);
+          }
+          node.isSized = true;
+        }
+        auto index = std::get<size_t>(elem);
+        if (index >= arrayInfo.getNumChilds(cur.ptr)) {
+          return {nullptr, nullptr};
+        }
+        auto &childInfo = arrayInfo.childInfo;
+        cur = {static_cast<char *>(arrayInfo.getChildBegin(cur.ptr)) +
+                   index * childInfo.cppByteSize,
+               &childInfo};
+        break;
+      }
+      case OK_List: {
+        auto &listInfo = static_cast<const ListInfo &>(*cur.type_info);
+        if (key) {
+          return {nullptr, nullptr};
+        }
+        if (!wasDecoded && !node.isSized) {
+          listInfo.resize(cur.ptr, node.numChilds);
+          node.isSized = true;
+        }
+        auto index = std::get<size_t>(elem);
+        if (index >= listInfo.getNumChilds(cur.ptr)) {
+          return {nullptr, nullptr};
+        }
+        cur = listInfo.getChildAt(cur.ptr, index);
+        break;
+      }
+      default:
+        return {nullptr, nullptr};
+    }
+    if (childIdx >= 0) {
+      nodeIdx = childIdx;
+      wasDecoded = wasDecoded || nodes[nodeIdx].isDecoded;
+    }
+  }
+  if (!wasDecoded && !decode(nodeIdx, cur)) {
+    return {nullptr, nullptr};
+  }
+  return cur;
+}
+
+bool LazyMsgPack::isDecoded(const Path &path) const {
+  size_t nodeIdx = 0;
+  for (auto &elem : path.getElems()) {
+    if (nodes[nodeIdx].isDecoded) {
+      return true;
+    }
+    // Nothing below was accessed yet.
+    if (!nodes[nodeIdx].isExpanded || nodes[nodeIdx].isFlat) {
+      return false;
+    }
+    auto childIdx = findChild(nodes[nodeIdx], elem);
+    if (childIdx < 0) {
+      return false;
+    }
+    nodeIdx = childIdx;
+  }
+  return nodes[nodeIdx].isDecoded;
+}
+
+}  // namespace coti
+}  // namespace tops
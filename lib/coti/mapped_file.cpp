@@ -0,0 +1,53 @@
+#include "tops/coti/mapped_file.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "tops/coti/msgpack_reader.h"
+
+namespace tops {
+namespace coti {
+
+std::shared_ptr<const MappedFile> MappedFile::open(const std::string &path) {
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return nullptr;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    return nullptr;
+  }
+  size_t size = st.st_size;
+  const char *data = nullptr;
+  if (size != 0) {
+    // Shared and read-only, so every process mapping the file uses the same
+    // page cache pages.
+    void *addr = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED) {
+      close(fd);
+      return nullptr;
+    }
+    data = static_cast<const char *>(addr);
+  }
+  // The mapping stays valid after the descriptor is closed.
+  close(fd);
+  return std::shared_ptr<const MappedFile>(new MappedFile(data, size));
+}
+
+MappedFile::~MappedFile() {
+  if (size != 0) {
+    munmap(const_cast<char *>(data), size);
+  }
+}
+
+bool from_msgpack_view(const TypeInfo &type_info, void *object,
+                       const MappedFile &file) {
+  MsgPackReader reader(file.getData());
+  return from_msgpack(type_info, object, reader) && reader.atEnd();
+}
+
+}  // namespace coti
+}  // namespace tops
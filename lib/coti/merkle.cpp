@@ -0,0 +1,610 @@
+#include "tops/coti/merkle.h"
+
+#include <algorithm>
+#include <cassert>
+#include <climits>
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include "tops/coti/utils.h"
+
+namespace tops {
+namespace coti {
+namespace {
+
+enum NodeTag : uint8_t {
+  kValueTag = 0,
+  kRunTag = 1,
+  kInteriorTag = 2,
+  kItemTag = 3,
+};
+
+bool is_scalar_info(const TypeInfo &type_info) {
+  return type_info.kind == OK_Bool || type_info.kind == OK_Int ||
+         type_info.kind == OK_Float;
+}
+
+// The weight defined in merkle.h, exact below `limit` and `limit` otherwise.
+size_t get_weight(const TypeInfo &type_info, const void *object,
+                  size_t limit) {
+  switch (type_info.kind) {
+    case OK_String: {
+      auto &stringInfo = static_cast<const StringInfo &>(type_info);
+      return std::min(limit, 1 + stringInfo.get(object).size() / 64);
+    }
+    case OK_Array: {
+      auto &arrayInfo = static_cast<const ArrayInfo &>(type_info);
+      size_t numChilds = arrayInfo.getNumChilds(object);
+      if (is_scalar_info(arrayInfo.childInfo)) {
+        return std::min(limit, 1 + numChilds);
+      }
+      auto *childPtr =
+          static_cast<const char *>(arrayInfo.getChildBegin(object));
+      size_t weight = 1;
+      for (size_t idx = 0; idx < numChilds && weight < limit; ++idx) {
+        weight += get_weight(arrayInfo.childInfo, childPtr, limit - weight);
+        childPtr += arrayInfo.childInfo.cppByteSize;
+      }
+      return std::min(weight, limit);
+    }
+    case OK_List: {
+      auto &listInfo = static_cast<const ListInfo &>(type_info);
+      size_t weight = 1;
+      for (size_t idx = 0, numChilds = listInfo.getNumChilds(object);
+           idx < numChilds && weight < limit; ++idx) {
+        auto child = listInfo.getChildAt(object, idx);
+        weight += get_weight(*child.type_info, child.ptr, limit - weight);
+      }
+      return std::min(weight, limit);
+    }
+    case OK_Dict: {
+      auto &dictInfo = static_cast<const DictInfo &>(type_info);
+      size_t weight = 1;
+      auto *iter = dictInfo.beginIter(object);
+      while (!dictInfo.isEndIter(object, iter) && weight < limit) {
+        auto value = dictInfo.getValueAtIter(object, iter);
+        weight += 1 + get_weight(*value.type_info, value.ptr, limit - weight);
+        iter = dictInfo.nextIter(object, iter);
+      }
+      dictInfo.finishIter(object, iter);
+      return std::min(weight, limit);
+    }
+    default:
+      return 1;
+  }
+}
+
+// Cuts children with the given weights into the ranges of child nodes: a
+// child weighing at least `leafWeight` alone, lighter ones greedily into
+// runs weighing at most `leafWeight`.
+std::vector<std::pair<size_t, size_t>> cut_runs(
+    const std::vector<size_t> &weights, size_t leafWeight) {
+  std::vector<std::pair<size_t, size_t>> ranges;
+  size_t begin = 0;
+  size_t runWeight = 0;
+  for (size_t idx = 0; idx < weights.size(); ++idx) {
+    if (weights[idx] >= leafWeight || runWeight + weights[idx] > leafWeight) {
+      if (begin != idx) {
+        ranges.emplace_back(begin, idx);
+      }
+      begin = idx;
+      runWeight = 0;
+    }
+    if (weights[idx] >= leafWeight) {
+      ranges.emplace_back(idx, idx + 1);
+      begin = idx + 1;
+      continue;
+    }
+    runWeight += weights[idx];
+  }
+  if (begin != weights.size()) {
+    ranges.emplace_back(begin, weights.size());
+  }
+  return ranges;
+}
+
+// Every node digest is computed with no other node started in between, so
+// one hasher per thread is enough.
+SHA3_256Hasher &begin_node(NodeTag tag) {
+  thread_local SHA3_256Hasher hasher;
+  hasher.reinit();
+  hasher.update(static_cast<uint8_t>(tag));
+  return hasher;
+}
+
+// A child of an Array/List, or an item of a Dict with its key.
+struct ChildRef {
+  std::string_view key;
+  TypedPtr value;
+};
+
+}  // namespace
+
+namespace impl {
+
+// Edits reported to a HashedObject since its last hash(), as a trie of path
+// elements.
+struct DirtyPaths {
+  // Everything from here down may have changed.
+  bool all = false;
+  std::map<PathElem, std::unique_ptr<DirtyPaths>> children;
+};
+
+}  // namespace impl
+
+namespace {
+
+using impl::DirtyPaths;
+
+// What an update keeps from the previous child nodes of a container.
+struct Reuse {
+  std::vector<MerkleNode> oldChildren;
+  // Previous index of every child, -1 for children that are new.
+  std::vector<ptrdiff_t> oldIdx;
+  // Edits below every dirty child that existed before, null otherwise.
+  std::vector<const DirtyPaths *> childDirty;
+  // Number of new or dirty children, and of new ones, before every child.
+  std::vector<size_t> numChangedBefore;
+  std::vector<size_t> numNewBefore;
+
+  void countChanged() {
+    size_t numChilds = oldIdx.size();
+    numChangedBefore.assign(numChilds + 1, 0);
+    numNewBefore.assign(numChilds + 1, 0);
+    for (size_t idx = 0; idx < numChilds; ++idx) {
+      bool isNew = oldIdx[idx] < 0;
+      numChangedBefore[idx + 1] =
+          numChangedBefore[idx] + (isNew || childDirty[idx]);
+      numNewBefore[idx + 1] = numNewBefore[idx] + isNew;
+    }
+  }
+
+  bool anyChanged(size_t begin, size_t end) const {
+    return numChangedBefore[end] != numChangedBefore[begin];
+  }
+
+  // The previous node covering exactly the children [begin, end), if any.
+  MerkleNode *findOld(size_t begin, size_t end) {
+    if (numNewBefore[end] != numNewBefore[begin]) {
+      return nullptr;
+    }
+    auto oldBegin = static_cast<size_t>(oldIdx[begin]);
+    if (static_cast<size_t>(oldIdx[end - 1]) - oldBegin != end - 1 - begin) {
+      return nullptr;
+    }
+    auto found = std::lower_bound(
+        oldChildren.begin(), oldChildren.end(), oldBegin,
+        [](const MerkleNode &node, size_t val) { return node.begin < val; });
+    if (found == oldChildren.end() || found->begin != oldBegin ||
+        found->end != oldBegin + (end - begin)) {
+      return nullptr;
+    }
+    return &*found;
+  }
+};
+
+size_t sum_weights(const std::vector<size_t> &weights) {
+  size_t sum = 1;
+  for (auto weight : weights) {
+    sum += weight;
+  }
+  return sum;
+}
+
+class MerkleBuilder {
+ public:
+  MerkleBuilder(WorkStealingPool &pool, size_t leafWeight, bool keepLayout)
+      : pool(pool), leafWeight(leafWeight), keepLayout(keepLayout) {}
+
+  MerkleNode build(const TypeInfo &type_info, const void *object) {
+    MerkleNode node;
+    bool isContainer = type_info.kind == OK_Array ||
+                       type_info.kind == OK_List || type_info.kind == OK_Dict;
+    if (!isContainer ||
+        get_weight(type_info, object, leafWeight) < leafWeight) {
+      node.kind = MerkleNode::Value;
+      auto &hasher = begin_node(kValueTag);
+      hash(type_info, object, hasher);
+      node.digest = hasher.finalize();
+      return node;
+    }
+    node.kind = MerkleNode::Interior;
+    buildInterior(node, type_info, object, nullptr);
+    return node;
+  }
+
+  // Brings `node`, built for `object` before the edits in `dirty`, up to
+  // date.
+  void update(MerkleNode &node, const TypeInfo &type_info, const void *object,
+              const DirtyPaths &dirty) {
+    if (dirty.all || node.kind != MerkleNode::Interior) {
+      return rebuild(node, type_info, object);
+    }
+    buildInterior(node, type_info, object, &dirty);
+  }
+
+ private:
+  void rebuild(MerkleNode &node, const TypeInfo &type_info,
+               const void *object) {
+    size_t begin = node.begin;
+    size_t end = node.end;
+    node = build(type_info, object);
+    node.begin = begin;
+    node.end = end;
+  }
+
+  // Fills in the Interior `node` of a container weighing at least the leaf
+  // weight. With `dirty`, `node` holds the tree of `object` from before the
+  // edits, and only what they touched is re-hashed.
+  void buildInterior(MerkleNode &node, const TypeInfo &type_info,
+                     const void *object, const DirtyPaths *dirty) {
+    switch (type_info.kind) {
+      case OK_Array: {
+        auto &arrayInfo = static_cast<const ArrayInfo &>(type_info);
+        if (is_scalar_info(arrayInfo.childInfo)) {
+          return buildScalarArray(node, arrayInfo, object, dirty);
+        }
+        auto &childInfo = arrayInfo.childInfo;
+        auto *childBegin =
+            static_cast<const char *>(arrayInfo.getChildBegin(object));
+        return buildSequence(
+            node, type_info, object, arrayInfo.getNumChilds(object),
+            [&](size_t idx) {
+              auto *childPtr = childBegin + idx * childInfo.cppByteSize;
+              return ChildRef{{}, {const_cast<char *>(childPtr), &childInfo}};
+            },
+            dirty);
+      }
+      case OK_List: {
+        auto &listInfo = static_cast<const ListInfo &>(type_info);
+        return buildSequence(
+            node, type_info, object, listInfo.getNumChilds(object),
+            [&](size_t idx) {
+              return ChildRef{{}, listInfo.getChildAt(object, idx)};
+            },
+            dirty);
+      }
+      default:
+        return buildDict(node, static_cast<const DictInfo &>(type_info),
+                         object, dirty);
+    }
+  }
+
+  void buildScalarArray(MerkleNode &node, const ArrayInfo &arrayInfo,
+                        const void *object, const DirtyPaths *dirty) {
+    size_t numChilds = arrayInfo.getNumChilds(object);
+    uint32_t elemSize = arrayInfo.childInfo.cppByteSize;
+    auto *childBegin =
+        static_cast<const char *>(arrayInfo.getChildBegin(object));
+    std::vector<MerkleNode> oldChildren;
+    std::vector<char> isRunDirty;
+    if (dirty) {
+      if (1 + numChilds < leafWeight) {
+        return rebuild(node, arrayInfo, object);
+      }
+      oldChildren = std::move(node.children);
+      isRunDirty.resize(oldChildren.size());
+      for (auto &[elem, childDirty] : dirty->children) {
+        auto *idx = std::get_if<size_t>(&elem);
+        if (!idx) {
+          return rebuild(node, arrayInfo, object);
+        }
+        if (*idx / leafWeight < isRunDirty.size()) {
+          isRunDirty[*idx / leafWeight] = true;
+        }
+      }
+    }
+    std::vector<std::pair<size_t, size_t>> ranges;
+    for (size_t begin = 0; begin < numChilds; begin += leafWeight) {
+      ranges.emplace_back(begin, std::min(begin + leafWeight, numChilds));
+    }
+    buildChildren(node, ranges, [&](size_t rangeIdx) {
+      auto [begin, end] = ranges[rangeIdx];
+      if (rangeIdx < oldChildren.size() && !isRunDirty[rangeIdx] &&
+          oldChildren[rangeIdx].end == end) {
+        return std::move(oldChildren[rangeIdx]);
+      }
+      MerkleNode run;
+      run.kind = MerkleNode::Run;
+      auto &hasher = begin_node(kRunTag);
+      hasher.update(static_cast<uint64_t>(end - begin));
+      hasher.updateBulk(childBegin + begin * elemSize,
+                        (end - begin) * elemSize);
+      run.digest = hasher.finalize();
+      return run;
+    });
+    finishInterior(node, OK_Array, numChilds,
+                   static_cast<uint32_t>(elemSize * CHAR_BIT));
+  }
+
+  template <typename GetChildFn>
+  void buildSequence(MerkleNode &node, const TypeInfo &type_info,
+                     const void *object, size_t numChilds,
+                     GetChildFn &&getChild, const DirtyPaths *dirty) {
+    std::vector<size_t> weights;
+    Reuse reuse;
+    if (dirty) {
+      if (numChilds != node.childWeights.size()) {
+        return rebuild(node, type_info, object);
+      }
+      weights = std::move(node.childWeights);
+      reuse.oldChildren = std::move(node.children);
+      reuse.oldIdx.resize(numChilds);
+      for (size_t idx = 0; idx < numChilds; ++idx) {
+        reuse.oldIdx[idx] = idx;
+      }
+      reuse.childDirty.resize(numChilds);
+      for (auto &[elem, childDirty] : dirty->children) {
+        auto *idx = std::get_if<size_t>(&elem);
+        if (!idx) {
+          return rebuild(node, type_info, object);
+        }
+        if (*idx >= numChilds) {
+          continue;
+        }
+        auto child = getChild(*idx).value;
+        reuse.childDirty[*idx] = childDirty.get();
+        weights[*idx] = get_weight(*child.type_info, child.ptr, leafWeight);
+      }
+      reuse.countChanged();
+      if (sum_weights(weights) < leafWeight) {
+        return rebuild(node, type_info, object);
+      }
+    } else {
+      weights.reserve(numChilds);
+      for (size_t idx = 0; idx < numChilds; ++idx) {
+        auto child = getChild(idx).value;
+        weights.push_back(get_weight(*child.type_info, child.ptr, leafWeight));
+      }
+    }
+    buildChildNodes(node, weights, getChild, false, dirty ? &reuse : nullptr);
+    finishInterior(node, type_info.kind, numChilds);
+    if (keepLayout) {
+      node.childWeights = std::move(weights);
+    }
+  }
+
+  void buildDict(MerkleNode &node, const DictInfo &dictInfo,
+                 const void *object, const DirtyPaths *dirty) {
+    std::vector<ChildRef> items;
+    items.reserve(dictInfo.getNumItems(object));
+    auto *iter = dictInfo.beginIter(object);
+    while (!dictInfo.isEndIter(object, iter)) {
+      items.push_back({dictInfo.getKeyAtIter(object, iter),
+                       dictInfo.getValueAtIter(object, iter)});
+      iter = dictInfo.nextIter(object, iter);
+    }
+    dictInfo.finishIter(object, iter);
+    std::sort(items.begin(), items.end(),
+              [](const auto &lhs, const auto &rhs) {
+                return lhs.key < rhs.key;
+              });
+    auto getWeight = [&](size_t idx) {
+      auto &value = items[idx].value;
+      return 1 + get_weight(*value.type_info, value.ptr, leafWeight);
+    };
+
+    std::vector<size_t> weights(items.size());
+    Reuse reuse;
+    bool keysChanged = true;
+    if (dirty) {
+      // Match the keys with the previous ones, both sorted.
+      auto &oldKeys = node.keys;
+      reuse.oldIdx.assign(items.size(), -1);
+      reuse.childDirty.resize(items.size());
+      size_t oldIdx = 0;
+      for (size_t idx = 0; idx < items.size(); ++idx) {
+        while (oldIdx < oldKeys.size() && oldKeys[oldIdx] < items[idx].key) {
+          ++oldIdx;
+        }
+        if (oldIdx < oldKeys.size() && oldKeys[oldIdx] == items[idx].key) {
+          reuse.oldIdx[idx] = oldIdx;
+          weights[idx] = node.childWeights[oldIdx];
+        } else {
+          weights[idx] = getWeight(idx);
+        }
+      }
+      for (auto &[elem, childDirty] : dirty->children) {
+        auto *key = std::get_if<std::string>(&elem);
+        if (!key) {
+          return rebuild(node, dictInfo, object);
+        }
+        auto found = std::lower_bound(
+            items.begin(), items.end(), std::string_view(*key),
+            [](const ChildRef &item, std::string_view val) {
+              return item.key < val;
+            });
+        if (found == items.end() || found->key != *key) {
+          continue;
+        }
+        size_t idx = found - items.begin();
+        if (reuse.oldIdx[idx] >= 0) {
+          reuse.childDirty[idx] = childDirty.get();
+          weights[idx] = getWeight(idx);
+        }
+      }
+      reuse.countChanged();
+      keysChanged = items.size() != oldKeys.size() ||
+                    reuse.numNewBefore.back() != 0;
+      if (sum_weights(weights) < leafWeight) {
+        return rebuild(node, dictInfo, object);
+      }
+      reuse.oldChildren = std::move(node.children);
+    } else {
+      for (size_t idx = 0; idx < items.size(); ++idx) {
+        weights[idx] = getWeight(idx);
+      }
+    }
+    buildChildNodes(
+        node, weights, [&](size_t idx) { return items[idx]; }, true,
+        dirty ? &reuse : nullptr);
+    finishInterior(node, OK_Dict, items.size());
+    if (keepLayout) {
+      node.childWeights = std::move(weights);
+      if (keysChanged) {
+        node.keys.clear();
+        node.keys.reserve(items.size());
+        for (auto &item : items) {
+          node.keys.emplace_back(item.key);
+        }
+      }
+    }
+  }
+
+  // Cuts the children into heavy nodes and runs, and builds the nodes that
+  // `reuse` (if any) can't supply unchanged.
+  template <typename GetChildFn>
+  void buildChildNodes(MerkleNode &node, const std::vector<size_t> &weights,
+                       GetChildFn &&getChild, bool isDict, Reuse *reuse) {
+    auto ranges = cut_runs(weights, leafWeight);
+    buildChildren(node, ranges, [&](size_t rangeIdx) {
+      auto [begin, end] = ranges[rangeIdx];
+      auto *prev = reuse ? reuse->findOld(begin, end) : nullptr;
+      if (prev && !reuse->anyChanged(begin, end)) {
+        return std::move(*prev);
+      }
+      if (end - begin == 1 && weights[begin] >= leafWeight) {
+        auto child = getChild(begin);
+        MerkleNode valueNode;
+        auto *childDirty = reuse ? reuse->childDirty[begin] : nullptr;
+        if (prev && prev->kind != MerkleNode::Run && childDirty) {
+          valueNode = std::move(isDict ? prev->children.front() : *prev);
+          update(valueNode, *child.value.type_info, child.value.ptr,
+                 *childDirty);
+        } else {
+          valueNode = build(*child.value.type_info, child.value.ptr);
+        }
+        if (!isDict) {
+          return valueNode;
+        }
+        MerkleNode itemNode;
+        itemNode.kind = MerkleNode::Item;
+        auto &hasher = begin_node(kItemTag);
+        hasher.update(static_cast<uint64_t>(child.key.size()));
+        hasher.update(child.key.data(), child.key.size());
+        hasher.update(valueNode.digest);
+        itemNode.digest = hasher.finalize();
+        itemNode.children.push_back(std::move(valueNode));
+        return itemNode;
+      }
+      MerkleNode run;
+      run.kind = MerkleNode::Run;
+      auto &hasher = begin_node(kRunTag);
+      hasher.update(static_cast<uint64_t>(end - begin));
+      for (size_t idx = begin; idx < end; ++idx) {
+        auto child = getChild(idx);
+        if (isDict) {
+          hasher.update(static_cast<uint64_t>(child.key.size()));
+          hasher.update(child.key.data(), child.key.size());
+        }
+        hash(*child.value.type_info, child.value.ptr, hasher);
+      }
+      run.digest = hasher.finalize();
+      return run;
+    });
+  }
+
+  // Sets the children of `node` to `buildRange(idx)` for every range, each
+  // built in its own task, and their begin/end to the range.
+  template <typename BuildRangeFn>
+  void buildChildren(MerkleNode &node,
+                     const std::vector<std::pair<size_t, size_t>> &ranges,
+                     BuildRangeFn &&buildRange) {
+    std::vector<MerkleNode> children(ranges.size());
+    TaskGroup group(pool);
+    for (size_t idx = 0; idx < ranges.size(); ++idx) {
+      group.spawn([&, idx] {
+        auto &child = children[idx];
+        child = buildRange(idx);
+        child.begin = ranges[idx].first;
+        child.end = ranges[idx].second;
+      });
+    }
+    group.wait();
+    node.children = std::move(children);
+  }
+
+  void finishInterior(MerkleNode &node, TypeKind kind, size_t size,
+                      uint32_t childBitWidth = 0) {
+    auto &hasher = begin_node(kInteriorTag);
+    hasher.update(static_cast<uint8_t>(kind));
+    hasher.update(static_cast<uint64_t>(size));
+    if (childBitWidth != 0) {
+      hasher.update(childBitWidth);
+    }
+    hasher.update(static_cast<uint64_t>(node.children.size()));
+    for (auto &child : node.children) {
+      hasher.update(child.digest);
+    }
+    node.digest = hasher.finalize();
+  }
+
+  WorkStealingPool &pool;
+  size_t leafWeight;
+  // Whether to fill in MerkleNode::childWeights/keys for update().
+  bool keepLayout;
+};
+
+}  // namespace
+
+MerkleTree merkle_hash(const TypeInfo &type_info, const void *object,
+                       WorkStealingPool &pool, size_t leafWeight) {
+  assert(leafWeight > 1);
+  return {MerkleBuilder(pool, leafWeight, false).build(type_info, object),
+          leafWeight};
+}
+
+bool merkle_verify(const MerkleNode &node, const TypeInfo &type_info,
+                   const void *object, WorkStealingPool &pool,
+                   size_t leafWeight) {
+  return merkle_hash(type_info, object, pool, leafWeight).getDigest() ==
+         node.digest;
+}
+
+HashedObject::HashedObject(const TypeInfo &type_info, const void *object,
+                           WorkStealingPool &pool, size_t leafWeight)
+    : type_info(type_info),
+      object(object),
+      pool(pool),
+      tree{{}, leafWeight},
+      dirty(std::make_unique<impl::DirtyPaths>()) {
+  assert(leafWeight > 1);
+}
+
+HashedObject::~HashedObject() = default;
+
+void HashedObject::markDirty(const Path &path) {
+  auto *node = dirty.get();
+  for (auto &elem : path.getElems()) {
+    if (node->all) {
+      return;
+    }
+    auto &child = node->children[elem];
+    if (!child) {
+      child = std::make_unique<impl::DirtyPaths>();
+    }
+    node = child.get();
+  }
+  node->all = true;
+  node->children.clear();
+}
+
+const SHA3_256DigestTy &HashedObject::hash() {
+  MerkleBuilder builder(pool, tree.leafWeight, true);
+  if (!hashed) {
+    tree.root = builder.build(type_info, object);
+    hashed = true;
+  } else if (dirty->all || !dirty->children.empty()) {
+    builder.update(tree.root, type_info, object, *dirty);
+  }
+  *dirty = {};
+  return tree.getDigest();
+}
+
+}  // namespace coti
+}  // namespace tops
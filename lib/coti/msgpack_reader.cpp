@@ -0,0 +1,562 @@
+#include "tops/coti/msgpack_reader.h"
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+#include "scalar_array.h"
+#include "tops/coti/span.h"
+#include "tops/coti/struct_info.h"
+#include "type_info_dispatch.h"
+
+namespace tops {
+namespace coti {
+namespace {
+
+using impl::type_info_dispatch;
+
+template <typename T>
+T load_be(const char *ptr) {
+  T val;
+  std::memcpy(&val, ptr, sizeof(T));
+  if constexpr (sizeof(T) == 2) {
+    return __builtin_bswap16(val);
+  }
+  if constexpr (sizeof(T) == 4) {
+    return __builtin_bswap32(val);
+  }
+  if constexpr (sizeof(T) == 8) {
+    return __builtin_bswap64(val);
+  }
+  return val;
+}
+
+// Typed loop over an already sized C array, see scalar_array.h.
+template <typename T>
+bool read_scalar_array(MsgPackReader &reader, T *data, size_t numChilds) {
+  MsgPackToken token;
+  if constexpr (std::is_floating_point_v<T>) {
+    for (size_t idx = 0; idx < numChilds; ++idx) {
+      if (!reader.next(token) || token.kind != MsgPackToken::Float) {
+        return false;
+      }
+      data[idx] = static_cast<T>(token.f64);
+    }
+    return true;
+  } else {
+    int64_t minVal = 0;
+    int64_t maxVal = 0;
+    for (size_t idx = 0; idx < numChilds; ++idx) {
+      if (!reader.next(token) || (token.kind != MsgPackToken::PosInt &&
+                                  token.kind != MsgPackToken::NegInt)) {
+        return false;
+      }
+      auto val = token.getInt();
+      minVal = std::min(minVal, val);
+      maxVal = std::max(maxVal, val);
+      data[idx] = static_cast<T>(val);
+    }
+    if constexpr (sizeof(T) < sizeof(int64_t)) {
+      return minVal >= int64_t(std::numeric_limits<T>::min()) &&
+             maxVal <= int64_t(std::numeric_limits<T>::max());
+    }
+    return true;
+  }
+}
+
+// Reads the `numItems` items of a map into a struct. Keys that aren't fields
+// are skipped, fields without a key default-filled.
+bool read_struct(const StructInfo &structInfo, void *object, uint32_t numItems,
+                 MsgPackReader &reader) {
+  SeenFields seen(structInfo.getNumFields());
+  for (uint32_t idx = 0; idx < numItems; ++idx) {
+    MsgPackToken keyToken;
+    std::string_view key;
+    if (!reader.next(keyToken) || keyToken.kind != MsgPackToken::Str ||
+        !reader.readBytes(keyToken.size, key)) {
+      return false;
+    }
+    auto fieldIdx = structInfo.findField(key);
+    if (fieldIdx < 0) {
+      if (!reader.skip()) {
+        return false;
+      }
+      continue;
+    }
+    seen.set(fieldIdx);
+    auto field = structInfo.getFieldAt(object, fieldIdx);
+    if (!from_msgpack(*field.type_info, field.ptr, reader)) {
+      return false;
+    }
+  }
+  if (structInfo.getHasDefaults()) {
+    structInfo.fillMissing(object, seen);
+  }
+  return true;
+}
+
+// Containers read from chunked input start at this many children.
+constexpr size_t kMinGrowth = 1 << 10;
+
+// Reads children [begin, end) of an already sized Array.
+bool read_childs(const ArrayInfo &arrayInfo, void *object, size_t begin,
+                 size_t end, MsgPackReader &reader) {
+  auto &childInfo = arrayInfo.childInfo;
+  auto *child = static_cast<char *>(arrayInfo.getChildBegin(object)) +
+                begin * childInfo.cppByteSize;
+  bool res = false;
+  if (impl::with_scalar_type(childInfo, [&](auto tag) {
+        using ElemT = typename decltype(tag)::type;
+        res = read_scalar_array(reader, reinterpret_cast<ElemT *>(child),
+                                end - begin);
+      })) {
+    return res;
+  }
+  for (size_t idx = begin; idx < end; ++idx) {
+    if (!from_msgpack(childInfo, child, reader)) {
+      return false;
+    }
+    child += childInfo.cppByteSize;
+  }
+  return true;
+}
+
+// Reads children [begin, end) of an already sized List.
+bool read_childs(const ListInfo &listInfo, void *object, size_t begin,
+                 size_t end, MsgPackReader &reader) {
+  for (size_t idx = begin; idx < end; ++idx) {
+    auto childPtr = listInfo.getChildAt(object, idx);
+    if (!from_msgpack(*childPtr.type_info, childPtr.ptr, reader)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+template <typename T>
+struct FromMsgPackStream {
+  static bool run(const T &type_info, void *object, MsgPackReader &reader) {
+    MsgPackToken token;
+    if (!reader.next(token)) {
+      return false;
+    }
+    if constexpr (std::is_same_v<T, BoolInfo>) {
+      if (token.kind != MsgPackToken::Bool) {
+        return false;
+      }
+      type_info.set(object, token.boolean);
+      return true;
+    }
+    if constexpr (std::is_same_v<T, IntegerInfo>) {
+      if (token.kind != MsgPackToken::PosInt &&
+          token.kind != MsgPackToken::NegInt) {
+        return false;
+      }
+      type_info.set(object, token.getInt());
+      return true;
+    }
+    if constexpr (std::is_same_v<T, FloatInfo>) {
+      if (token.kind != MsgPackToken::Float) {
+        return false;
+      }
+      type_info.set(object, token.f64);
+      return true;
+    }
+    if constexpr (std::is_same_v<T, StringInfo>) {
+      // Views need the payload to outlive the reader's window.
+      std::string_view str;
+      if (token.kind != MsgPackToken::Str ||
+          (type_info.isView && !reader.isBorrowed()) ||
+          !reader.readBytes(token.size, str)) {
+        return false;
+      }
+      type_info.set(object, str);
+      return true;
+    }
+    if constexpr (std::is_same_v<T, ArrayInfo>) {
+      if (type_info.isView) {
+        // Views need the payload to outlive the reader's window.
+        std::string_view bytes;
+        return token.kind == MsgPackToken::Bin && reader.isBorrowed() &&
+               reader.readBytes(token.size, bytes) &&
+               static_cast<const SpanInfo &>(type_info).setView(object, bytes);
+      }
+    }
+    if constexpr (std::is_same_v<T, ArrayInfo> || std::is_same_v<T, ListInfo>) {
+      if (token.kind != MsgPackToken::Array) {
+        return false;
+      }
+      // A forged count mustn't allocate more than the input holds. A buffer
+      // bounds it up front; chunked input doesn't, so there the container
+      // grows along with the children decoded so far.
+      size_t numChilds = token.size;
+      if (numChilds > reader.getMaxNumValues()) {
+        return false;
+      }
+      bool mayGrow = !reader.isBorrowed() &&
+                     numChilds > type_info.getNumChilds(object);
+      size_t numDone = 0;
+      do {
+        size_t numNext = numChilds;
+        if (mayGrow) {
+          numNext = std::min(numChilds, std::max(numDone * 2, kMinGrowth));
+        }
+        type_info.resize(object, numNext);
+        if (!read_childs(type_info, object, numDone, numNext, reader)) {
+          return false;
+        }
+        numDone = numNext;
+      } while (numDone < numChilds);
+      return true;
+    }
+    if constexpr (std::is_same_v<T, DictInfo>) {
+      if (token.kind != MsgPackToken::Map) {
+        return false;
+      }
+      if (type_info.isStruct) {
+        return read_struct(static_cast<const StructInfo &>(type_info), object,
+                           token.size, reader);
+      }
+      for (size_t idx = 0; idx < token.size; ++idx) {
+        MsgPackToken keyToken;
+        std::string_view key;
+        if (!reader.next(keyToken) || keyToken.kind != MsgPackToken::Str ||
+            !reader.readBytes(keyToken.size, key)) {
+          return false;
+        }
+        // `key` may point into the reader's window, so it has to be consumed
+        // before decoding the value.
+        auto valPtr = type_info.getValueAt(object, key);
+        if (!from_msgpack(*valPtr.type_info, valPtr.ptr, reader)) {
+          return false;
+        }
+      }
+      return true;
+    }
+  }
+};
+
+}  // namespace
+
+MsgPackReader::MsgPackReader(std::string_view buffer)
+    : windowBegin(buffer.data()),
+      cur(buffer.data()),
+      end(buffer.data() + buffer.size()) {}
+
+MsgPackReader::MsgPackReader(ReadFn read, size_t chunkSize)
+    : windowBegin(nullptr),
+      cur(nullptr),
+      end(nullptr),
+      read(std::move(read)),
+      chunkSize(chunkSize) {}
+
+MsgPackReader::MsgPackReader(NextChunkFn nextChunk)
+    : windowBegin(nullptr),
+      cur(nullptr),
+      end(nullptr),
+      nextChunk(std::move(nextChunk)) {}
+
+bool MsgPackReader::refill(size_t size) {
+  if (nextChunk) {
+    return refillFromChunks(size);
+  }
+  if (!read) {
+    return false;
+  }
+  size_t remain = end - cur;
+  size_t capacity = std::max(size, chunkSize);
+  if (window.size() < capacity) {
+    std::vector<char> newWindow(capacity);
+    if (remain != 0) {
+      std::memcpy(newWindow.data(), cur, remain);
+    }
+    window.swap(newWindow);
+  } else if (remain != 0) {
+    std::memmove(window.data(), cur, remain);
+  }
+  consumedBefore += cur - windowBegin;
+  windowBegin = window.data();
+  cur = windowBegin;
+  end = windowBegin + remain;
+  while (remain < size) {
+    size_t got = read(window.data() + remain, window.size() - remain);
+    if (got == 0) {
+      return false;
+    }
+    remain += got;
+    end = windowBegin + remain;
+  }
+  return true;
+}
+
+bool MsgPackReader::refillFromChunks(size_t size) {
+  consumedBefore += cur - windowBegin;
+  windowBegin = cur;
+  size_t remain = end - cur;
+  auto pull = [&] {
+    auto chunk = nextChunk();
+    chunkCur = chunk.data();
+    chunkEnd = chunk.data() + chunk.size();
+    return !chunk.empty();
+  };
+  if (remain == 0) {
+    // Nothing is left over, so decode from the next chunk in place.
+    if (chunkCur == chunkEnd && !pull()) {
+      return false;
+    }
+    windowBegin = cur = chunkCur;
+    end = chunkEnd;
+    chunkCur = chunkEnd;
+    remain = end - cur;
+    if (remain >= size) {
+      return true;
+    }
+  }
+  // The value straddles chunks; gather it in the window, and go back to the
+  // rest of the last chunk once it is consumed.
+  if (window.size() < size) {
+    std::vector<char> newWindow(size);
+    if (remain != 0) {
+      std::memcpy(newWindow.data(), cur, remain);
+    }
+    window.swap(newWindow);
+  } else if (remain != 0) {
+    std::memmove(window.data(), cur, remain);
+  }
+  windowBegin = cur = window.data();
+  end = windowBegin + remain;
+  while (remain < size) {
+    if (chunkCur == chunkEnd && !pull()) {
+      return false;
+    }
+    size_t len = std::min(size - remain, size_t(chunkEnd - chunkCur));
+    std::memcpy(window.data() + remain, chunkCur, len);
+    chunkCur += len;
+    remain += len;
+    end = windowBegin + remain;
+  }
+  return true;
+}
+
+bool MsgPackReader::atEnd() { return cur == end && !refill(1); }
+
+bool MsgPackReader::next(MsgPackToken &token) {
+  if (!ensure(1)) {
+    return false;
+  }
+  auto byte = static_cast<uint8_t>(*cur++);
+  // Fix-sized formats encode their payload in the first byte.
+  if (byte <= 0x7f) {
+    token.kind = MsgPackToken::PosInt;
+    token.u64 = byte;
+    return true;
+  }
+  if (byte >= 0xe0) {
+    token.kind = MsgPackToken::NegInt;
+    token.u64 = static_cast<uint64_t>(static_cast<int64_t>(int8_t(byte)));
+    return true;
+  }
+  if (byte <= 0x8f) {
+    token.kind = MsgPackToken::Map;
+    token.size = byte & 0x0f;
+    return true;
+  }
+  if (byte <= 0x9f) {
+    token.kind = MsgPackToken::Array;
+    token.size = byte & 0x0f;
+    return true;
+  }
+  if (byte <= 0xbf) {
+    token.kind = MsgPackToken::Str;
+    token.size = byte & 0x1f;
+    return true;
+  }
+
+  static constexpr uint8_t kPayloadBytes[] = {
+      0, 0, 0, 0,        // nil, (never used), false, true
+      1, 2, 4,           // bin 8/16/32
+      2, 3, 5,           // ext 8/16/32
+      4, 8,              // float 32/64
+      1, 2, 4, 8,        // uint 8/16/32/64
+      1, 2, 4, 8,        // int 8/16/32/64
+      2, 3, 5, 9, 17,    // fixext 1/2/4/8/16 (type byte + data)
+      1, 2, 4,           // str 8/16/32
+      2, 4,              // array 16/32
+      2, 4,              // map 16/32
+  };
+  size_t headerBytes = kPayloadBytes[byte - 0xc0];
+  if (byte >= 0xd4 && byte <= 0xd8) {
+    // For fixext only the type byte is part of the header.
+    headerBytes = 1;
+  }
+  if (!ensure(headerBytes)) {
+    return false;
+  }
+  const char *ptr = cur;
+  cur += headerBytes;
+  switch (byte) {
+    case 0xc0:
+      token.kind = MsgPackToken::Nil;
+      return true;
+    case 0xc2:
+    case 0xc3:
+      token.kind = MsgPackToken::Bool;
+      token.boolean = byte == 0xc3;
+      return true;
+    case 0xc4:
+    case 0xc5:
+    case 0xc6:
+      token.kind = MsgPackToken::Bin;
+      token.size = byte == 0xc4   ? load_be<uint8_t>(ptr)
+                   : byte == 0xc5 ? load_be<uint16_t>(ptr)
+                                  : load_be<uint32_t>(ptr);
+      return true;
+    case 0xc7:
+    case 0xc8:
+    case 0xc9: {
+      token.kind = MsgPackToken::Ext;
+      size_t lenBytes = headerBytes - 1;
+      token.size = lenBytes == 1   ? load_be<uint8_t>(ptr)
+                   : lenBytes == 2 ? load_be<uint16_t>(ptr)
+                                   : load_be<uint32_t>(ptr);
+      token.extType = static_cast<int8_t>(ptr[lenBytes]);
+      return true;
+    }
+    case 0xca: {
+      uint32_t bits = load_be<uint32_t>(ptr);
+      float val;
+      std::memcpy(&val, &bits, sizeof(val));
+      token.kind = MsgPackToken::Float;
+      token.f64 = val;
+      return true;
+    }
+    case 0xcb: {
+      uint64_t bits = load_be<uint64_t>(ptr);
+      token.kind = MsgPackToken::Float;
+      std::memcpy(&token.f64, &bits, sizeof(token.f64));
+      return true;
+    }
+    case 0xcc:
+      token.kind = MsgPackToken::PosInt;
+      token.u64 = load_be<uint8_t>(ptr);
+      return true;
+    case 0xcd:
+      token.kind = MsgPackToken::PosInt;
+      token.u64 = load_be<uint16_t>(ptr);
+      return true;
+    case 0xce:
+      token.kind = MsgPackToken::PosInt;
+      token.u64 = load_be<uint32_t>(ptr);
+      return true;
+    case 0xcf:
+      token.kind = MsgPackToken::PosInt;
+      token.u64 = load_be<uint64_t>(ptr);
+      return true;
+    case 0xd0:
+    case 0xd1:
+    case 0xd2:
+    case 0xd3: {
+      int64_t val = byte == 0xd0   ? int8_t(load_be<uint8_t>(ptr))
+                    : byte == 0xd1 ? int16_t(load_be<uint16_t>(ptr))
+                    : byte == 0xd2 ? int32_t(load_be<uint32_t>(ptr))
+                                   : int64_t(load_be<uint64_t>(ptr));
+      token.kind = val < 0 ? MsgPackToken::NegInt : MsgPackToken::PosInt;
+      token.u64 = static_cast<uint64_t>(val);
+      return true;
+    }
+    case 0xd4:
+    case 0xd5:
+    case 0xd6:
+    case 0xd7:
+    case 0xd8:
+      token.kind = MsgPackToken::Ext;
+      token.size = kPayloadBytes[byte - 0xc0] - 1;
+      token.extType = static_cast<int8_t>(ptr[0]);
+      return true;
+    case 0xd9:
+    case 0xda:
+    case 0xdb:
+      token.kind = MsgPackToken::Str;
+      token.size = byte == 0xd9   ? load_be<uint8_t>(ptr)
+                   : byte == 0xda ? load_be<uint16_t>(ptr)
+                                  : load_be<uint32_t>(ptr);
+      return true;
+    case 0xdc:
+    case 0xdd:
+      token.kind = MsgPackToken::Array;
+      token.size =
+          byte == 0xdc ? load_be<uint16_t>(ptr) : load_be<uint32_t>(ptr);
+      return true;
+    case 0xde:
+    case 0xdf:
+      token.kind = MsgPackToken::Map;
+      token.size =
+          byte == 0xde ? load_be<uint16_t>(ptr) : load_be<uint32_t>(ptr);
+      return true;
+    default:
+      // 0xc1 is never used.
+      return false;
+  }
+}
+
+bool MsgPackReader::readBytes(size_t size, std::string_view &bytes) {
+  if (!ensure(size)) {
+    return false;
+  }
+  bytes = std::string_view(cur, size);
+  cur += size;
+  return true;
+}
+
+bool MsgPackReader::skipBytes(size_t size) {
+  // Don't grow the window for payloads that are skipped anyway.
+  while (size > static_cast<size_t>(end - cur)) {
+    size -= end - cur;
+    cur = end;
+    if (!refill(1)) {
+      return false;
+    }
+  }
+  cur += size;
+  return true;
+}
+
+bool MsgPackReader::skip() {
+  size_t remain = 1;
+  MsgPackToken token;
+  while (remain != 0) {
+    --remain;
+    if (!next(token)) {
+      return false;
+    }
+    switch (token.kind) {
+      case MsgPackToken::Str:
+      case MsgPackToken::Bin:
+      case MsgPackToken::Ext:
+        if (!skipBytes(token.size)) {
+          return false;
+        }
+        break;
+      case MsgPackToken::Array:
+        remain += token.size;
+        break;
+      case MsgPackToken::Map:
+        remain += size_t(token.size) * 2;
+        break;
+      default:
+        break;
+    }
+  }
+  return true;
+}
+
+bool from_msgpack(const TypeInfo &type_info, void *object,
+                  MsgPackReader &reader) {
+#ifdef TOPS_COTI_INSTRUMENT
+  impl::InstrumentOpScope opScope(InstrumentOp::FromMsgPack, &reader);
+#endif
+  return type_info_dispatch<FromMsgPackStream>(type_info, object, reader);
+}
+
+}  // namespace coti
+}  // namespace tops
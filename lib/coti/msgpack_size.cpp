@@ -0,0 +1,162 @@
+#include "tops/coti/msgpack_size.h"
+
+#include <cstring>
+#include <type_traits>
+
+#include "msgpack.h"
+#include "scalar_array.h"
+#include "tops/coti/utils.h"
+#include "type_info_dispatch.h"
+
+namespace tops {
+namespace coti {
+namespace {
+
+using impl::type_info_dispatch;
+
+// The sizes below follow msgpack-c's packers, which pick the shortest form for
+// each integer value and length.
+
+size_t int_size(int64_t val) {
+  if (val >= 0) {
+    if (val < (1 << 7)) {
+      return 1;
+    }
+    if (val < (1 << 8)) {
+      return 2;
+    }
+    if (val < (1 << 16)) {
+      return 3;
+    }
+    return val < (int64_t(1) << 32) ? 5 : 9;
+  }
+  if (val >= -(1 << 5)) {
+    return 1;
+  }
+  if (val >= -(1 << 7)) {
+    return 2;
+  }
+  if (val >= -(1 << 15)) {
+    return 3;
+  }
+  return val >= -(int64_t(1) << 31) ? 5 : 9;
+}
+
+size_t str_header_size(size_t size) {
+  return size < 32 ? 1 : size < (1 << 8) ? 2 : size < (1 << 16) ? 3 : 5;
+}
+
+size_t bin_header_size(size_t size) {
+  return size < (1 << 8) ? 2 : size < (1 << 16) ? 3 : 5;
+}
+
+// Array and map headers.
+size_t container_header_size(size_t size) {
+  return size < 16 ? 1 : size < (1 << 16) ? 3 : 5;
+}
+
+template <typename T>
+struct MsgPackSize {
+  static size_t run(const T &type_info, const void *object) {
+    if constexpr (std::is_same_v<T, BoolInfo>) {
+      // msgpack_pack_true()/msgpack_pack_false().
+      return 1;
+    }
+    if constexpr (std::is_same_v<T, IntegerInfo>) {
+      return int_size(type_info.get(object));
+    }
+    if constexpr (std::is_same_v<T, FloatInfo>) {
+      // Always msgpack_pack_double().
+      return 9;
+    }
+    if constexpr (std::is_same_v<T, StringInfo>) {
+      auto size = type_info.get(object).size();
+      return str_header_size(size) + size;
+    }
+    if constexpr (std::is_same_v<T, ArrayInfo>) {
+      auto numChilds = type_info.getNumChilds(object);
+      auto &childInfo = type_info.childInfo;
+      if (type_info.isView) {
+        auto numBytes = numChilds * childInfo.cppByteSize;
+        return bin_header_size(numBytes) + numBytes;
+      }
+      size_t size = container_header_size(numChilds);
+      // Fixed width, see pack_scalar_elems().
+      if (impl::with_scalar_type(childInfo, [&](auto tag) {
+            using ElemT = typename decltype(tag)::type;
+            using WireT =
+                std::conditional_t<std::is_floating_point_v<ElemT>, double,
+                                   ElemT>;
+            size += numChilds * (1 + sizeof(WireT));
+          })) {
+        return size;
+      }
+      auto *childPtr =
+          static_cast<const char *>(type_info.getChildBegin(object));
+      for (size_t idx = 0; idx < numChilds; ++idx) {
+        size += msgpack_size(childInfo, childPtr);
+        childPtr += childInfo.cppByteSize;
+      }
+      return size;
+    }
+    if constexpr (std::is_same_v<T, ListInfo>) {
+      auto numChilds = type_info.getNumChilds(object);
+      size_t size = container_header_size(numChilds);
+      for (size_t idx = 0; idx < numChilds; ++idx) {
+        auto child = type_info.getChildAt(object, idx);
+        size += msgpack_size(*child.type_info, child.ptr);
+      }
+      return size;
+    }
+    if constexpr (std::is_same_v<T, DictInfo>) {
+      // Codecs emit the same map as the generic walk.
+      size_t size = container_header_size(type_info.getNumItems(object));
+      auto iter = type_info.beginIter(object);
+      while (!type_info.isEndIter(object, iter)) {
+        auto keySize = type_info.getKeyAtIter(object, iter).size();
+        auto value = type_info.getValueAtIter(object, iter);
+        size += str_header_size(keySize) + keySize +
+                msgpack_size(*value.type_info, value.ptr);
+        iter = type_info.nextIter(object, iter);
+      }
+      type_info.finishIter(object, iter);
+      return size;
+    }
+  }
+};
+
+struct BufferWriter {
+  char *cur;
+  char *end;
+  // Set once a write didn't fit; every later write is dropped.
+  bool isFull = false;
+
+  static int write(void *data, const char *buf, size_t len) {
+    auto *writer = static_cast<BufferWriter *>(data);
+    if (writer->isFull ||
+        static_cast<size_t>(writer->end - writer->cur) < len) {
+      writer->isFull = true;
+      return -1;
+    }
+    std::memcpy(writer->cur, buf, len);
+    writer->cur += len;
+    return 0;
+  }
+};
+
+}  // namespace
+
+size_t msgpack_size(const TypeInfo &type_info, const void *object) {
+  return type_info_dispatch<MsgPackSize>(type_info, object);
+}
+
+size_t to_msgpack_into(const TypeInfo &type_info, const void *object,
+                       char *buf, size_t size) {
+  BufferWriter writer{buf, buf + size};
+  msgpack_packer packer{&writer, BufferWriter::write};
+  to_msgpack(type_info, object, packer);
+  return writer.isFull ? 0 : writer.cur - buf;
+}
+
+}  // namespace coti
+}  // namespace tops
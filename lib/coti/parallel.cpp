@@ -0,0 +1,417 @@
+#include "tops/coti/parallel.h"
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "msgpack.h"
+#include "scalar_array.h"
+#include "tops/coti/utils.h"
+
+namespace tops {
+namespace coti {
+namespace {
+
+// Rough number of leaf values under `object`, where a string counts one per
+// 64 bytes. Counting stops once `limit` is reached, and arrays are estimated
+// from their first element, so deciding not to split stays cheap.
+size_t estimate_weight(const TypeInfo &type_info, const void *object,
+                       size_t limit) {
+  switch (type_info.kind) {
+    case OK_String: {
+      auto &stringInfo = static_cast<const StringInfo &>(type_info);
+      return 1 + stringInfo.get(object).size() / 64;
+    }
+    case OK_Array: {
+      auto &arrayInfo = static_cast<const ArrayInfo &>(type_info);
+      size_t numChilds = arrayInfo.getNumChilds(object);
+      if (numChilds == 0) {
+        return 1;
+      }
+      size_t childWeight = estimate_weight(
+          arrayInfo.childInfo, arrayInfo.getChildBegin(object), limit);
+      return numChilds >= limit / childWeight ? limit
+                                              : 1 + numChilds * childWeight;
+    }
+    case OK_List: {
+      auto &listInfo = static_cast<const ListInfo &>(type_info);
+      size_t weight = 1;
+      for (size_t idx = 0, numChilds = listInfo.getNumChilds(object);
+           idx < numChilds && weight < limit; ++idx) {
+        auto child = listInfo.getChildAt(object, idx);
+        weight += estimate_weight(*child.type_info, child.ptr, limit - weight);
+      }
+      return std::min(weight, limit);
+    }
+    case OK_Dict: {
+      auto &dictInfo = static_cast<const DictInfo &>(type_info);
+      size_t weight = 1;
+      auto *iter = dictInfo.beginIter(object);
+      while (!dictInfo.isEndIter(object, iter) && weight < limit) {
+        auto value = dictInfo.getValueAtIter(object, iter);
+        weight +=
+            1 + estimate_weight(*value.type_info, value.ptr, limit - weight);
+        iter = dictInfo.nextIter(object, iter);
+      }
+      dictInfo.finishIter(object, iter);
+      return std::min(weight, limit);
+    }
+    default:
+      return 1;
+  }
+}
+
+struct DictItem {
+  std::string_view key;
+  TypedPtr value;
+  size_t weight;
+};
+
+// Items of a dict to be split, shared with the tasks encoding them.
+std::shared_ptr<const std::vector<DictItem>> get_dict_items(
+    const DictInfo &dictInfo, const void *object, size_t splitThreshold) {
+  auto items = std::make_shared<std::vector<DictItem>>();
+  items->reserve(dictInfo.getNumItems(object));
+  auto *iter = dictInfo.beginIter(object);
+  while (!dictInfo.isEndIter(object, iter)) {
+    auto value = dictInfo.getValueAtIter(object, iter);
+    items->push_back(
+        {dictInfo.getKeyAtIter(object, iter), value,
+         estimate_weight(*value.type_info, value.ptr, splitThreshold)});
+    iter = dictInfo.nextIter(object, iter);
+  }
+  dictInfo.finishIter(object, iter);
+  return items;
+}
+
+// Calls `fn(begin, end)` for consecutive runs of children whose weights add
+// up to about `splitThreshold`. A heavy child gets a run of its own.
+template <typename WeightFn, typename Fn>
+void for_each_chunk(size_t numChilds, size_t splitThreshold,
+                    WeightFn &&getWeight, Fn &&fn) {
+  size_t begin = 0;
+  size_t weight = 0;
+  for (size_t idx = 0; idx < numChilds; ++idx) {
+    size_t childWeight = getWeight(idx);
+    if (idx != begin && weight + childWeight > splitThreshold) {
+      fn(begin, idx);
+      begin = idx;
+      weight = 0;
+    }
+    weight += childWeight;
+  }
+  if (begin != numChilds) {
+    fn(begin, numChilds);
+  }
+}
+
+// Output of one task: bytes it wrote itself, interleaved with the outputs of
+// the tasks it spawned, in the order they belong in the stream.
+class Pieces {
+ public:
+  // Where the calling task's next bytes go.
+  std::string &getBytes() {
+    if (parts.empty() || parts.back().child) {
+      parts.emplace_back();
+    }
+    return parts.back().bytes;
+  }
+
+  // Output of a spawned task, placed after everything written so far.
+  Pieces &addChild() {
+    parts.emplace_back();
+    parts.back().child = std::make_unique<Pieces>();
+    return *parts.back().child;
+  }
+
+  void writeTo(msgpack_packer &packer) const {
+    for (auto &part : parts) {
+      if (part.child) {
+        part.child->writeTo(packer);
+      } else {
+        packer.callback(packer.data, part.bytes.data(), part.bytes.size());
+      }
+    }
+  }
+
+  msgpack_packer getPacker() { return {this, append}; }
+
+ private:
+  static int append(void *data, const char *buf, size_t len) {
+    static_cast<Pieces *>(data)->getBytes().append(buf, len);
+    return 0;
+  }
+
+  struct Part {
+    std::string bytes;
+    std::unique_ptr<Pieces> child;
+  };
+
+  std::vector<Part> parts;
+};
+
+class MsgPackEncoder {
+ public:
+  MsgPackEncoder(TaskGroup &group, size_t splitThreshold)
+      : group(group), splitThreshold(splitThreshold) {}
+
+  void encode(const TypeInfo &type_info, const void *object, Pieces &out) {
+    if (estimate_weight(type_info, object, splitThreshold) < splitThreshold) {
+      auto packer = out.getPacker();
+      return to_msgpack(type_info, object, packer);
+    }
+    switch (type_info.kind) {
+      case OK_Array:
+        return encode(static_cast<const ArrayInfo &>(type_info), object, out);
+      case OK_List:
+        return encode(static_cast<const ListInfo &>(type_info), object, out);
+      case OK_Dict:
+        return encode(static_cast<const DictInfo &>(type_info), object, out);
+      default: {
+        auto packer = out.getPacker();
+        return to_msgpack(type_info, object, packer);
+      }
+    }
+  }
+
+ private:
+  void encode(const ArrayInfo &arrayInfo, const void *object, Pieces &out) {
+    auto packer = out.getPacker();
+    if (arrayInfo.isView) {
+      return to_msgpack(arrayInfo, object, packer);
+    }
+    size_t numChilds = arrayInfo.getNumChilds(object);
+    auto &childInfo = arrayInfo.childInfo;
+    auto *childBegin =
+        static_cast<const char *>(arrayInfo.getChildBegin(object));
+    msgpack_pack_array(&packer, numChilds);
+    if (impl::with_scalar_type(childInfo, [&](auto tag) {
+          using ElemT = typename decltype(tag)::type;
+          auto *data = reinterpret_cast<const ElemT *>(childBegin);
+          for (size_t begin = 0; begin < numChilds; begin += splitThreshold) {
+            size_t count = std::min(splitThreshold, numChilds - begin);
+            auto &piece = out.addChild();
+            group.spawn([&piece, data, begin, count] {
+              auto piecePacker = piece.getPacker();
+              impl::pack_scalar_elems(data + begin, count, piecePacker);
+            });
+          }
+        })) {
+      return;
+    }
+    if (numChilds == 0) {
+      return;
+    }
+    size_t childWeight = estimate_weight(childInfo, childBegin, splitThreshold);
+    for_each_chunk(
+        numChilds, splitThreshold, [&](size_t) { return childWeight; },
+        [&](size_t begin, size_t end) {
+          auto &piece = out.addChild();
+          group.spawn([this, &piece, &childInfo, childBegin, begin, end] {
+            for (size_t idx = begin; idx < end; ++idx) {
+              encode(childInfo, childBegin + idx * childInfo.cppByteSize,
+                     piece);
+            }
+          });
+        });
+  }
+
+  void encode(const ListInfo &listInfo, const void *object, Pieces &out) {
+    size_t numChilds = listInfo.getNumChilds(object);
+    auto packer = out.getPacker();
+    msgpack_pack_array(&packer, numChilds);
+    for_each_chunk(
+        numChilds, splitThreshold,
+        [&](size_t idx) {
+          auto child = listInfo.getChildAt(object, idx);
+          return estimate_weight(*child.type_info, child.ptr, splitThreshold);
+        },
+        [&](size_t begin, size_t end) {
+          auto &piece = out.addChild();
+          group.spawn([this, &piece, &listInfo, object, begin, end] {
+            for (size_t idx = begin; idx < end; ++idx) {
+              auto child = listInfo.getChildAt(object, idx);
+              encode(*child.type_info, child.ptr, piece);
+            }
+          });
+        });
+  }
+
+  void encode(const DictInfo &dictInfo, const void *object, Pieces &out) {
+    auto items = get_dict_items(dictInfo, object, splitThreshold);
+    auto packer = out.getPacker();
+    msgpack_pack_map(&packer, items->size());
+    for_each_chunk(
+        items->size(), splitThreshold,
+        [&](size_t idx) { return 1 + (*items)[idx].weight; },
+        [&](size_t begin, size_t end) {
+          auto &piece = out.addChild();
+          group.spawn([this, &piece, items, begin, end] {
+            for (size_t idx = begin; idx < end; ++idx) {
+              auto &item = (*items)[idx];
+              auto piecePacker = piece.getPacker();
+              msgpack_pack_str_with_body(&piecePacker, item.key.data(),
+                                         item.key.size());
+              encode(*item.value.type_info, item.value.ptr, piece);
+            }
+          });
+        });
+  }
+
+  TaskGroup &group;
+  size_t splitThreshold;
+};
+
+class JsonEncoder {
+ public:
+  JsonEncoder(TaskGroup &group, size_t splitThreshold)
+      : group(group), splitThreshold(splitThreshold) {}
+
+  void encode(const TypeInfo &type_info, const void *object,
+              nlohmann::json &out) {
+    if (estimate_weight(type_info, object, splitThreshold) < splitThreshold) {
+      out = to_json(type_info, object);
+      return;
+    }
+    switch (type_info.kind) {
+      case OK_Array:
+        return encode(static_cast<const ArrayInfo &>(type_info), object, out);
+      case OK_List:
+        return encode(static_cast<const ListInfo &>(type_info), object, out);
+      case OK_Dict:
+        return encode(static_cast<const DictInfo &>(type_info), object, out);
+      default:
+        out = to_json(type_info, object);
+        return;
+    }
+  }
+
+ private:
+  void encode(const ArrayInfo &arrayInfo, const void *object,
+              nlohmann::json &out) {
+    size_t numChilds = arrayInfo.getNumChilds(object);
+    auto &childInfo = arrayInfo.childInfo;
+    auto *childBegin =
+        static_cast<const char *>(arrayInfo.getChildBegin(object));
+    out = nlohmann::json::array_t(numChilds);
+    auto &array = out.get_ref<nlohmann::json::array_t &>();
+    if (impl::with_scalar_type(childInfo, [&](auto tag) {
+          using ElemT = typename decltype(tag)::type;
+          using JsonT = std::conditional_t<std::is_floating_point_v<ElemT>,
+                                           double, int64_t>;
+          auto *data = reinterpret_cast<const ElemT *>(childBegin);
+          for (size_t begin = 0; begin < numChilds; begin += splitThreshold) {
+            size_t end = std::min(begin + splitThreshold, numChilds);
+            group.spawn([&array, data, begin, end] {
+              for (size_t idx = begin; idx < end; ++idx) {
+                array[idx] = static_cast<JsonT>(data[idx]);
+              }
+            });
+          }
+        })) {
+      return;
+    }
+    if (numChilds == 0) {
+      return;
+    }
+    size_t childWeight = estimate_weight(childInfo, childBegin, splitThreshold);
+    for_each_chunk(
+        numChilds, splitThreshold, [&](size_t) { return childWeight; },
+        [&](size_t begin, size_t end) {
+          group.spawn([this, &array, &childInfo, childBegin, begin, end] {
+            for (size_t idx = begin; idx < end; ++idx) {
+              encode(childInfo, childBegin + idx * childInfo.cppByteSize,
+                     array[idx]);
+            }
+          });
+        });
+  }
+
+  void encode(const ListInfo &listInfo, const void *object,
+              nlohmann::json &out) {
+    size_t numChilds = listInfo.getNumChilds(object);
+    out = nlohmann::json::array_t(numChilds);
+    auto &array = out.get_ref<nlohmann::json::array_t &>();
+    for_each_chunk(
+        numChilds, splitThreshold,
+        [&](size_t idx) {
+          auto child = listInfo.getChildAt(object, idx);
+          return estimate_weight(*child.type_info, child.ptr, splitThreshold);
+        },
+        [&](size_t begin, size_t end) {
+          group.spawn([this, &array, &listInfo, object, begin, end] {
+            for (size_t idx = begin; idx < end; ++idx) {
+              auto child = listInfo.getChildAt(object, idx);
+              encode(*child.type_info, child.ptr, array[idx]);
+            }
+          });
+        });
+  }
+
+  void encode(const DictInfo &dictInfo, const void *object,
+              nlohmann::json &out) {
+    auto items = get_dict_items(dictInfo, object, splitThreshold);
+    // Slots are made here, so tasks only write to values. A repeated key
+    // keeps its first value, as json.emplace() does in to_json.
+    out = nlohmann::json::object();
+    auto slots = std::make_shared<std::vector<nlohmann::json *>>();
+    slots->reserve(items->size());
+    for (auto &item : *items) {
+      auto [iter, inserted] = out.emplace(item.key, nullptr);
+      slots->push_back(inserted ? &*iter : nullptr);
+    }
+    for_each_chunk(
+        items->size(), splitThreshold,
+        [&](size_t idx) { return 1 + (*items)[idx].weight; },
+        [&](size_t begin, size_t end) {
+          group.spawn([this, items, slots, begin, end] {
+            for (size_t idx = begin; idx < end; ++idx) {
+              if (auto *slot = (*slots)[idx]) {
+                auto &value = (*items)[idx].value;
+                encode(*value.type_info, value.ptr, *slot);
+              }
+            }
+          });
+        });
+  }
+
+  TaskGroup &group;
+  size_t splitThreshold;
+};
+
+}  // namespace
+
+void to_msgpack_parallel(const TypeInfo &type_info, const void *object,
+                         msgpack_packer &packer, WorkStealingPool &pool,
+                         size_t splitThreshold) {
+  if (estimate_weight(type_info, object, splitThreshold) < splitThreshold) {
+    return to_msgpack(type_info, object, packer);
+  }
+  Pieces out;
+  {
+    TaskGroup group(pool);
+    MsgPackEncoder encoder(group, splitThreshold);
+    encoder.encode(type_info, object, out);
+    group.wait();
+  }
+  out.writeTo(packer);
+}
+
+nlohmann::json to_json_parallel(const TypeInfo &type_info, const void *object,
+                                WorkStealingPool &pool,
+                                size_t splitThreshold) {
+  if (estimate_weight(type_info, object, splitThreshold) < splitThreshold) {
+    return to_json(type_info, object);
+  }
+  nlohmann::json out;
+  TaskGroup group(pool);
+  JsonEncoder encoder(group, splitThreshold);
+  encoder.encode(type_info, object, out);
+  group.wait();
+  return out;
+}
+
+}  // namespace coti
+}  // namespace tops
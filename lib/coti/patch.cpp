@@ -0,0 +1,488 @@
+#include "tops/coti/patch.h"
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include "msgpack.h"
+#include "tops/coti/msgpack_reader.h"
+#include "tops/coti/msgpack_size.h"
+#include "tops/coti/path.h"
+#include "tops/coti/struct_info.h"
+#include "tops/coti/utils.h"
+
+namespace tops {
+namespace coti {
+namespace {
+
+enum PatchOp : uint8_t {
+  kSetOp = 0,
+  kResizeOp = 1,
+  kEraseOp = 2,
+};
+
+bool is_scalar_info(const TypeInfo &type_info) {
+  return type_info.kind == OK_Bool || type_info.kind == OK_Int ||
+         type_info.kind == OK_Float;
+}
+
+int append_to_string(void *data, const char *buf, size_t len) {
+  static_cast<std::string *>(data)->append(buf, len);
+  return 0;
+}
+
+struct DictItem {
+  std::string_view key;
+  TypedPtr value;
+};
+
+std::vector<DictItem> get_sorted_items(const DictInfo &dictInfo,
+                                       const void *object) {
+  std::vector<DictItem> items;
+  items.reserve(dictInfo.getNumItems(object));
+  auto *iter = dictInfo.beginIter(object);
+  while (!dictInfo.isEndIter(object, iter)) {
+    items.push_back({dictInfo.getKeyAtIter(object, iter),
+                     dictInfo.getValueAtIter(object, iter)});
+    iter = dictInfo.nextIter(object, iter);
+  }
+  dictInfo.finishIter(object, iter);
+  std::sort(items.begin(), items.end(),
+            [](const DictItem &lhs, const DictItem &rhs) {
+              return lhs.key < rhs.key;
+            });
+  return items;
+}
+
+// Collects the ops of a patch, then writes them out behind the array header.
+// `path` is the location of the values being compared.
+class Differ {
+ public:
+  Differ()
+      : packer{&ops, append_to_string},
+        headerPacker{&header, append_to_string} {}
+
+  void diff(const TypeInfo &type_info, const void *a, const void *b) {
+    switch (type_info.kind) {
+      case OK_Bool:
+      case OK_Int:
+      case OK_Float:
+        if (std::memcmp(a, b, type_info.cppByteSize) != 0) {
+          addSet(type_info, b);
+        }
+        return;
+      case OK_String: {
+        auto &stringInfo = static_cast<const StringInfo &>(type_info);
+        if (stringInfo.get(a) != stringInfo.get(b)) {
+          addSet(type_info, b);
+        }
+        return;
+      }
+      case OK_Array:
+        return diffContainer(type_info, b, [&] {
+          return diffChilds(static_cast<const ArrayInfo &>(type_info), a, b);
+        });
+      case OK_List:
+        return diffContainer(type_info, b, [&] {
+          return diffChilds(static_cast<const ListInfo &>(type_info), a, b);
+        });
+      case OK_Dict:
+        return diffContainer(type_info, b, [&] {
+          return diffChilds(static_cast<const DictInfo &>(type_info), a, b);
+        });
+    }
+  }
+
+  void writeTo(msgpack_packer &out) {
+    msgpack_pack_array(&out, numOps);
+    out.callback(out.data, ops.data(), ops.size());
+  }
+
+ private:
+  // Runs `diffChilds`, then replaces what it emitted with a single set of
+  // `b` if that is no longer. The set is sized with msgpack_size() and only
+  // encoded if it is used.
+  template <typename DiffChildsFn>
+  void diffContainer(const TypeInfo &type_info, const void *b,
+                     DiffChildsFn &&diffChilds) {
+    size_t oldSize = ops.size();
+    size_t oldNumOps = numOps;
+    if (!diffChilds()) {
+      return;
+    }
+    header.clear();
+    packOpHeader(headerPacker, kSetOp, 3);
+    if (header.size() + msgpack_size(type_info, b) > ops.size() - oldSize) {
+      return;
+    }
+    ops.resize(oldSize);
+    numOps = oldNumOps;
+    addSet(type_info, b);
+  }
+
+  // The diffChilds() overloads return whether anything was emitted.
+  bool diffChilds(const ArrayInfo &arrayInfo, const void *a, const void *b) {
+    size_t oldNumOps = numOps;
+    if (arrayInfo.isView) {
+      size_t numBytes =
+          arrayInfo.getNumChilds(a) * arrayInfo.childInfo.cppByteSize;
+      if (arrayInfo.getNumChilds(a) != arrayInfo.getNumChilds(b) ||
+          (numBytes != 0 &&
+           std::memcmp(arrayInfo.getChildBegin(a), arrayInfo.getChildBegin(b),
+                       numBytes) != 0)) {
+        addSet(arrayInfo, b);
+      }
+      return numOps != oldNumOps;
+    }
+    size_t numA = arrayInfo.getNumChilds(a);
+    size_t numB = arrayInfo.getNumChilds(b);
+    if (numA != numB) {
+      addResize(numB);
+    }
+    auto &childInfo = arrayInfo.childInfo;
+    size_t childSize = childInfo.cppByteSize;
+    auto *childA = static_cast<const char *>(arrayInfo.getChildBegin(a));
+    auto *childB = static_cast<const char *>(arrayInfo.getChildBegin(b));
+    size_t numCommon = std::min(numA, numB);
+    if (is_scalar_info(childInfo) && numCommon != 0 &&
+        std::memcmp(childA, childB, numCommon * childSize) == 0) {
+      numCommon = 0;
+    }
+    for (size_t idx = 0; idx < numCommon; ++idx) {
+      path.index(idx);
+      diff(childInfo, childA + idx * childSize, childB + idx * childSize);
+      path.pop();
+    }
+    for (size_t idx = numA; idx < numB; ++idx) {
+      path.index(idx);
+      addSet(childInfo, childB + idx * childSize);
+      path.pop();
+    }
+    return numOps != oldNumOps;
+  }
+
+  bool diffChilds(const ListInfo &listInfo, const void *a, const void *b) {
+    size_t oldNumOps = numOps;
+    size_t numA = listInfo.getNumChilds(a);
+    size_t numB = listInfo.getNumChilds(b);
+    size_t numCommon = std::min(numA, numB);
+    // A set can only decode into the TypeInfo the list already has there.
+    for (size_t idx = 0; idx < numCommon; ++idx) {
+      if (listInfo.getChildAt(a, idx).type_info !=
+          listInfo.getChildAt(b, idx).type_info) {
+        addSet(listInfo, b);
+        return true;
+      }
+    }
+    if (numA != numB) {
+      addResize(numB);
+    }
+    for (size_t idx = 0; idx < numCommon; ++idx) {
+      auto childA = listInfo.getChildAt(a, idx);
+      auto childB = listInfo.getChildAt(b, idx);
+      path.index(idx);
+      diff(*childA.type_info, childA.ptr, childB.ptr);
+      path.pop();
+    }
+    for (size_t idx = numA; idx < numB; ++idx) {
+      auto childB = listInfo.getChildAt(b, idx);
+      path.index(idx);
+      addSet(*childB.type_info, childB.ptr);
+      path.pop();
+    }
+    return numOps != oldNumOps;
+  }
+
+  bool diffChilds(const DictInfo &dictInfo, const void *a, const void *b) {
+    size_t oldNumOps = numOps;
+    auto itemsA = get_sorted_items(dictInfo, a);
+    auto itemsB = get_sorted_items(dictInfo, b);
+    size_t idxA = 0;
+    size_t idxB = 0;
+    while (idxA < itemsA.size() || idxB < itemsB.size()) {
+      if (idxB == itemsB.size() ||
+          (idxA < itemsA.size() && itemsA[idxA].key < itemsB[idxB].key)) {
+        path.key(itemsA[idxA++].key);
+        addErase();
+        path.pop();
+        continue;
+      }
+      auto &itemB = itemsB[idxB++];
+      path.key(itemB.key);
+      if (idxA == itemsA.size() || itemB.key < itemsA[idxA].key) {
+        addSet(*itemB.value.type_info, itemB.value.ptr);
+      } else {
+        auto &itemA = itemsA[idxA++];
+        if (itemA.value.type_info != itemB.value.type_info) {
+          addSet(*itemB.value.type_info, itemB.value.ptr);
+        } else {
+          diff(*itemB.value.type_info, itemA.value.ptr, itemB.value.ptr);
+        }
+      }
+      path.pop();
+    }
+    return numOps != oldNumOps;
+  }
+
+  // The op up to its last field, for the current path.
+  void packOpHeader(msgpack_packer &out, PatchOp op, uint32_t numFields) {
+    msgpack_pack_array(&out, numFields);
+    msgpack_pack_uint8(&out, op);
+    auto &elems = path.getElems();
+    msgpack_pack_array(&out, elems.size());
+    for (auto &elem : elems) {
+      if (auto *key = std::get_if<std::string>(&elem)) {
+        msgpack_pack_str_with_body(&out, key->data(), key->size());
+      } else {
+        msgpack_pack_uint64(&out, std::get<size_t>(elem));
+      }
+    }
+  }
+
+  void packOp(PatchOp op, uint32_t numFields) {
+    ++numOps;
+    packOpHeader(packer, op, numFields);
+  }
+
+  void addSet(const TypeInfo &type_info, const void *value) {
+    packOp(kSetOp, 3);
+    to_msgpack(type_info, value, packer);
+  }
+
+  void addResize(size_t newNumChilds) {
+    packOp(kResizeOp, 3);
+    msgpack_pack_uint64(&packer, newNumChilds);
+  }
+
+  void addErase() { packOp(kEraseOp, 2); }
+
+  std::string ops;
+  size_t numOps = 0;
+  msgpack_packer packer;
+  // Scratch space to size op headers.
+  std::string header;
+  msgpack_packer headerPacker;
+  Path path;
+};
+
+// from_msgpack() merges into the dicts it decodes into, so containers are
+// emptied before a set replaces them.
+void clear_value(const TypeInfo &type_info, void *object) {
+  switch (type_info.kind) {
+    case OK_Array: {
+      auto &arrayInfo = static_cast<const ArrayInfo &>(type_info);
+      if (!arrayInfo.isView) {
+        arrayInfo.resize(object, 0);
+      }
+      return;
+    }
+    case OK_List:
+      return static_cast<const ListInfo &>(type_info).resize(object, 0);
+    case OK_Dict: {
+      auto &dictInfo = static_cast<const DictInfo &>(type_info);
+      auto items = get_sorted_items(dictInfo, object);
+      if (dictInfo.isStruct) {
+        for (auto &item : items) {
+          clear_value(*item.value.type_info, item.value.ptr);
+        }
+        return;
+      }
+      std::vector<std::string> keys;
+      keys.reserve(items.size());
+      for (auto &item : items) {
+        keys.emplace_back(item.key);
+      }
+      for (auto &key : keys) {
+        dictInfo.eraseValueAt(object, key);
+      }
+      return;
+    }
+    default:
+      return;
+  }
+}
+
+// Finds the item at `key` without inserting it, unlike getValueAt(). Returns
+// {nullptr, nullptr} if there is none.
+TypedPtr find_value(const DictInfo &dictInfo, const void *object,
+                    std::string_view key) {
+  if (dictInfo.isStruct) {
+    auto &structInfo = static_cast<const StructInfo &>(dictInfo);
+    auto idx = structInfo.findField(key);
+    return idx < 0 ? TypedPtr{nullptr, nullptr}
+                   : structInfo.getFieldAt(const_cast<void *>(object), idx);
+  }
+  TypedPtr res{nullptr, nullptr};
+  auto *iter = dictInfo.beginIter(object);
+  while (!dictInfo.isEndIter(object, iter)) {
+    if (dictInfo.getKeyAtIter(object, iter) == key) {
+      res = dictInfo.getValueAtIter(object, iter);
+      break;
+    }
+    iter = dictInfo.nextIter(object, iter);
+  }
+  dictInfo.finishIter(object, iter);
+  return res;
+}
+
+// Steps from `cur` to its child named by the next path element in `reader`.
+// A missing Dict key is inserted if `mayInsert`, and fails otherwise.
+bool step_into(TypedPtr &cur, MsgPackReader &reader, bool mayInsert) {
+  MsgPackToken token;
+  if (!reader.next(token)) {
+    return false;
+  }
+  switch (cur.type_info->kind) {
+    case OK_Dict: {
+      std::string_view key;
+      if (token.kind != MsgPackToken::Str ||
+          !reader.readBytes(token.size, key)) {
+        return false;
+      }
+      auto &dictInfo = static_cast<const DictInfo &>(*cur.type_info);
+      auto value = find_value(dictInfo, cur.ptr, key);
+      if (!value.ptr) {
+        if (!mayInsert || dictInfo.isStruct) {
+          return false;
+        }
+        value = dictInfo.getValueAt(cur.ptr, key);
+      }
+      cur = value;
+      return true;
+    }
+    case OK_Array: {
+      auto &arrayInfo = static_cast<const ArrayInfo &>(*cur.type_info);
+      if (token.kind != MsgPackToken::PosInt || arrayInfo.isView ||
+          token.u64 >= arrayInfo.getNumChilds(cur.ptr)) {
+        return false;
+      }
+      auto *childBegin =
+          static_cast<const char *>(arrayInfo.getChildBegin(cur.ptr));
+      cur = {const_cast<char *>(childBegin) +
+                 token.u64 * arrayInfo.childInfo.cppByteSize,
+             &arrayInfo.childInfo};
+      return true;
+    }
+    case OK_List: {
+      auto &listInfo = static_cast<const ListInfo &>(*cur.type_info);
+      if (token.kind != MsgPackToken::PosInt ||
+          token.u64 >= listInfo.getNumChilds(cur.ptr)) {
+        return false;
+      }
+      cur = listInfo.getChildAt(cur.ptr, token.u64);
+      return true;
+    }
+    default:
+      return false;
+  }
+}
+
+bool apply_op(const TypeInfo &type_info, void *object, MsgPackReader &reader) {
+  MsgPackToken token;
+  if (!reader.next(token) || token.kind != MsgPackToken::Array ||
+      token.size < 2) {
+    return false;
+  }
+  uint32_t numFields = token.size;
+  if (!reader.next(token) || token.kind != MsgPackToken::PosInt) {
+    return false;
+  }
+  uint64_t op = token.u64;
+  if ((op == kEraseOp) != (numFields == 2) || op > kEraseOp) {
+    return false;
+  }
+  if (!reader.next(token) || token.kind != MsgPackToken::Array) {
+    return false;
+  }
+  uint32_t pathSize = token.size;
+  TypedPtr cur{object, &type_info};
+  if (op == kEraseOp) {
+    if (pathSize == 0) {
+      return false;
+    }
+    for (uint32_t idx = 0; idx + 1 < pathSize; ++idx) {
+      if (!step_into(cur, reader, false)) {
+        return false;
+      }
+    }
+    std::string_view key;
+    if (cur.type_info->kind != OK_Dict || !reader.next(token) ||
+        token.kind != MsgPackToken::Str ||
+        !reader.readBytes(token.size, key)) {
+      return false;
+    }
+    auto &dictInfo = static_cast<const DictInfo &>(*cur.type_info);
+    if (dictInfo.isStruct || !find_value(dictInfo, cur.ptr, key).ptr) {
+      return false;
+    }
+    dictInfo.eraseValueAt(cur.ptr, key);
+    return true;
+  }
+  // Only a set may insert, and only the key it sets.
+  for (uint32_t idx = 0; idx < pathSize; ++idx) {
+    if (!step_into(cur, reader, op == kSetOp && idx + 1 == pathSize)) {
+      return false;
+    }
+  }
+  if (op == kSetOp) {
+    clear_value(*cur.type_info, cur.ptr);
+    return from_msgpack(*cur.type_info, cur.ptr, reader);
+  }
+  if (!reader.next(token) || token.kind != MsgPackToken::PosInt) {
+    return false;
+  }
+  // diff() sets every element a resize adds, so it can't add more than there
+  // are bytes left; a larger count is forged and must not be allocated.
+  auto fits = [&](size_t numChilds) {
+    return token.u64 <= numChilds ||
+           token.u64 - numChilds <= reader.getMaxNumValues();
+  };
+  if (cur.type_info->kind == OK_Array) {
+    auto &arrayInfo = static_cast<const ArrayInfo &>(*cur.type_info);
+    if (arrayInfo.isView || !fits(arrayInfo.getNumChilds(cur.ptr))) {
+      return false;
+    }
+    arrayInfo.resize(cur.ptr, token.u64);
+    return true;
+  }
+  if (cur.type_info->kind == OK_List) {
+    auto &listInfo = static_cast<const ListInfo &>(*cur.type_info);
+    if (!fits(listInfo.getNumChilds(cur.ptr))) {
+      return false;
+    }
+    listInfo.resize(cur.ptr, token.u64);
+    return true;
+  }
+  return false;
+}
+
+}  // namespace
+
+void diff(const TypeInfo &type_info, const void *a, const void *b,
+          msgpack_packer &packer) {
+  Differ differ;
+  differ.diff(type_info, a, b);
+  differ.writeTo(packer);
+}
+
+bool apply_patch(const TypeInfo &type_info, void *object,
+                 std::string_view patch) {
+  MsgPackReader reader(patch);
+  MsgPackToken token;
+  if (!reader.next(token) || token.kind != MsgPackToken::Array) {
+    return false;
+  }
+  for (uint32_t idx = 0; idx < token.size; ++idx) {
+    if (!apply_op(type_info, object, reader)) {
+      return false;
+    }
+  }
+  return reader.atEnd();
+}
+
+}  // namespace coti
+}  // namespace tops
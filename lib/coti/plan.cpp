@@ -0,0 +1,567 @@
+#include "tops/coti/plan.h"
+
+#include <cassert>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "msgpack.h"
+#include "scalar_array.h"
+#include "tops/coti/registry.h"
+#include "tops/coti/struct_info.h"
+#include "tops/coti/utils.h"
+
+namespace tops {
+namespace coti {
+
+enum class PlanOpKind : uint8_t {
+  Bool,
+  Int8,
+  Int16,
+  Int32,
+  Int64,
+  UInt8,
+  UInt16,
+  UInt32,
+  UInt64,
+  Float32,
+  Float64,
+  // Half and bfloat, converted by FloatInfo.
+  FloatOther,
+  String,
+  // ArrayInfo with a plain scalar child, run by the scalar_array.h kernels.
+  ScalarArray,
+  // ArrayInfo, the element program is [this + 1, end).
+  Array,
+  // `numFields` fields follow, each a Key op and the ops of its value, up to
+  // the EndStruct at `end`.
+  BeginStruct,
+  Key,
+  EndStruct,
+  // Anything else, run by the generic functions.
+  Generic,
+};
+
+struct PlanOp {
+  PlanOpKind kind;
+  // From the root object or, inside an element program, the element.
+  uint32_t offset = 0;
+  uint32_t end = 0;
+  uint32_t numFields = 0;
+  // BeginStruct: index into fieldOps of the Key op index of its first field.
+  // Key: the msgpack encoded key in keyPool, the name is its tail.
+  uint32_t auxBegin = 0;
+  uint32_t keySize = 0;
+  uint32_t nameSize = 0;
+  const TypeInfo *type_info = nullptr;
+};
+
+class SerializationPlan {
+ public:
+  std::vector<PlanOp> ops;
+  std::vector<uint32_t> fieldOps;
+  std::string keyPool;
+
+  std::string_view getKeyBytes(const PlanOp &op) const {
+    return {keyPool.data() + op.auxBegin, op.keySize};
+  }
+
+  std::string_view getName(const PlanOp &op) const {
+    return {keyPool.data() + op.auxBegin + op.keySize - op.nameSize,
+            op.nameSize};
+  }
+};
+
+namespace {
+
+template <typename T>
+T load(const char *ptr) {
+  T val;
+  std::memcpy(&val, ptr, sizeof(T));
+  return val;
+}
+
+template <typename T>
+void store(char *ptr, T val) {
+  std::memcpy(ptr, &val, sizeof(T));
+}
+
+// The str header msgpack_pack_str() would write, followed by the key.
+void append_msgpack_str(std::string &out, std::string_view str) {
+  auto size = str.size();
+  if (size < 32) {
+    out.push_back(static_cast<char>(0xa0 | size));
+  } else if (size < 256) {
+    out.push_back(static_cast<char>(0xd9));
+    out.push_back(static_cast<char>(size));
+  } else if (size < 65536) {
+    out.push_back(static_cast<char>(0xda));
+    out.push_back(static_cast<char>(size >> 8));
+    out.push_back(static_cast<char>(size));
+  } else {
+    out.push_back(static_cast<char>(0xdb));
+    for (int shift = 24; shift >= 0; shift -= 8) {
+      out.push_back(static_cast<char>(size >> shift));
+    }
+  }
+  out.append(str);
+}
+
+class PlanCompiler {
+ public:
+  explicit PlanCompiler(SerializationPlan &plan) : plan(plan) {}
+
+  void compile(const TypeInfo &type_info, uint32_t offset) {
+    PlanOp op;
+    op.offset = offset;
+    op.type_info = &type_info;
+    switch (type_info.kind) {
+      case OK_Bool:
+        op.kind = PlanOpKind::Bool;
+        break;
+      case OK_Int:
+        op.kind = getIntKind(static_cast<const IntegerInfo &>(type_info));
+        break;
+      case OK_Float:
+        op.kind = getFloatKind(static_cast<const FloatInfo &>(type_info));
+        break;
+      case OK_String:
+        op.kind = PlanOpKind::String;
+        break;
+      case OK_Array:
+        return compileArray(static_cast<const ArrayInfo &>(type_info), op);
+      case OK_Dict: {
+        auto &dictInfo = static_cast<const DictInfo &>(type_info);
+        if (dictInfo.isStruct && !isCompiling(dictInfo)) {
+          return compileStruct(static_cast<const StructInfo &>(dictInfo), op);
+        }
+        op.kind = PlanOpKind::Generic;
+        break;
+      }
+      default:
+        op.kind = PlanOpKind::Generic;
+        break;
+    }
+    plan.ops.push_back(op);
+  }
+
+ private:
+  static PlanOpKind getIntKind(const IntegerInfo &intInfo) {
+    bool isSigned = intInfo.isSigned();
+    switch (intInfo.getBitWidth()) {
+      case 8:
+        return isSigned ? PlanOpKind::Int8 : PlanOpKind::UInt8;
+      case 16:
+        return isSigned ? PlanOpKind::Int16 : PlanOpKind::UInt16;
+      case 32:
+        return isSigned ? PlanOpKind::Int32 : PlanOpKind::UInt32;
+      case 64:
+        return isSigned ? PlanOpKind::Int64 : PlanOpKind::UInt64;
+      default:
+        __builtin_unreachable();
+    }
+  }
+
+  static PlanOpKind getFloatKind(const FloatInfo &floatInfo) {
+    if (floatInfo.getKind() == FloatInfo::IEEE) {
+      if (floatInfo.getBitWidth() == 32) {
+        return PlanOpKind::Float32;
+      }
+      if (floatInfo.getBitWidth() == 64) {
+        return PlanOpKind::Float64;
+      }
+    }
+    return PlanOpKind::FloatOther;
+  }
+
+  void compileArray(const ArrayInfo &arrayInfo, PlanOp op) {
+    if (arrayInfo.isView) {
+      op.kind = PlanOpKind::Generic;
+      plan.ops.push_back(op);
+      return;
+    }
+    if (impl::with_scalar_type(arrayInfo.childInfo, [](auto) {})) {
+      op.kind = PlanOpKind::ScalarArray;
+      plan.ops.push_back(op);
+      return;
+    }
+    op.kind = PlanOpKind::Array;
+    auto idx = plan.ops.size();
+    plan.ops.push_back(op);
+    compile(arrayInfo.childInfo, 0);
+    plan.ops[idx].end = plan.ops.size();
+  }
+
+  void compileStruct(const StructInfo &structInfo, PlanOp op) {
+    auto numFields = structInfo.getNumFields();
+    op.kind = PlanOpKind::BeginStruct;
+    op.numFields = numFields;
+    op.auxBegin = plan.fieldOps.size();
+    plan.fieldOps.resize(plan.fieldOps.size() + numFields);
+    auto idx = plan.ops.size();
+    plan.ops.push_back(op);
+
+    compiling.push_back(&structInfo);
+    for (uint32_t fieldIdx = 0; fieldIdx < numFields; ++fieldIdx) {
+      auto &field = structInfo.getFields()[fieldIdx];
+      PlanOp keyOp;
+      keyOp.kind = PlanOpKind::Key;
+      keyOp.auxBegin = plan.keyPool.size();
+      append_msgpack_str(plan.keyPool, field.name);
+      keyOp.keySize = plan.keyPool.size() - keyOp.auxBegin;
+      keyOp.nameSize = field.name.size();
+      plan.fieldOps[op.auxBegin + fieldIdx] = plan.ops.size();
+      plan.ops.push_back(keyOp);
+      compile(field.getTypeInfo(), op.offset + field.offset);
+    }
+    compiling.pop_back();
+
+    PlanOp endOp;
+    endOp.kind = PlanOpKind::EndStruct;
+    plan.ops[idx].end = plan.ops.size();
+    plan.ops.push_back(endOp);
+  }
+
+  // A struct that (indirectly) contains itself, e.g. through a vector, stays
+  // generic below its first level.
+  bool isCompiling(const DictInfo &dictInfo) const {
+    for (auto *info : compiling) {
+      if (info == &dictInfo) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  SerializationPlan &plan;
+  std::vector<const TypeInfo *> compiling;
+};
+
+void run_msgpack(const SerializationPlan &plan, uint32_t begin, uint32_t end,
+                 const char *base, msgpack_packer &packer) {
+  for (uint32_t idx = begin; idx < end; ++idx) {
+    auto &op = plan.ops[idx];
+    const char *ptr = base + op.offset;
+    switch (op.kind) {
+      case PlanOpKind::Bool:
+        if (load<bool>(ptr)) {
+          msgpack_pack_true(&packer);
+        } else {
+          msgpack_pack_false(&packer);
+        }
+        break;
+      case PlanOpKind::Int8:
+        msgpack_pack_int8(&packer, load<int8_t>(ptr));
+        break;
+      case PlanOpKind::Int16:
+        msgpack_pack_int16(&packer, load<int16_t>(ptr));
+        break;
+      case PlanOpKind::Int32:
+        msgpack_pack_int32(&packer, load<int32_t>(ptr));
+        break;
+      case PlanOpKind::Int64:
+        msgpack_pack_int64(&packer, load<int64_t>(ptr));
+        break;
+      case PlanOpKind::UInt8:
+        msgpack_pack_uint8(&packer, load<uint8_t>(ptr));
+        break;
+      case PlanOpKind::UInt16:
+        msgpack_pack_uint16(&packer, load<uint16_t>(ptr));
+        break;
+      case PlanOpKind::UInt32:
+        msgpack_pack_uint32(&packer, load<uint32_t>(ptr));
+        break;
+      case PlanOpKind::UInt64:
+        msgpack_pack_uint64(&packer, load<uint64_t>(ptr));
+        break;
+      case PlanOpKind::Float32:
+        msgpack_pack_double(&packer, load<float>(ptr));
+        break;
+      case PlanOpKind::Float64:
+        msgpack_pack_double(&packer, load<double>(ptr));
+        break;
+      case PlanOpKind::FloatOther:
+        msgpack_pack_double(
+            &packer, static_cast<const FloatInfo *>(op.type_info)->get(ptr));
+        break;
+      case PlanOpKind::String: {
+        auto val = static_cast<const StringInfo *>(op.type_info)->get(ptr);
+        msgpack_pack_str_with_body(&packer, val.data(), val.size());
+        break;
+      }
+      case PlanOpKind::ScalarArray: {
+        auto &arrayInfo = *static_cast<const ArrayInfo *>(op.type_info);
+        auto numChilds = arrayInfo.getNumChilds(ptr);
+        auto *childBegin = arrayInfo.getChildBegin(ptr);
+        impl::with_scalar_type(arrayInfo.childInfo, [&](auto tag) {
+          using ElemT = typename decltype(tag)::type;
+          impl::pack_scalar_array(static_cast<const ElemT *>(childBegin),
+                                  numChilds, packer);
+        });
+        break;
+      }
+      case PlanOpKind::Array: {
+        auto &arrayInfo = *static_cast<const ArrayInfo *>(op.type_info);
+        auto numChilds = arrayInfo.getNumChilds(ptr);
+        auto *child = static_cast<const char *>(arrayInfo.getChildBegin(ptr));
+        auto childSize = arrayInfo.childInfo.cppByteSize;
+        msgpack_pack_array(&packer, numChilds);
+        for (size_t childIdx = 0; childIdx < numChilds; ++childIdx) {
+          run_msgpack(plan, idx + 1, op.end, child, packer);
+          child += childSize;
+        }
+        idx = op.end - 1;
+        break;
+      }
+      case PlanOpKind::BeginStruct:
+        msgpack_pack_map(&packer, op.numFields);
+        break;
+      case PlanOpKind::Key: {
+        auto keyBytes = plan.getKeyBytes(op);
+        packer.callback(packer.data, keyBytes.data(), keyBytes.size());
+        break;
+      }
+      case PlanOpKind::EndStruct:
+        break;
+      case PlanOpKind::Generic:
+        to_msgpack(*op.type_info, ptr, packer);
+        break;
+    }
+  }
+}
+
+// Runs the ops of the value starting at `idx` and moves `idx` past them.
+nlohmann::json run_json(const SerializationPlan &plan, uint32_t &idx,
+                        const char *base) {
+  auto &op = plan.ops[idx++];
+  const char *ptr = base + op.offset;
+  switch (op.kind) {
+    case PlanOpKind::Bool:
+      return load<bool>(ptr);
+    case PlanOpKind::Int8:
+      return int64_t(load<int8_t>(ptr));
+    case PlanOpKind::Int16:
+      return int64_t(load<int16_t>(ptr));
+    case PlanOpKind::Int32:
+      return int64_t(load<int32_t>(ptr));
+    case PlanOpKind::Int64:
+      return load<int64_t>(ptr);
+    case PlanOpKind::UInt8:
+      return int64_t(load<uint8_t>(ptr));
+    case PlanOpKind::UInt16:
+      return int64_t(load<uint16_t>(ptr));
+    case PlanOpKind::UInt32:
+      return int64_t(load<uint32_t>(ptr));
+    case PlanOpKind::UInt64:
+      return int64_t(load<uint64_t>(ptr));
+    case PlanOpKind::Float32:
+      return double(load<float>(ptr));
+    case PlanOpKind::Float64:
+      return load<double>(ptr);
+    case PlanOpKind::FloatOther:
+      return static_cast<const FloatInfo *>(op.type_info)->get(ptr);
+    case PlanOpKind::String:
+      return static_cast<const StringInfo *>(op.type_info)->get(ptr);
+    case PlanOpKind::ScalarArray: {
+      auto &arrayInfo = *static_cast<const ArrayInfo *>(op.type_info);
+      auto numChilds = arrayInfo.getNumChilds(ptr);
+      auto *childBegin = arrayInfo.getChildBegin(ptr);
+      nlohmann::json json;
+      impl::with_scalar_type(arrayInfo.childInfo, [&](auto tag) {
+        using ElemT = typename decltype(tag)::type;
+        json = impl::scalar_array_to_json(
+            static_cast<const ElemT *>(childBegin), numChilds);
+      });
+      return json;
+    }
+    case PlanOpKind::Array: {
+      auto &arrayInfo = *static_cast<const ArrayInfo *>(op.type_info);
+      auto numChilds = arrayInfo.getNumChilds(ptr);
+      auto *child = static_cast<const char *>(arrayInfo.getChildBegin(ptr));
+      auto childSize = arrayInfo.childInfo.cppByteSize;
+      nlohmann::json::array_t array;
+      array.reserve(numChilds);
+      for (size_t childIdx = 0; childIdx < numChilds; ++childIdx) {
+        uint32_t childOp = idx;
+        array.push_back(run_json(plan, childOp, child));
+        child += childSize;
+      }
+      idx = op.end;
+      return array;
+    }
+    case PlanOpKind::BeginStruct: {
+      nlohmann::json json(nlohmann::json::value_t::object);
+      for (uint32_t fieldIdx = 0; fieldIdx < op.numFields; ++fieldIdx) {
+        auto name = plan.getName(plan.ops[idx++]);
+        json.emplace(name, run_json(plan, idx, base));
+      }
+      assert(plan.ops[idx].kind == PlanOpKind::EndStruct);
+      ++idx;
+      return json;
+    }
+    case PlanOpKind::Key:
+    case PlanOpKind::EndStruct:
+      assert(false && "not the start of a value");
+      __builtin_unreachable();
+    case PlanOpKind::Generic:
+      return to_json(*op.type_info, ptr);
+  }
+  __builtin_unreachable();
+}
+
+void run_from_msgpack(const SerializationPlan &plan, uint32_t idx, char *base,
+                      const msgpack_object &msg_obj) {
+  auto &op = plan.ops[idx];
+  char *ptr = base + op.offset;
+  switch (op.kind) {
+    case PlanOpKind::Bool:
+      assert(msg_obj.type == MSGPACK_OBJECT_BOOLEAN);
+      return store(ptr, msg_obj.via.boolean);
+    case PlanOpKind::Int8:
+    case PlanOpKind::UInt8:
+      assert(msg_obj.type == MSGPACK_OBJECT_POSITIVE_INTEGER ||
+             msg_obj.type == MSGPACK_OBJECT_NEGATIVE_INTEGER);
+      return store(ptr, uint8_t(msg_obj.via.i64));
+    case PlanOpKind::Int16:
+    case PlanOpKind::UInt16:
+      assert(msg_obj.type == MSGPACK_OBJECT_POSITIVE_INTEGER ||
+             msg_obj.type == MSGPACK_OBJECT_NEGATIVE_INTEGER);
+      return store(ptr, uint16_t(msg_obj.via.i64));
+    case PlanOpKind::Int32:
+    case PlanOpKind::UInt32:
+      assert(msg_obj.type == MSGPACK_OBJECT_POSITIVE_INTEGER ||
+             msg_obj.type == MSGPACK_OBJECT_NEGATIVE_INTEGER);
+      return store(ptr, uint32_t(msg_obj.via.i64));
+    case PlanOpKind::Int64:
+    case PlanOpKind::UInt64:
+      assert(msg_obj.type == MSGPACK_OBJECT_POSITIVE_INTEGER ||
+             msg_obj.type == MSGPACK_OBJECT_NEGATIVE_INTEGER);
+      return store(ptr, msg_obj.via.i64);
+    case PlanOpKind::Float32:
+      assert(msg_obj.type == MSGPACK_OBJECT_FLOAT32 ||
+             msg_obj.type == MSGPACK_OBJECT_FLOAT64);
+      return store(ptr, float(msg_obj.via.f64));
+    case PlanOpKind::Float64:
+      assert(msg_obj.type == MSGPACK_OBJECT_FLOAT32 ||
+             msg_obj.type == MSGPACK_OBJECT_FLOAT64);
+      return store(ptr, msg_obj.via.f64);
+    case PlanOpKind::FloatOther:
+      assert(msg_obj.type == MSGPACK_OBJECT_FLOAT32 ||
+             msg_obj.type == MSGPACK_OBJECT_FLOAT64);
+      return static_cast<const FloatInfo *>(op.type_info)
+          ->set(ptr, msg_obj.via.f64);
+    case PlanOpKind::String: {
+      assert(msg_obj.type == MSGPACK_OBJECT_STR);
+      auto str = msg_obj.via.str;
+      return static_cast<const StringInfo *>(op.type_info)
+          ->set(ptr, std::string_view(str.ptr, str.size));
+    }
+    case PlanOpKind::ScalarArray: {
+      assert(msg_obj.type == MSGPACK_OBJECT_ARRAY);
+      auto &arrayInfo = *static_cast<const ArrayInfo *>(op.type_info);
+      auto array = msg_obj.via.array;
+      arrayInfo.resize(ptr, array.size);
+      auto *childBegin = arrayInfo.getChildBegin(static_cast<void *>(ptr));
+      impl::with_scalar_type(arrayInfo.childInfo, [&](auto tag) {
+        using ElemT = typename decltype(tag)::type;
+        impl::unpack_scalar_array(array.ptr, array.size,
+                                  static_cast<ElemT *>(childBegin));
+      });
+      return;
+    }
+    case PlanOpKind::Array: {
+      assert(msg_obj.type == MSGPACK_OBJECT_ARRAY);
+      auto &arrayInfo = *static_cast<const ArrayInfo *>(op.type_info);
+      auto array = msg_obj.via.array;
+      arrayInfo.resize(ptr, array.size);
+      auto *child = static_cast<char *>(
+          arrayInfo.getChildBegin(static_cast<void *>(ptr)));
+      auto childSize = arrayInfo.childInfo.cppByteSize;
+      for (size_t childIdx = 0; childIdx < array.size; ++childIdx) {
+        run_from_msgpack(plan, idx + 1, child, array.ptr[childIdx]);
+        child += childSize;
+      }
+      return;
+    }
+    case PlanOpKind::BeginStruct: {
+      assert(msg_obj.type == MSGPACK_OBJECT_MAP);
+      auto &structInfo = *static_cast<const StructInfo *>(op.type_info);
+      auto *fieldOps = plan.fieldOps.data() + op.auxBegin;
+      auto map = msg_obj.via.map;
+      SeenFields seen(op.numFields);
+      uint32_t expected = 0;
+      for (uint32_t itemIdx = 0; itemIdx < map.size; ++itemIdx) {
+        auto &keyVal = map.ptr[itemIdx];
+        assert(keyVal.key.type == MSGPACK_OBJECT_STR);
+        std::string_view key(keyVal.key.via.str.ptr, keyVal.key.via.str.size);
+        int32_t fieldIdx;
+        if (expected < op.numFields &&
+            plan.getName(plan.ops[fieldOps[expected]]) == key) {
+          fieldIdx = expected;
+        } else {
+          fieldIdx = structInfo.findField(key);
+          // A key of a newer schema.
+          if (fieldIdx < 0) {
+            continue;
+          }
+        }
+        seen.set(fieldIdx);
+        expected = fieldIdx + 1;
+        run_from_msgpack(plan, fieldOps[fieldIdx] + 1, base, keyVal.val);
+      }
+      if (structInfo.getHasDefaults()) {
+        structInfo.fillMissing(ptr, seen);
+      }
+      return;
+    }
+    case PlanOpKind::Key:
+    case PlanOpKind::EndStruct:
+      assert(false && "not the start of a value");
+      __builtin_unreachable();
+    case PlanOpKind::Generic:
+      return from_msgpack(*op.type_info, ptr, msg_obj);
+  }
+}
+
+}  // namespace
+
+const SerializationPlan &get_plan(const TypeInfo &type_info) {
+  // One plan per TypeInfo, cached on its registry entry. Not per schema: the
+  // plan calls the TypeInfo's own resize, getChildBegin and fillMissing,
+  // which the fingerprint doesn't cover.
+  auto &entry = intern_type_info(type_info);
+  if (auto *plan = entry.plan.load(std::memory_order_acquire)) {
+    return *plan;
+  }
+  // Compiled without a lock, a racing thread's plan is simply dropped.
+  auto plan = std::make_unique<SerializationPlan>();
+  PlanCompiler(*plan).compile(*entry.type_info, 0);
+  const SerializationPlan *expected = nullptr;
+  if (entry.plan.compare_exchange_strong(expected, plan.get(),
+                                         std::memory_order_acq_rel)) {
+    // Lives as long as the registry.
+    return *plan.release();
+  }
+  return *expected;
+}
+
+void to_msgpack(const SerializationPlan &plan, const void *object,
+                msgpack_packer &packer) {
+  run_msgpack(plan, 0, plan.ops.size(), static_cast<const char *>(object),
+              packer);
+}
+
+nlohmann::json to_json(const SerializationPlan &plan, const void *object) {
+  uint32_t idx = 0;
+  return run_json(plan, idx, static_cast<const char *>(object));
+}
+
+void from_msgpack(const SerializationPlan &plan, void *object,
+                  const msgpack_object &msg_obj) {
+  run_from_msgpack(plan, 0, static_cast<char *>(object), msg_obj);
+}
+
+}  // namespace coti
+}  // namespace tops
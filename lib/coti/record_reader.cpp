@@ -0,0 +1,216 @@
+#include "tops/coti/record_reader.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cassert>
+#include <cerrno>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "tops/coti/msgpack_reader.h"
+
+namespace tops {
+namespace coti {
+namespace {
+
+template <typename T>
+class BoundedQueue {
+ public:
+  explicit BoundedQueue(size_t capacity) : capacity(capacity) {}
+
+  // Blocks while full. Returns false if the queue is closed.
+  bool push(T val) {
+    std::unique_lock<std::mutex> lock(mutex);
+    notFull.wait(lock, [&] { return closed || items.size() < capacity; });
+    if (closed) {
+      return false;
+    }
+    items.push_back(std::move(val));
+    notEmpty.notify_one();
+    return true;
+  }
+
+  // Blocks while empty. Returns false once the queue is closed and drained.
+  bool pop(T &val) {
+    std::unique_lock<std::mutex> lock(mutex);
+    notEmpty.wait(lock, [&] { return closed || !items.empty(); });
+    if (items.empty()) {
+      return false;
+    }
+    val = std::move(items.front());
+    items.pop_front();
+    notFull.notify_one();
+    return true;
+  }
+
+  // Fails the pushes from now on; pops get what is left first.
+  void close() {
+    std::lock_guard<std::mutex> lock(mutex);
+    closed = true;
+    notFull.notify_all();
+    notEmpty.notify_all();
+  }
+
+ private:
+  std::mutex mutex;
+  std::condition_variable notFull;
+  std::condition_variable notEmpty;
+  std::deque<T> items;
+  size_t capacity;
+  bool closed = false;
+};
+
+struct Chunk {
+  char *data;
+  size_t size;
+};
+
+}  // namespace
+
+namespace impl {
+
+// The I/O thread fills free chunk buffers and queues them; the decoder
+// thread decodes them in place with a MsgPackReader, returns them to the free
+// list and queues the decoded objects for next().
+class RecordPipeline {
+ public:
+  RecordPipeline(const TypeInfo &type_info,
+                 MsgPackRecordStream::ObjectOps ops, int fd,
+                 const RecordReaderOptions &options)
+      : type_info(type_info),
+        ops(ops),
+        fd(fd),
+        chunkSize(options.chunkSize),
+        freeChunks(options.numChunks),
+        fullChunks(options.numChunks),
+        records(options.maxQueuedRecords) {
+    assert(chunkSize != 0 && options.numChunks != 0);
+    for (size_t idx = 0; idx < options.numChunks; ++idx) {
+      buffers.emplace_back(new char[chunkSize]);
+      freeChunks.push(buffers.back().get());
+    }
+    ioThread = std::thread([this] { ioLoop(); });
+    decodeThread = std::thread([this] { decodeLoop(); });
+  }
+
+  ~RecordPipeline() {
+    records.close();
+    fullChunks.close();
+    freeChunks.close();
+    ioThread.join();
+    decodeThread.join();
+    void *object;
+    while (records.pop(object)) {
+      ops.destroy(object);
+    }
+    close(fd);
+  }
+
+  void *next() {
+    void *object;
+    return records.pop(object) ? object : nullptr;
+  }
+
+  bool isOk() const { return !failed.load(std::memory_order_acquire); }
+
+ private:
+  void ioLoop() {
+    char *data;
+    while (freeChunks.pop(data)) {
+      size_t size = 0;
+      while (size < chunkSize) {
+        auto res = read(fd, data + size, chunkSize - size);
+        if (res < 0 && errno == EINTR) {
+          continue;
+        }
+        if (res < 0) {
+          failed.store(true, std::memory_order_release);
+          break;
+        }
+        if (res == 0) {
+          break;
+        }
+        size += res;
+      }
+      // A short chunk marks the end of the file.
+      if (!fullChunks.push({data, size}) || size < chunkSize) {
+        break;
+      }
+    }
+    fullChunks.close();
+  }
+
+  void decodeLoop() {
+    Chunk chunk{nullptr, 0};
+    // The reader is done with a chunk once it asks for the next one.
+    MsgPackReader reader([&]() -> std::string_view {
+      if (chunk.data) {
+        freeChunks.push(chunk.data);
+        chunk.data = nullptr;
+      }
+      if (!fullChunks.pop(chunk)) {
+        chunk = {nullptr, 0};
+        return {};
+      }
+      return {chunk.data, chunk.size};
+    });
+    while (!reader.atEnd()) {
+      void *object = ops.create();
+      if (!from_msgpack(type_info, object, reader)) {
+        ops.destroy(object);
+        failed.store(true, std::memory_order_release);
+        break;
+      }
+      if (!records.push(object)) {
+        ops.destroy(object);
+        break;
+      }
+    }
+    records.close();
+  }
+
+  const TypeInfo &type_info;
+  MsgPackRecordStream::ObjectOps ops;
+  int fd;
+  size_t chunkSize;
+  std::vector<std::unique_ptr<char[]>> buffers;
+  BoundedQueue<char *> freeChunks;
+  BoundedQueue<Chunk> fullChunks;
+  BoundedQueue<void *> records;
+  std::atomic<bool> failed{false};
+  std::thread ioThread;
+  std::thread decodeThread;
+};
+
+}  // namespace impl
+
+std::unique_ptr<MsgPackRecordStream> MsgPackRecordStream::open(
+    const TypeInfo &type_info, ObjectOps ops, const std::string &path,
+    const RecordReaderOptions &options) {
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return nullptr;
+  }
+  posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+  return std::unique_ptr<MsgPackRecordStream>(new MsgPackRecordStream(
+      std::make_unique<impl::RecordPipeline>(type_info, ops, fd, options)));
+}
+
+MsgPackRecordStream::MsgPackRecordStream(
+    std::unique_ptr<impl::RecordPipeline> pipeline)
+    : pipeline(std::move(pipeline)) {}
+
+MsgPackRecordStream::~MsgPackRecordStream() = default;
+
+void *MsgPackRecordStream::next() { return pipeline->next(); }
+
+bool MsgPackRecordStream::isOk() const { return pipeline->isOk(); }
+
+}  // namespace coti
+}  // namespace tops
@@ -0,0 +1,121 @@
+#include "tops/coti/registry.h"
+
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "fingerprint.h"
+
+namespace tops {
+namespace coti {
+namespace {
+
+// Open addressing on the TypeInfo address. Readers probe the current table
+// without locking; writers fill a slot only after its entry is complete, and
+// replace a full table by a larger copy. Tables and entries are never freed,
+// so a reader may keep using whatever it loaded.
+class Registry {
+ public:
+  Registry() { table.store(newTable(64), std::memory_order_release); }
+
+  const TypeEntry *find(const TypeInfo &type_info) const {
+    return find(*table.load(std::memory_order_acquire), &type_info);
+  }
+
+  const TypeEntry &insert(const TypeInfo &type_info, uint64_t fingerprint) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto *cur = table.load(std::memory_order_relaxed);
+    if (auto *entry = find(*cur, &type_info)) {
+      return *entry;
+    }
+    auto &entry = entries.emplace_back();
+    entry.type_info = &type_info;
+    entry.fingerprint = fingerprint;
+    auto &canonical = canonicals[fingerprint];
+    if (!canonical) {
+      canonical = &entry;
+    }
+    entry.canonical = canonical;
+    // At most half full.
+    if (entries.size() * 2 > cur->numSlots) {
+      cur = newTable(cur->numSlots * 2);
+      for (auto &old : entries) {
+        place(*cur, &old);
+      }
+      table.store(cur, std::memory_order_release);
+    } else {
+      place(*cur, &entry);
+    }
+    return entry;
+  }
+
+ private:
+  struct Table {
+    size_t numSlots;
+    std::unique_ptr<std::atomic<const TypeEntry *>[]> slots;
+  };
+
+  static size_t hashPtr(const TypeInfo *type_info) {
+    return (reinterpret_cast<uintptr_t>(type_info) >> 3) *
+           0x9e3779b97f4a7c15ull >> 16;
+  }
+
+  static const TypeEntry *find(const Table &table, const TypeInfo *type_info) {
+    auto mask = table.numSlots - 1;
+    for (auto idx = hashPtr(type_info) & mask;; idx = (idx + 1) & mask) {
+      auto *entry = table.slots[idx].load(std::memory_order_acquire);
+      if (!entry || entry->type_info == type_info) {
+        return entry;
+      }
+    }
+  }
+
+  static void place(Table &table, const TypeEntry *entry) {
+    auto mask = table.numSlots - 1;
+    auto idx = hashPtr(entry->type_info) & mask;
+    while (table.slots[idx].load(std::memory_order_relaxed)) {
+      idx = (idx + 1) & mask;
+    }
+    table.slots[idx].store(entry, std::memory_order_release);
+  }
+
+  Table *newTable(size_t numSlots) {
+    auto &res = tables.emplace_back(std::make_unique<Table>());
+    res->numSlots = numSlots;
+    res->slots.reset(new std::atomic<const TypeEntry *>[numSlots]);
+    for (size_t idx = 0; idx < numSlots; ++idx) {
+      res->slots[idx].store(nullptr, std::memory_order_relaxed);
+    }
+    return res.get();
+  }
+
+  std::atomic<Table *> table;
+  // Guards everything below, and writes to `table` and its slots.
+  std::mutex mutex;
+  // A deque, so entries stay put.
+  std::deque<TypeEntry> entries;
+  std::unordered_map<uint64_t, const TypeEntry *> canonicals;
+  std::vector<std::unique_ptr<Table>> tables;
+};
+
+Registry &get_registry() {
+  // Leaked, lookups may come from static destructors.
+  static auto *registry = new Registry();
+  return *registry;
+}
+
+}  // namespace
+
+const TypeEntry &intern_type_info(const TypeInfo &type_info) {
+  auto &registry = get_registry();
+  if (auto *entry = registry.find(type_info)) {
+    return *entry;
+  }
+  // Computed outside the lock, it may walk a large schema.
+  return registry.insert(type_info, impl::Fingerprinter(true).run(type_info));
+}
+
+}  // namespace coti
+}  // namespace tops
@@ -0,0 +1,216 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <type_traits>
+
+#include "msgpack.h"
+#include "nlohmann/json.hpp"
+#include "tops/coti/type_info.h"
+
+/// Kernels for arrays whose child is a plain IntegerInfo or IEEE FloatInfo, so
+/// the elements are a contiguous C array of int8_t..int64_t/uint8_t..uint64_t,
+/// float or double. They replace the per-element get()/set() and bit width
+/// switching of the generic TypeInfo walk.
+
+namespace tops {
+namespace coti {
+namespace impl {
+
+template <typename T>
+struct ScalarTag {
+  using type = T;
+};
+
+// Calls `fn(ScalarTag<T>{})` with the cpp type of `childInfo` if it has one.
+// Returns false without calling `fn` otherwise.
+template <typename Fn>
+bool with_scalar_type(const TypeInfo &childInfo, Fn &&fn) {
+  if (childInfo.kind == OK_Int) {
+    auto &intInfo = static_cast<const IntegerInfo &>(childInfo);
+    bool isSigned = intInfo.isSigned();
+    switch (intInfo.getBitWidth()) {
+      case 8:
+        return isSigned ? (fn(ScalarTag<int8_t>{}), true)
+                        : (fn(ScalarTag<uint8_t>{}), true);
+      case 16:
+        return isSigned ? (fn(ScalarTag<int16_t>{}), true)
+                        : (fn(ScalarTag<uint16_t>{}), true);
+      case 32:
+        return isSigned ? (fn(ScalarTag<int32_t>{}), true)
+                        : (fn(ScalarTag<uint32_t>{}), true);
+      case 64:
+        return isSigned ? (fn(ScalarTag<int64_t>{}), true)
+                        : (fn(ScalarTag<uint64_t>{}), true);
+      default:
+        return false;
+    }
+  }
+  if (childInfo.kind == OK_Float) {
+    auto &floatInfo = static_cast<const FloatInfo &>(childInfo);
+    if (floatInfo.getKind() != FloatInfo::IEEE) {
+      return false;
+    }
+    switch (floatInfo.getBitWidth()) {
+      case 32:
+        return fn(ScalarTag<float>{}), true;
+      case 64:
+        return fn(ScalarTag<double>{}), true;
+      default:
+        return false;
+    }
+  }
+  return false;
+}
+
+template <typename T>
+auto bswap(T val) {
+  if constexpr (sizeof(T) == 1) {
+    return static_cast<uint8_t>(val);
+  }
+  if constexpr (sizeof(T) == 2) {
+    return __builtin_bswap16(static_cast<uint16_t>(val));
+  }
+  if constexpr (sizeof(T) == 4) {
+    return __builtin_bswap32(static_cast<uint32_t>(val));
+  }
+  if constexpr (sizeof(T) == 8) {
+    return __builtin_bswap64(static_cast<uint64_t>(val));
+  }
+}
+
+// The msgpack format byte for fixed-width T. Floats are always packed as
+// float 64, the same as msgpack_pack_double() in ToMsgPack<FloatInfo>.
+template <typename T>
+constexpr uint8_t msgpack_fixed_marker() {
+  constexpr uint8_t log2Size = __builtin_ctz(sizeof(T));
+  if constexpr (std::is_floating_point_v<T>) {
+    return 0xcb;
+  } else if constexpr (std::is_signed_v<T>) {
+    return 0xd0 + log2Size;
+  } else {
+    return 0xcc + log2Size;
+  }
+}
+
+// Packs elements as fixed-width msgpack ints/float 64, without the array
+// header. The elements are byte-swapped as a batch (which compilers
+// vectorize), then interleaved with the format byte into a stack buffer that
+// is written with one callback.
+template <typename T>
+void pack_scalar_elems(const T *data, size_t numChilds,
+                       msgpack_packer &packer) {
+  using WireT = std::conditional_t<std::is_floating_point_v<T>, double, T>;
+  using BitsT = decltype(bswap(WireT()));
+  constexpr size_t kRecordSize = 1 + sizeof(WireT);
+  constexpr size_t kBatch = 512;
+  constexpr uint8_t kMarker = msgpack_fixed_marker<T>();
+
+  BitsT swapped[kBatch];
+  char out[kBatch * kRecordSize];
+  for (size_t begin = 0; begin < numChilds; begin += kBatch) {
+    size_t count = std::min(kBatch, numChilds - begin);
+    for (size_t idx = 0; idx < count; ++idx) {
+      BitsT bits;
+      WireT val = static_cast<WireT>(data[begin + idx]);
+      std::memcpy(&bits, &val, sizeof(bits));
+      swapped[idx] = bswap(bits);
+    }
+    char *ptr = out;
+    for (size_t idx = 0; idx < count; ++idx) {
+      *ptr = static_cast<char>(kMarker);
+      std::memcpy(ptr + 1, &swapped[idx], sizeof(BitsT));
+      ptr += kRecordSize;
+    }
+    packer.callback(packer.data, out, count * kRecordSize);
+  }
+}
+
+template <typename T>
+void pack_scalar_array(const T *data, size_t numChilds,
+                       msgpack_packer &packer) {
+  msgpack_pack_array(&packer, numChilds);
+  pack_scalar_elems(data, numChilds, packer);
+}
+
+// Decodes an already sized C array from msgpack objects. Type and range
+// errors are folded into one check after the loop.
+template <typename T>
+void unpack_scalar_array(const msgpack_object *objs, size_t numChilds,
+                         T *data) {
+  if constexpr (std::is_floating_point_v<T>) {
+    bool allFloat = true;
+    for (size_t idx = 0; idx < numChilds; ++idx) {
+      allFloat &= objs[idx].type == MSGPACK_OBJECT_FLOAT32 ||
+                  objs[idx].type == MSGPACK_OBJECT_FLOAT64;
+      data[idx] = static_cast<T>(objs[idx].via.f64);
+    }
+    assert(allFloat);
+    (void)allFloat;
+  } else {
+    bool allInt = true;
+    int64_t minVal = 0;
+    int64_t maxVal = 0;
+    for (size_t idx = 0; idx < numChilds; ++idx) {
+      allInt &= objs[idx].type == MSGPACK_OBJECT_POSITIVE_INTEGER ||
+                objs[idx].type == MSGPACK_OBJECT_NEGATIVE_INTEGER;
+      int64_t val = objs[idx].via.i64;
+      minVal = std::min(minVal, val);
+      maxVal = std::max(maxVal, val);
+      data[idx] = static_cast<T>(val);
+    }
+    if constexpr (sizeof(T) < sizeof(int64_t)) {
+      assert(minVal >= int64_t(std::numeric_limits<T>::min()) &&
+             maxVal <= int64_t(std::numeric_limits<T>::max()));
+    }
+    assert(allInt);
+    (void)allInt;
+    (void)minVal;
+    (void)maxVal;
+  }
+}
+
+// Json values are produced exactly as ToJson<IntegerInfo/FloatInfo> does,
+// int64_t for integers and double for floats.
+template <typename T>
+nlohmann::json scalar_array_to_json(const T *data, size_t numChilds) {
+  using JsonT = std::conditional_t<std::is_floating_point_v<T>, double,
+                                   int64_t>;
+  nlohmann::json::array_t array;
+  array.reserve(numChilds);
+  for (size_t idx = 0; idx < numChilds; ++idx) {
+    array.emplace_back(static_cast<JsonT>(data[idx]));
+  }
+  return nlohmann::json(std::move(array));
+}
+
+template <typename T>
+void scalar_array_from_json(const nlohmann::json::array_t &array, T *data) {
+  if constexpr (std::is_floating_point_v<T>) {
+    for (size_t idx = 0, numChilds = array.size(); idx < numChilds; ++idx) {
+      data[idx] = static_cast<T>(array[idx].get<double>());
+    }
+  } else {
+    int64_t minVal = 0;
+    int64_t maxVal = 0;
+    for (size_t idx = 0, numChilds = array.size(); idx < numChilds; ++idx) {
+      auto val = array[idx].get<int64_t>();
+      minVal = std::min(minVal, val);
+      maxVal = std::max(maxVal, val);
+      data[idx] = static_cast<T>(val);
+    }
+    if constexpr (sizeof(T) < sizeof(int64_t)) {
+      assert(minVal >= int64_t(std::numeric_limits<T>::min()) &&
+             maxVal <= int64_t(std::numeric_limits<T>::max()));
+    }
+    (void)minVal;
+    (void)maxVal;
+  }
+}
+
+}  // namespace impl
+}  // namespace coti
+}  // namespace tops
@@ -0,0 +1,219 @@
+#include "tops/coti/sink.h"
+
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace tops {
+namespace coti {
+namespace impl {
+
+// Owns the file and the buffers. The sink exchanges a full buffer for a free
+// one; the writer thread takes all queued buffers at once and writes them
+// with writev().
+class FileWriter {
+ public:
+  FileWriter(int fd, const FileSinkOptions &options)
+      : fd(fd), bufferSize(options.bufferSize) {
+    assert(options.bufferSize != 0 && options.numBuffers >= 2);
+    for (size_t idx = 0; idx < options.numBuffers; ++idx) {
+      buffers.emplace_back(new char[bufferSize]);
+      freeBuffers.push_back(buffers.back().get());
+    }
+    thread = std::thread([this] { run(); });
+  }
+
+  // Writes what is still queued, then closes the file.
+  ~FileWriter() { finish(); }
+
+  size_t getBufferSize() const { return bufferSize; }
+
+  // Queues the first `size` bytes of `full`, if not null, and returns a free
+  // buffer, waiting for the writer thread to release one if there is none.
+  char *exchange(char *full, size_t size) {
+    std::unique_lock<std::mutex> lock(mutex);
+    if (full) {
+      pending.push_back({full, size});
+      wake.notify_one();
+    }
+    done.wait(lock, [&] { return !freeBuffers.empty(); });
+    auto *res = freeBuffers.back();
+    freeBuffers.pop_back();
+    return res;
+  }
+
+  // Waits until the queued buffers are written.
+  void wait() {
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [&] { return pending.empty() && !writing; });
+  }
+
+  bool finish() {
+    if (thread.joinable()) {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+        wake.notify_one();
+      }
+      thread.join();
+      if (::close(fd) != 0) {
+        failed.store(true, std::memory_order_release);
+      }
+    }
+    return isOk();
+  }
+
+  bool isOk() const { return !failed.load(std::memory_order_acquire); }
+
+ private:
+  void run() {
+    std::vector<char *> batch;
+    std::vector<iovec> iovs;
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+      wake.wait(lock, [&] { return stopping || !pending.empty(); });
+      if (pending.empty()) {
+        break;
+      }
+      auto numBufs = std::min<size_t>(pending.size(), IOV_MAX);
+      batch.clear();
+      iovs.clear();
+      for (size_t idx = 0; idx < numBufs; ++idx) {
+        batch.push_back(pending[idx].data);
+        iovs.push_back({pending[idx].data, pending[idx].size});
+      }
+      pending.erase(pending.begin(), pending.begin() + numBufs);
+      writing = true;
+      lock.unlock();
+      if (isOk() && !writeAll(iovs)) {
+        failed.store(true, std::memory_order_release);
+      }
+      lock.lock();
+      freeBuffers.insert(freeBuffers.end(), batch.begin(), batch.end());
+      writing = false;
+      done.notify_all();
+    }
+  }
+
+  // Advances `iovs` past partial writes.
+  bool writeAll(std::vector<iovec> &iovs) {
+    size_t idx = 0;
+    while (idx < iovs.size()) {
+      auto res = ::writev(fd, iovs.data() + idx, int(iovs.size() - idx));
+      if (res < 0 && errno == EINTR) {
+        continue;
+      }
+      if (res < 0) {
+        return false;
+      }
+      // Skip what was written, possibly ending inside a buffer.
+      auto written = size_t(res);
+      while (idx < iovs.size() && written >= iovs[idx].iov_len) {
+        written -= iovs[idx].iov_len;
+        ++idx;
+      }
+      if (idx < iovs.size()) {
+        iovs[idx].iov_base = static_cast<char *>(iovs[idx].iov_base) + written;
+        iovs[idx].iov_len -= written;
+      }
+    }
+    return true;
+  }
+
+  struct Pending {
+    char *data;
+    size_t size;
+  };
+
+  int fd;
+  size_t bufferSize;
+  std::vector<std::unique_ptr<char[]>> buffers;
+  std::atomic<bool> failed{false};
+
+  std::mutex mutex;
+  // Signals the writer thread that buffers are queued or it should stop.
+  std::condition_variable wake;
+  // Signals the sink that buffers were released.
+  std::condition_variable done;
+  std::vector<char *> freeBuffers;
+  std::deque<Pending> pending;
+  bool writing = false;
+  bool stopping = false;
+  std::thread thread;
+};
+
+}  // namespace impl
+
+std::unique_ptr<FileSink> FileSink::open(const std::string &path,
+                                         const FileSinkOptions &options) {
+  int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    return nullptr;
+  }
+  return std::unique_ptr<FileSink>(
+      new FileSink(std::make_unique<impl::FileWriter>(fd, options)));
+}
+
+FileSink::FileSink(std::unique_ptr<impl::FileWriter> writer)
+    : writer(std::move(writer)) {
+  buf = this->writer->exchange(nullptr, 0);
+  bufSize = this->writer->getBufferSize();
+}
+
+FileSink::~FileSink() { close(); }
+
+void FileSink::write(const char *data, size_t size) {
+  assert(writer);
+  while (size != 0) {
+    auto len = std::min(size, bufSize - bufPos);
+    std::memcpy(buf + bufPos, data, len);
+    bufPos += len;
+    data += len;
+    size -= len;
+    if (bufPos == bufSize) {
+      buf = writer->exchange(buf, bufPos);
+      bufPos = 0;
+    }
+  }
+}
+
+bool FileSink::flush() {
+  assert(writer);
+  if (bufPos != 0) {
+    buf = writer->exchange(buf, bufPos);
+    bufPos = 0;
+  }
+  writer->wait();
+  return writer->isOk();
+}
+
+bool FileSink::close() {
+  if (!writer) {
+    return closedOk;
+  }
+  if (bufPos != 0) {
+    buf = writer->exchange(buf, bufPos);
+    bufPos = 0;
+  }
+  closedOk = writer->finish();
+  writer.reset();
+  buf = nullptr;
+  return closedOk;
+}
+
+bool FileSink::isOk() const { return writer ? writer->isOk() : closedOk; }
+
+}  // namespace coti
+}  // namespace tops
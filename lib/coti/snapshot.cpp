@@ -0,0 +1,464 @@
+#include "tops/coti/snapshot.h"
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "fingerprint.h"
+#include "msgpack.h"
+#include "tops/coti/msgpack_reader.h"
+#include "tops/coti/span.h"
+#include "tops/coti/struct_info.h"
+
+namespace tops {
+namespace coti {
+namespace {
+
+constexpr char kMagic[8] = {'C', 'O', 'T', 'I', 'S', 'N', 'A', 'P'};
+// Part of the fingerprint, bumped when the encoding changes.
+constexpr uint8_t kFormatVersion = 1;
+
+// The byte ranges holding the scalars of a raw TypeInfo, relative to the
+// object, sorted with adjacent ranges merged.
+struct RawLayout {
+  struct Run {
+    uint32_t offset;
+    uint32_t size;
+  };
+
+  std::vector<Run> runs;
+  // Sum of the run sizes, the bytes a value takes in the snapshot.
+  size_t numBytes = 0;
+  // A single run covering the whole object.
+  bool isDense = false;
+
+  void addRuns(const RawLayout &other, uint32_t base) {
+    for (auto &run : other.runs) {
+      runs.push_back({base + run.offset, run.size});
+    }
+  }
+
+  void finish(uint32_t cppByteSize) {
+    std::sort(runs.begin(), runs.end(), [](const Run &lhs, const Run &rhs) {
+      return lhs.offset < rhs.offset;
+    });
+    std::vector<Run> merged;
+    for (auto &run : runs) {
+      if (!merged.empty() &&
+          merged.back().offset + merged.back().size == run.offset) {
+        merged.back().size += run.size;
+      } else {
+        merged.push_back(run);
+      }
+    }
+    runs = std::move(merged);
+    numBytes = 0;
+    for (auto &run : runs) {
+      numBytes += run.size;
+    }
+    isDense = runs.size() == 1 && runs[0].offset == 0 &&
+              runs[0].size == cppByteSize;
+  }
+};
+
+// Raw layouts of the TypeInfos met by one save/load.
+class LayoutCache {
+ public:
+  // Null if `type_info` isn't raw.
+  const RawLayout *get(const TypeInfo &type_info) {
+    auto iter = layouts.find(&type_info);
+    if (iter != layouts.end()) {
+      return iter->second.get();
+    }
+    auto layout = compute(type_info);
+    auto *res = layout.get();
+    layouts.emplace(&type_info, std::move(layout));
+    return res;
+  }
+
+ private:
+  std::unique_ptr<RawLayout> compute(const TypeInfo &type_info) {
+    auto layout = std::make_unique<RawLayout>();
+    switch (type_info.kind) {
+      // Scalars are plain storage, e.g. a BFloat is 16 bits, and the
+      // fingerprint pins their kind and width, so they are always raw.
+      case OK_Bool:
+      case OK_Int:
+      case OK_Float:
+        break;
+      case OK_Array: {
+        auto &arrayInfo = static_cast<const ArrayInfo &>(type_info);
+        auto &childInfo = arrayInfo.childInfo;
+        auto *childLayout = arrayInfo.isInline ? get(childInfo) : nullptr;
+        if (!childLayout) {
+          return nullptr;
+        }
+        if (childLayout->isDense) {
+          break;
+        }
+        for (uint32_t base = 0; base < type_info.cppByteSize;
+             base += childInfo.cppByteSize) {
+          layout->addRuns(*childLayout, base);
+        }
+        layout->finish(type_info.cppByteSize);
+        return layout;
+      }
+      case OK_Dict: {
+        auto &dictInfo = static_cast<const DictInfo &>(type_info);
+        if (!dictInfo.isStruct) {
+          return nullptr;
+        }
+        auto &structInfo = static_cast<const StructInfo &>(dictInfo);
+        for (uint32_t idx = 0; idx < structInfo.getNumFields(); ++idx) {
+          auto &field = structInfo.getFields()[idx];
+          auto *fieldLayout = get(field.getTypeInfo());
+          if (!fieldLayout) {
+            return nullptr;
+          }
+          layout->addRuns(*fieldLayout, field.offset);
+        }
+        layout->finish(type_info.cppByteSize);
+        return layout;
+      }
+      default:
+        return nullptr;
+    }
+    layout->runs.push_back({0, type_info.cppByteSize});
+    layout->finish(type_info.cppByteSize);
+    return layout;
+  }
+
+  std::unordered_map<const TypeInfo *, std::unique_ptr<RawLayout>> layouts;
+};
+
+class SnapshotWriter {
+ public:
+  explicit SnapshotWriter(msgpack_packer &packer) : packer(packer) {}
+
+  void write(const TypeInfo &type_info, const void *object) {
+    if (auto *layout = layouts.get(type_info)) {
+      return writeRaw(*layout, object, 1, type_info.cppByteSize);
+    }
+    switch (type_info.kind) {
+      case OK_String: {
+        auto str = static_cast<const StringInfo &>(type_info).get(object);
+        msgpack_pack_str_with_body(&packer, str.data(), str.size());
+        return;
+      }
+      case OK_Array: {
+        auto &arrayInfo = static_cast<const ArrayInfo &>(type_info);
+        auto &childInfo = arrayInfo.childInfo;
+        size_t numChilds = arrayInfo.getNumChilds(object);
+        auto *childBegin =
+            static_cast<const char *>(arrayInfo.getChildBegin(object));
+        if (arrayInfo.isView) {
+          msgpack_pack_bin_with_body(&packer, childBegin,
+                                     numChilds * childInfo.cppByteSize);
+          return;
+        }
+        msgpack_pack_array(&packer, numChilds);
+        if (auto *childLayout = layouts.get(childInfo)) {
+          return writeRaw(*childLayout, childBegin, numChilds,
+                          childInfo.cppByteSize);
+        }
+        for (size_t idx = 0; idx < numChilds; ++idx) {
+          write(childInfo, childBegin + idx * childInfo.cppByteSize);
+        }
+        return;
+      }
+      case OK_List: {
+        auto &listInfo = static_cast<const ListInfo &>(type_info);
+        size_t numChilds = listInfo.getNumChilds(object);
+        msgpack_pack_array(&packer, numChilds);
+        for (size_t idx = 0; idx < numChilds; ++idx) {
+          auto child = listInfo.getChildAt(object, idx);
+          write(*child.type_info, child.ptr);
+        }
+        return;
+      }
+      case OK_Dict: {
+        auto &dictInfo = static_cast<const DictInfo &>(type_info);
+        if (dictInfo.isStruct) {
+          auto &structInfo = static_cast<const StructInfo &>(dictInfo);
+          for (uint32_t idx = 0; idx < structInfo.getNumFields(); ++idx) {
+            auto &field = structInfo.getFields()[idx];
+            write(field.getTypeInfo(),
+                  static_cast<const char *>(object) + field.offset);
+          }
+          return;
+        }
+        msgpack_pack_map(&packer, dictInfo.getNumItems(object));
+        auto *iter = dictInfo.beginIter(object);
+        while (!dictInfo.isEndIter(object, iter)) {
+          auto key = dictInfo.getKeyAtIter(object, iter);
+          msgpack_pack_str_with_body(&packer, key.data(), key.size());
+          auto value = dictInfo.getValueAtIter(object, iter);
+          write(*value.type_info, value.ptr);
+          iter = dictInfo.nextIter(object, iter);
+        }
+        dictInfo.finishIter(object, iter);
+        return;
+      }
+      default:
+        // Scalars are always raw.
+        __builtin_unreachable();
+    }
+  }
+
+ private:
+  // Writes `count` raw values laid out `stride` bytes apart from `first`.
+  void writeRaw(const RawLayout &layout, const void *first, size_t count,
+                size_t stride) {
+    auto *ptr = static_cast<const char *>(first);
+    if (count == 0) {
+      return;
+    }
+    if (layout.isDense) {
+      packer.callback(packer.data, ptr, count * stride);
+      return;
+    }
+    // Gathers the runs so that small structs don't become a callback per
+    // field.
+    constexpr size_t kBatch = 1 << 14;
+    char out[kBatch];
+    size_t outSize = 0;
+    for (size_t idx = 0; idx < count; ++idx, ptr += stride) {
+      for (auto &run : layout.runs) {
+        if (outSize + run.size > kBatch) {
+          packer.callback(packer.data, out, outSize);
+          outSize = 0;
+        }
+        if (run.size > kBatch) {
+          packer.callback(packer.data, ptr + run.offset, run.size);
+          continue;
+        }
+        std::memcpy(out + outSize, ptr + run.offset, run.size);
+        outSize += run.size;
+      }
+    }
+    if (outSize != 0) {
+      packer.callback(packer.data, out, outSize);
+    }
+  }
+
+  msgpack_packer &packer;
+  LayoutCache layouts;
+};
+
+class SnapshotReader {
+ public:
+  explicit SnapshotReader(std::string_view body)
+      : body(body), reader(body) {}
+
+  bool read(const TypeInfo &type_info, void *object) {
+    if (auto *layout = layouts.get(type_info)) {
+      return readRaw(*layout, object, 1, type_info.cppByteSize);
+    }
+    MsgPackToken token;
+    switch (type_info.kind) {
+      case OK_String: {
+        std::string_view str;
+        if (!reader.next(token) || token.kind != MsgPackToken::Str ||
+            !reader.readBytes(token.size, str)) {
+          return false;
+        }
+        static_cast<const StringInfo &>(type_info).set(object, str);
+        return true;
+      }
+      case OK_Array: {
+        auto &arrayInfo = static_cast<const ArrayInfo &>(type_info);
+        auto &childInfo = arrayInfo.childInfo;
+        if (!reader.next(token)) {
+          return false;
+        }
+        if (arrayInfo.isView) {
+          std::string_view bytes;
+          return token.kind == MsgPackToken::Bin &&
+                 reader.readBytes(token.size, bytes) &&
+                 static_cast<const SpanInfo &>(arrayInfo)
+                     .setView(object, bytes);
+        }
+        if (token.kind != MsgPackToken::Array) {
+          return false;
+        }
+        if (arrayInfo.isInline) {
+          if (token.size != arrayInfo.getNumChilds(object)) {
+            return false;
+          }
+        } else {
+          if (!fits(token.size, getMinBytes(childInfo))) {
+            return false;
+          }
+          arrayInfo.resize(object, token.size);
+        }
+        auto *childBegin = static_cast<char *>(arrayInfo.getChildBegin(object));
+        if (auto *childLayout = layouts.get(childInfo)) {
+          return readRaw(*childLayout, childBegin, token.size,
+                         childInfo.cppByteSize);
+        }
+        for (size_t idx = 0; idx < token.size; ++idx) {
+          if (!read(childInfo, childBegin + idx * childInfo.cppByteSize)) {
+            return false;
+          }
+        }
+        return true;
+      }
+      case OK_List: {
+        auto &listInfo = static_cast<const ListInfo &>(type_info);
+        if (!reader.next(token) || token.kind != MsgPackToken::Array) {
+          return false;
+        }
+        // A ListInfo doesn't expose its child TypeInfo, so each child is
+        // only known to take a byte.
+        if (!fits(token.size, 1)) {
+          return false;
+        }
+        listInfo.resize(object, token.size);
+        for (size_t idx = 0; idx < token.size; ++idx) {
+          auto child = listInfo.getChildAt(object, idx);
+          if (!read(*child.type_info, child.ptr)) {
+            return false;
+          }
+        }
+        return true;
+      }
+      case OK_Dict: {
+        auto &dictInfo = static_cast<const DictInfo &>(type_info);
+        if (dictInfo.isStruct) {
+          auto &structInfo = static_cast<const StructInfo &>(dictInfo);
+          for (uint32_t idx = 0; idx < structInfo.getNumFields(); ++idx) {
+            auto &field = structInfo.getFields()[idx];
+            if (!read(field.getTypeInfo(),
+                      static_cast<char *>(object) + field.offset)) {
+              return false;
+            }
+          }
+          return true;
+        }
+        if (!reader.next(token) || token.kind != MsgPackToken::Map) {
+          return false;
+        }
+        for (size_t idx = 0; idx < token.size; ++idx) {
+          MsgPackToken keyToken;
+          std::string_view key;
+          if (!reader.next(keyToken) || keyToken.kind != MsgPackToken::Str ||
+              !reader.readBytes(keyToken.size, key)) {
+            return false;
+          }
+          auto value = dictInfo.getValueAt(object, key);
+          if (!read(*value.type_info, value.ptr)) {
+            return false;
+          }
+        }
+        return true;
+      }
+      default:
+        __builtin_unreachable();
+    }
+  }
+
+  bool atEnd() { return reader.atEnd(); }
+
+ private:
+  // Whether the rest of the body can hold `count` values of at least
+  // `numBytes` each. Checked before resizing, so that a forged count fails
+  // instead of allocating for elements the input doesn't have. Values that
+  // take no bytes count as one.
+  bool fits(size_t count, size_t numBytes) {
+    auto remaining = body.size() - reader.getOffset();
+    return count <= remaining / std::max<size_t>(numBytes, 1);
+  }
+
+  // The fewest bytes a value of `type_info` takes in the snapshot.
+  size_t getMinBytes(const TypeInfo &type_info) {
+    auto iter = minBytes.find(&type_info);
+    if (iter != minBytes.end()) {
+      return iter->second;
+    }
+    size_t res = 1;
+    if (auto *layout = layouts.get(type_info)) {
+      res = layout->numBytes;
+    } else if (type_info.kind == OK_Dict &&
+               static_cast<const DictInfo &>(type_info).isStruct) {
+      // Fields follow each other without a header.
+      auto &structInfo = static_cast<const StructInfo &>(type_info);
+      res = 0;
+      for (uint32_t idx = 0; idx < structInfo.getNumFields(); ++idx) {
+        res += getMinBytes(structInfo.getFields()[idx].getTypeInfo());
+      }
+    }
+    minBytes.emplace(&type_info, res);
+    return res;
+  }
+
+  bool readRaw(const RawLayout &layout, void *first, size_t count,
+               size_t stride) {
+    std::string_view bytes;
+    if (!reader.readBytes(count * layout.numBytes, bytes)) {
+      return false;
+    }
+    if (count == 0) {
+      return true;
+    }
+    auto *ptr = static_cast<char *>(first);
+    if (layout.isDense) {
+      std::memcpy(ptr, bytes.data(), bytes.size());
+      return true;
+    }
+    auto *in = bytes.data();
+    for (size_t idx = 0; idx < count; ++idx, ptr += stride) {
+      for (auto &run : layout.runs) {
+        std::memcpy(ptr + run.offset, in, run.size);
+        in += run.size;
+      }
+    }
+    return true;
+  }
+
+  std::string_view body;
+  MsgPackReader reader;
+  LayoutCache layouts;
+  std::unordered_map<const TypeInfo *, size_t> minBytes;
+};
+
+}  // namespace
+
+uint64_t snapshot_fingerprint(const TypeInfo &type_info) {
+  // Leaves out class names, which differ between builds, so that snapshots
+  // load across builds.
+  return impl::Fingerprinter(false).run(
+      type_info, std::string_view(reinterpret_cast<const char *>(
+                                      &kFormatVersion),
+                                  sizeof(kFormatVersion)));
+}
+
+void save_snapshot(const TypeInfo &type_info, const void *object,
+                   msgpack_packer &packer) {
+  uint64_t fingerprint = snapshot_fingerprint(type_info);
+  packer.callback(packer.data, kMagic, sizeof(kMagic));
+  packer.callback(packer.data, reinterpret_cast<const char *>(&fingerprint),
+                  sizeof(fingerprint));
+  SnapshotWriter(packer).write(type_info, object);
+}
+
+bool load_snapshot(const TypeInfo &type_info, void *object,
+                   std::string_view snapshot) {
+  constexpr size_t kHeaderSize = sizeof(kMagic) + sizeof(uint64_t);
+  if (snapshot.size() < kHeaderSize ||
+      std::memcmp(snapshot.data(), kMagic, sizeof(kMagic)) != 0) {
+    return false;
+  }
+  uint64_t fingerprint;
+  std::memcpy(&fingerprint, snapshot.data() + sizeof(kMagic),
+              sizeof(fingerprint));
+  if (fingerprint != snapshot_fingerprint(type_info)) {
+    return false;
+  }
+  SnapshotReader reader(snapshot.substr(kHeaderSize));
+  return reader.read(type_info, object) && reader.atEnd();
+}
+
+}  // namespace coti
+}  // namespace tops
@@ -0,0 +1,217 @@
+#include "tops/coti/thread_pool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+
+namespace tops {
+namespace coti {
+
+ThreadPool::ThreadPool(size_t numThreads) {
+  threads.reserve(numThreads);
+  for (size_t idx = 0; idx < numThreads; ++idx) {
+    threads.emplace_back([this] { workerLoop(); });
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  cv.notify_all();
+  for (auto &thread : threads) {
+    thread.join();
+  }
+}
+
+void ThreadPool::submit(std::function<void()> task) {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    tasks.push_back(std::move(task));
+  }
+  cv.notify_one();
+}
+
+void ThreadPool::workerLoop() {
+  while (true) {
+    std::function<void()> task;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      cv.wait(lock, [this] { return stopping || !tasks.empty(); });
+      if (tasks.empty()) {
+        return;
+      }
+      task = std::move(tasks.front());
+      tasks.pop_front();
+    }
+    task();
+  }
+}
+
+void ThreadPool::parallelFor(size_t numTasks,
+                             const std::function<void(size_t)> &fn) {
+  // Shared with the helpers, which may only get to run after this call has
+  // returned and then find nothing left to do.
+  struct State {
+    std::atomic<size_t> next{0};
+    std::atomic<size_t> numDone{0};
+    std::mutex mutex;
+    std::condition_variable cv;
+  };
+  auto state = std::make_shared<State>();
+  auto runTasks = [state, numTasks, &fn] {
+    size_t numRun = 0;
+    for (size_t idx; (idx = state->next.fetch_add(1)) < numTasks;) {
+      fn(idx);
+      ++numRun;
+    }
+    if (numRun != 0 && state->numDone.fetch_add(numRun) + numRun == numTasks) {
+      std::lock_guard<std::mutex> lock(state->mutex);
+      state->cv.notify_all();
+    }
+  };
+  // The calling thread runs tasks too, so one less helper is enough.
+  size_t numHelpers =
+      numTasks == 0 ? 0 : std::min(getNumThreads(), numTasks - 1);
+  for (size_t idx = 0; idx < numHelpers; ++idx) {
+    // `fn` is only touched while tasks are left, i.e. before this returns.
+    submit(runTasks);
+  }
+  runTasks();
+  std::unique_lock<std::mutex> lock(state->mutex);
+  state->cv.wait(lock, [&] { return state->numDone.load() == numTasks; });
+}
+
+ThreadPool &ThreadPool::getDefault() {
+  static ThreadPool pool(std::max(1u, std::thread::hardware_concurrency()));
+  return pool;
+}
+
+namespace {
+
+// The pool and deque of the worker running on this thread, if any.
+thread_local const WorkStealingPool *currentPool = nullptr;
+thread_local size_t currentWorker = 0;
+
+// Number of TaskGroup::wait() calls active on this thread.
+thread_local size_t waitDepth = 0;
+
+}  // namespace
+
+WorkStealingPool::WorkStealingPool(size_t numThreads) {
+  for (size_t idx = 0; idx < numThreads; ++idx) {
+    workers.push_back(std::make_unique<Worker>());
+  }
+  threads.reserve(numThreads);
+  for (size_t idx = 0; idx < numThreads; ++idx) {
+    threads.emplace_back([this, idx] { workerLoop(idx); });
+  }
+}
+
+WorkStealingPool::~WorkStealingPool() {
+  {
+    std::lock_guard<std::mutex> lock(sleepMutex);
+    stopping = true;
+  }
+  sleepCv.notify_all();
+  for (auto &thread : threads) {
+    thread.join();
+  }
+}
+
+void WorkStealingPool::push(const TaskGroup *group, std::function<void()> fn) {
+  size_t workerIdx = currentPool == this
+                         ? currentWorker
+                         : nextWorker.fetch_add(1) % workers.size();
+  {
+    auto &worker = *workers[workerIdx];
+    std::lock_guard<std::mutex> lock(worker.mutex);
+    worker.tasks.push_back({group, std::move(fn)});
+  }
+  {
+    // Taken so the increment can't slip between a sleeper's check and wait.
+    std::lock_guard<std::mutex> lock(sleepMutex);
+    numQueued.fetch_add(1);
+  }
+  sleepCv.notify_one();
+}
+
+bool WorkStealingPool::runOne(const TaskGroup *onlyGroup) {
+  std::function<void()> task;
+  bool isWorker = currentPool == this;
+  if (onlyGroup && !isWorker) {
+    return false;
+  }
+  size_t numWorkers = onlyGroup ? 1 : workers.size();
+  size_t self = isWorker ? currentWorker : 0;
+  for (size_t offset = 0; offset < numWorkers && !task; ++offset) {
+    auto &worker = *workers[(self + offset) % workers.size()];
+    std::lock_guard<std::mutex> lock(worker.mutex);
+    if (worker.tasks.empty()) {
+      continue;
+    }
+    if (offset == 0 && isWorker) {
+      if (onlyGroup && worker.tasks.back().group != onlyGroup) {
+        continue;
+      }
+      task = std::move(worker.tasks.back().fn);
+      worker.tasks.pop_back();
+    } else {
+      task = std::move(worker.tasks.front().fn);
+      worker.tasks.pop_front();
+    }
+  }
+  if (!task) {
+    return false;
+  }
+  numQueued.fetch_sub(1);
+  task();
+  return true;
+}
+
+void WorkStealingPool::workerLoop(size_t workerIdx) {
+  currentPool = this;
+  currentWorker = workerIdx;
+  while (true) {
+    if (runOne()) {
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(sleepMutex);
+    sleepCv.wait(lock, [this] { return stopping || numQueued.load() != 0; });
+    if (stopping && numQueued.load() == 0) {
+      return;
+    }
+  }
+}
+
+WorkStealingPool &WorkStealingPool::getDefault() {
+  static WorkStealingPool pool(
+      std::max(1u, std::thread::hardware_concurrency()));
+  return pool;
+}
+
+void TaskGroup::spawn(std::function<void()> task) {
+  numPending.fetch_add(1);
+  pool.push(this, [this, task = std::move(task)] {
+    task();
+    numPending.fetch_sub(1);
+  });
+}
+
+void TaskGroup::wait() {
+  // Tasks of this group still queued here sit on top of this worker's deque,
+  // and the others are running on the threads that took them, so waiting
+  // with `onlyGroup` still makes progress.
+  ++waitDepth;
+  const TaskGroup *onlyGroup = waitDepth > kMaxStealDepth ? this : nullptr;
+  while (numPending.load() != 0) {
+    if (!pool.runOne(onlyGroup)) {
+      std::this_thread::yield();
+    }
+  }
+  --waitDepth;
+}
+
+}  // namespace coti
+}  // namespace tops
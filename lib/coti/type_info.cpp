@@ -0,0 +1,314 @@
+#include "tops/coti/type_info.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <string>
+
+#include "tops/coti/arena.h"
+#include "tops/coti/span.h"
+#include "tops/coti/type_trait.h"
+
+namespace tops {
+namespace coti {
+namespace {
+
+template <typename T>
+T load(const void *object) {
+  T val;
+  std::memcpy(&val, object, sizeof(T));
+  return val;
+}
+
+template <typename T>
+void store(void *object, T val) {
+  std::memcpy(object, &val, sizeof(T));
+}
+
+float bits_to_float(uint32_t bits) {
+  float val;
+  std::memcpy(&val, &bits, sizeof(val));
+  return val;
+}
+
+uint32_t float_to_bits(float val) {
+  uint32_t bits;
+  std::memcpy(&bits, &val, sizeof(bits));
+  return bits;
+}
+
+float half_to_float(uint16_t half) {
+  uint32_t sign = uint32_t(half & 0x8000) << 16;
+  uint32_t exp = (half >> 10) & 0x1f;
+  uint32_t mant = half & 0x3ff;
+  if (exp == 0x1f) {
+    return bits_to_float(sign | 0x7f800000 | (mant << 13));
+  }
+  if (exp == 0) {
+    // Zero or subnormal, mant * 2^-24.
+    float val = float(mant) * (1.0f / 16777216.0f);
+    return sign ? -val : val;
+  }
+  return bits_to_float(sign | ((exp + 112) << 23) | (mant << 13));
+}
+
+uint16_t float_to_half(float val) {
+  uint32_t bits = float_to_bits(val);
+  uint16_t sign = (bits >> 16) & 0x8000;
+  uint32_t absBits = bits & 0x7fffffff;
+  if (absBits >= 0x7f800000) {
+    // Inf or nan, keep nan quiet.
+    return sign | 0x7c00 | (absBits > 0x7f800000 ? 0x200 : 0);
+  }
+  if (absBits >= 0x477ff000) {
+    // Rounds to a value larger than the largest half.
+    return sign | 0x7c00;
+  }
+  if (absBits < 0x38800000) {
+    // Subnormal half, round to nearest even on mant * 2^-24.
+    float absVal = bits_to_float(absBits) * 16777216.0f;
+    auto mant = static_cast<uint32_t>(absVal);
+    float rem = absVal - float(mant);
+    if (rem > 0.5f || (rem == 0.5f && (mant & 1))) {
+      ++mant;
+    }
+    return sign | mant;
+  }
+  uint32_t rounded = absBits + 0xfff + ((absBits >> 13) & 1);
+  return sign | ((rounded - 0x38000000) >> 13);
+}
+
+float bfloat_to_float(uint16_t bfloat) {
+  return bits_to_float(uint32_t(bfloat) << 16);
+}
+
+uint16_t float_to_bfloat(float val) {
+  uint32_t bits = float_to_bits(val);
+  if ((bits & 0x7fffffff) > 0x7f800000) {
+    return (bits >> 16) | 0x40;
+  }
+  // Round to nearest even.
+  return (bits + 0x7fff + ((bits >> 16) & 1)) >> 16;
+}
+
+struct StdStringInfo : StringInfo {
+  StdStringInfo() : StringInfo(sizeof(std::string)) {}
+
+  std::string_view get(const void *object) const override {
+    return *static_cast<const std::string *>(object);
+  }
+
+  void set(void *object, std::string_view val) const override {
+    static_cast<std::string *>(object)->assign(val);
+  }
+};
+
+// set() stores the view itself, so a decoded std::string_view points into the
+// decoder's input, e.g. a MappedFile.
+struct StdStringViewInfo : StringInfo {
+  StdStringViewInfo() : StringInfo(sizeof(std::string_view)) { isView = true; }
+
+  std::string_view get(const void *object) const override {
+    return *static_cast<const std::string_view *>(object);
+  }
+
+  void set(void *object, std::string_view val) const override {
+    *static_cast<std::string_view *>(object) = val;
+  }
+};
+
+}  // namespace
+
+namespace impl {
+
+const StringInfo &getStdStrigTypeInfo() {
+  static const StdStringInfo info;
+  return info;
+}
+
+const StringInfo &getStdStrigViewTypeInfo() {
+  static const StdStringViewInfo info;
+  return info;
+}
+
+}  // namespace impl
+
+TypeInfo::~TypeInfo() = default;
+
+const BoolInfo &BoolInfo::getSingleton() {
+  static const BoolInfo info;
+  return info;
+}
+
+IntegerInfo &IntegerInfo::getSBitIntInfo(uint32_t bitWidth) {
+  static IntegerInfo infos[] = {{true, 8}, {true, 16}, {true, 32}, {true, 64}};
+  switch (bitWidth) {
+    case 8:
+      return infos[0];
+    case 16:
+      return infos[1];
+    case 32:
+      return infos[2];
+    case 64:
+      return infos[3];
+    default:
+      assert(false && "unsupported integer bit width");
+      __builtin_unreachable();
+  }
+}
+
+IntegerInfo &IntegerInfo::getUBitIntInfo(uint32_t bitWidth) {
+  static IntegerInfo infos[] = {
+      {false, 8}, {false, 16}, {false, 32}, {false, 64}};
+  switch (bitWidth) {
+    case 8:
+      return infos[0];
+    case 16:
+      return infos[1];
+    case 32:
+      return infos[2];
+    case 64:
+      return infos[3];
+    default:
+      assert(false && "unsupported integer bit width");
+      __builtin_unreachable();
+  }
+}
+
+IntegerInfo::SignBitEncodeTy IntegerInfo::encodeSignBit(bool isSigned,
+                                                        uint32_t bitWidth) {
+  return (bitWidth << 1) | SignBitEncodeTy(isSigned);
+}
+
+IntegerInfo::BitWidthAndSign IntegerInfo::decodeSignBit(
+    SignBitEncodeTy signAndBit) {
+  return {signAndBit >> 1, bool(signAndBit & 1)};
+}
+
+int64_t IntegerInfo::get(const void *object) const {
+  auto [bitWidth, isSigned] = decodeSignBit(signBitEncode);
+  switch (bitWidth) {
+    case 8:
+      return isSigned ? int64_t(load<int8_t>(object))
+                      : int64_t(load<uint8_t>(object));
+    case 16:
+      return isSigned ? int64_t(load<int16_t>(object))
+                      : int64_t(load<uint16_t>(object));
+    case 32:
+      return isSigned ? int64_t(load<int32_t>(object))
+                      : int64_t(load<uint32_t>(object));
+    case 64:
+      return load<int64_t>(object);
+    default:
+      __builtin_unreachable();
+  }
+}
+
+void IntegerInfo::set(void *object, int64_t val) const {
+  switch (getBitWidth()) {
+    case 8:
+      return store(object, uint8_t(val));
+    case 16:
+      return store(object, uint16_t(val));
+    case 32:
+      return store(object, uint32_t(val));
+    case 64:
+      return store(object, val);
+    default:
+      __builtin_unreachable();
+  }
+}
+
+FloatInfo &FloatInfo::getSingleton(uint32_t bitWidth, FloatKind kind) {
+  static FloatInfo half(16, IEEE), single(32, IEEE), dbl(64, IEEE),
+      bfloat(16, BFloat);
+  if (kind == BFloat) {
+    assert(bitWidth == 16);
+    return bfloat;
+  }
+  switch (bitWidth) {
+    case 16:
+      return half;
+    case 32:
+      return single;
+    case 64:
+      return dbl;
+    default:
+      assert(false && "unsupported float bit width");
+      __builtin_unreachable();
+  }
+}
+
+FloatInfo::BitKindEncodeTy FloatInfo::encodeBitKind(uint32_t bitWidth,
+                                                    FloatKind kind) {
+  return (bitWidth << 1) | BitKindEncodeTy(kind);
+}
+
+FloatInfo::BitWidthAndKind FloatInfo::decodeBitKind(BitKindEncodeTy encode) {
+  return {encode >> 1, FloatKind(encode & 1)};
+}
+
+double FloatInfo::get(const void *object) const {
+  auto [bitWidth, kind] = decodeBitKind(kindBitEncode);
+  switch (bitWidth) {
+    case 16:
+      return kind == BFloat ? bfloat_to_float(load<uint16_t>(object))
+                            : half_to_float(load<uint16_t>(object));
+    case 32:
+      return load<float>(object);
+    case 64:
+      return load<double>(object);
+    default:
+      __builtin_unreachable();
+  }
+}
+
+void FloatInfo::set(void *object, double val) const {
+  auto [bitWidth, kind] = decodeBitKind(kindBitEncode);
+  switch (bitWidth) {
+    case 16:
+      return store(object, kind == BFloat ? float_to_bfloat(float(val))
+                                          : float_to_half(float(val)));
+    case 32:
+      return store(object, float(val));
+    case 64:
+      return store(object, val);
+    default:
+      __builtin_unreachable();
+  }
+}
+
+uint64_t FloatInfo::getU64ZExt(const void *object) const {
+  uint64_t bits = 0;
+  std::memcpy(&bits, object, cppByteSize);
+  return bits;
+}
+
+void FloatInfo::setU64(void *object, uint64_t val) const {
+  std::memcpy(object, &val, cppByteSize);
+}
+
+bool SpanInfo::setView(void *object, std::string_view bytes) const {
+  auto elemSize = childInfo.cppByteSize;
+  if (bytes.size() % elemSize != 0) {
+    return false;
+  }
+  auto *data = bytes.data();
+  if (reinterpret_cast<uintptr_t>(data) % elemSize != 0) {
+    auto *resource = get_decode_resource();
+    if (!resource) {
+      return false;
+    }
+    auto *copy = static_cast<char *>(resource->allocate(
+        std::max<size_t>(bytes.size(), 1), elemSize));
+    std::memcpy(copy, bytes.data(), bytes.size());
+    data = copy;
+  }
+  auto &rep = const_cast<impl::SpanRep &>(asRep(object));
+  rep.data = data;
+  rep.size = bytes.size() / elemSize;
+  return true;
+}
+
+}  // namespace coti
+}  // namespace tops
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <type_traits>
+#include <utility>
+
+#include "instrument_scope.h"
+#include "tops/coti/type_info.h"
+
+namespace tops {
+namespace coti {
+namespace impl {
+
+template <template <typename> typename T, typename... Args>
+auto type_info_dispatch(const TypeInfo &type_info, Args &&...args) {
+#ifdef TOPS_COTI_INSTRUMENT
+  InstrumentScope scope(type_info);
+#endif
+  switch (type_info.kind) {
+    default:
+      break;
+    case TypeKind::OK_Bool:
+      return T<BoolInfo>::run(static_cast<const BoolInfo &>(type_info),
+                              std::forward<Args>(args)...);
+    case TypeKind::OK_Int:
+      return T<IntegerInfo>::run(static_cast<const IntegerInfo &>(type_info),
+                                 std::forward<Args>(args)...);
+    case TypeKind::OK_Float:
+      return T<FloatInfo>::run(static_cast<const FloatInfo &>(type_info),
+                               std::forward<Args>(args)...);
+    case TypeKind::OK_String:
+      return T<StringInfo>::run(static_cast<const StringInfo &>(type_info),
+                                std::forward<Args>(args)...);
+    case TypeKind::OK_Array:
+      return T<ArrayInfo>::run(static_cast<const ArrayInfo &>(type_info),
+                               std::forward<Args>(args)...);
+    case TypeKind::OK_List:
+      return T<ListInfo>::run(static_cast<const ListInfo &>(type_info),
+                              std::forward<Args>(args)...);
+    case TypeKind::OK_Dict:
+      return T<DictInfo>::run(static_cast<const DictInfo &>(type_info),
+                              std::forward<Args>(args)...);
+  }
+  __builtin_unreachable();
+}
+
+template <typename T>
+constexpr bool has_simple_get_set_v =
+    std::is_same_v<T, BoolInfo> || std::is_same_v<T, IntegerInfo> ||
+    std::is_same_v<T, FloatInfo> || std::is_same_v<T, StringInfo>;
+
+}  // namespace impl
+}  // namespace coti
+}  // namespace tops
@@ -6,45 +6,17 @@
 #include "msgpack.h"
 #include "openssl/crypto.h"
 #include "openssl/evp.h"
+#include "scalar_array.h"
+#include "tops/coti/span.h"
+#include "tops/coti/struct_info.h"
+#include "type_info_dispatch.h"
 
 namespace tops {
 namespace coti {
 namespace {
 
-template <template <typename> typename T, typename... Args>
-auto type_info_dispatch(const TypeInfo &type_info, Args &&...args) {
-  switch (type_info.kind) {
-    default:
-      break;
-    case TypeKind::OK_Bool:
-      return T<BoolInfo>::run(static_cast<const BoolInfo &>(type_info),
-                              std::forward<Args>(args)...);
-    case TypeKind::OK_Int:
-      return T<IntegerInfo>::run(static_cast<const IntegerInfo &>(type_info),
-                                 std::forward<Args>(args)...);
-    case TypeKind::OK_Float:
-      return T<FloatInfo>::run(static_cast<const FloatInfo &>(type_info),
-                               std::forward<Args>(args)...);
-    case TypeKind::OK_String:
-      return T<StringInfo>::run(static_cast<const StringInfo &>(type_info),
-                                std::forward<Args>(args)...);
-    case TypeKind::OK_Array:
-      return T<ArrayInfo>::run(static_cast<const ArrayInfo &>(type_info),
-                               std::forward<Args>(args)...);
-    case TypeKind::OK_List:
-      return T<ListInfo>::run(static_cast<const ListInfo &>(type_info),
-                              std::forward<Args>(args)...);
-    case TypeKind::OK_Dict:
-      return T<DictInfo>::run(static_cast<const DictInfo &>(type_info),
-                              std::forward<Args>(args)...);
-  }
-  __builtin_unreachable();
-}
-
-template <typename T>
-constexpr bool has_simple_get_set_v =
-    std::is_same_v<T, BoolInfo> || std::is_same_v<T, IntegerInfo> ||
-    std::is_same_v<T, FloatInfo> || std::is_same_v<T, StringInfo>;
+using impl::has_simple_get_set_v;
+using impl::type_info_dispatch;
 
 nlohmann::json to_json(const ArrayInfo &arrayInfo, const void *object);
 nlohmann::json to_json(const ListInfo &listInfo, const void *object);
@@ -91,6 +63,15 @@ struct ToJsonList {
 };
 
 nlohmann::json to_json(const ArrayInfo &arrayInfo, const void *object) {
+  nlohmann::json json;
+  if (impl::with_scalar_type(arrayInfo.childInfo, [&](auto tag) {
+        using ElemT = typename decltype(tag)::type;
+        json = impl::scalar_array_to_json(
+            reinterpret_cast<const ElemT *>(arrayInfo.getChildBegin(object)),
+            arrayInfo.getNumChilds(object));
+      })) {
+    return json;
+  }
   return type_info_dispatch<ToJsonArray>(arrayInfo.childInfo, arrayInfo,
                                          object);
 }
@@ -106,6 +87,9 @@ nlohmann::json to_json(const ListInfo &listInfo, const void *object) {
 }
 
 nlohmann::json to_json(const DictInfo &dictInfo, const void *object) {
+  if (dictInfo.codecs && dictInfo.codecs->toJson) {
+    return dictInfo.codecs->toJson(object);
+  }
   nlohmann::json json(nlohmann::json::value_t::object);
   auto *iter = dictInfo.beginIter(object);
   while (!dictInfo.isEndIter(object, iter)) {
@@ -129,6 +113,13 @@ template <typename T>
 struct FromJson {
   static void run(const T &type_info, const nlohmann::json &json,
                   void *object) {
+    if constexpr (std::is_same_v<T, StringInfo>) {
+      // It would point into the json, which the caller may free.
+      if (type_info.isView) {
+        assert(false && "std::string_view can't be decoded from json");
+        return;
+      }
+    }
     if constexpr (has_simple_get_set_v<T>) {
       return type_info.set(object, json.get<typename T::JsonValType>());
     }
@@ -149,8 +140,21 @@ struct FromJsonArray {
 
 void from_json(const ArrayInfo &arrayInfo, void *object,
                const nlohmann::json &json) {
+  // A Span can't own elements.
+  if (arrayInfo.isView) {
+    assert(false && "a Span can't be decoded from json");
+    return;
+  }
   auto numChilds = json.size();
   arrayInfo.resize(object, numChilds);
+  if (impl::with_scalar_type(arrayInfo.childInfo, [&](auto tag) {
+        using ElemT = typename decltype(tag)::type;
+        impl::scalar_array_from_json(
+            json.get_ref<const nlohmann::json::array_t &>(),
+            reinterpret_cast<ElemT *>(arrayInfo.getChildBegin(object)));
+      })) {
+    return;
+  }
   return type_info_dispatch<FromJsonArray>(
       arrayInfo.childInfo, json,
       reinterpret_cast<char *>(arrayInfo.getChildBegin(object)), numChilds);
@@ -166,8 +170,29 @@ void from_json(const ListInfo &listInfo, void *object,
   }
 }
 
+// Keys that aren't fields are skipped, fields without a key default-filled.
+void from_json(const StructInfo &structInfo, void *object,
+               const nlohmann::json &json) {
+  SeenFields seen(structInfo.getNumFields());
+  for (const auto &[key, value] : json.items()) {
+    auto idx = structInfo.findField(key);
+    if (idx < 0) {
+      continue;
+    }
+    seen.set(idx);
+    auto field = structInfo.getFieldAt(object, idx);
+    from_json(*field.type_info, field.ptr, value);
+  }
+  if (structInfo.getHasDefaults()) {
+    structInfo.fillMissing(object, seen);
+  }
+}
+
 void from_json(const DictInfo &dictInfo, void *object,
                const nlohmann::json &json) {
+  if (dictInfo.isStruct) {
+    return from_json(static_cast<const StructInfo &>(dictInfo), object, json);
+  }
   for (const auto &[key, value] : json.items()) {
     auto typedPtr = dictInfo.getValueAt(object, key);
     from_json(*typedPtr.type_info, typedPtr.ptr, value);
@@ -189,8 +214,11 @@ struct ToMsgPack {
   static void run(const T &type_info, const void *object,
                   msgpack_packer &packer) {
     if constexpr (std::is_same_v<T, BoolInfo>) {
-      auto val = type_info.get(object);
-      msgpack_pack_char(&packer, val ? '\1' : '\0');
+      if (type_info.get(object)) {
+        msgpack_pack_true(&packer);
+      } else {
+        msgpack_pack_false(&packer);
+      }
       return;
     }
     if constexpr (std::is_same_v<T, IntegerInfo>) {
@@ -242,6 +270,13 @@ struct ToMsgPack {
       return;
     }
     if constexpr (std::is_same_v<T, ArrayInfo>) {
+      if (type_info.isView) {
+        auto numBytes =
+            type_info.getNumChilds(object) * type_info.childInfo.cppByteSize;
+        msgpack_pack_bin_with_body(&packer, type_info.getChildBegin(object),
+                                   numBytes);
+        return;
+      }
       return to_msgpack(type_info.childInfo, type_info.getNumChilds(object),
                         type_info.getChildBegin(object), packer);
     }
@@ -255,6 +290,9 @@ struct ToMsgPack {
       return;
     }
     if constexpr (std::is_same_v<T, DictInfo>) {
+      if (type_info.codecs && type_info.codecs->toMsgPack) {
+        return type_info.codecs->toMsgPack(object, packer);
+      }
       auto numItems = type_info.getNumItems(object);
       msgpack_pack_map(&packer, numItems);
       auto iter = type_info.beginIter(object);
@@ -285,6 +323,13 @@ struct ToMsgPackArray {
 
 void to_msgpack(const TypeInfo &elemInfo, size_t numChilds,
                 const void *childBegin, msgpack_packer &packer) {
+  if (impl::with_scalar_type(elemInfo, [&](auto tag) {
+        using ElemT = typename decltype(tag)::type;
+        impl::pack_scalar_array(reinterpret_cast<const ElemT *>(childBegin),
+                                numChilds, packer);
+      })) {
+    return;
+  }
   msgpack_pack_array(&packer, numChilds);
   return type_info_dispatch<ToMsgPackArray>(elemInfo, numChilds, childBegin,
                                             packer);
@@ -293,6 +338,28 @@ void to_msgpack(const TypeInfo &elemInfo, size_t numChilds,
 void from_msgpack(const ArrayInfo &arrayInfo, void *object,
                   msgpack_object_array array);
 
+// Keys that aren't fields are skipped, fields without a key default-filled.
+void from_msgpack_struct(const StructInfo &structInfo, void *object,
+                         msgpack_object_map map) {
+  SeenFields seen(structInfo.getNumFields());
+  for (size_t idx = 0; idx < map.size; ++idx) {
+    auto &keyVal = map.ptr[idx];
+    assert(keyVal.key.type == MSGPACK_OBJECT_STR);
+    auto strObj = keyVal.key.via.str;
+    auto fieldIdx =
+        structInfo.findField(std::string_view(strObj.ptr, strObj.size));
+    if (fieldIdx < 0) {
+      continue;
+    }
+    seen.set(fieldIdx);
+    auto field = structInfo.getFieldAt(object, fieldIdx);
+    from_msgpack(*field.type_info, field.ptr, keyVal.val);
+  }
+  if (structInfo.getHasDefaults()) {
+    structInfo.fillMissing(object, seen);
+  }
+}
+
 template <typename T>
 struct FromMsgPack {
   static void run(const T &type_info, void *object,
@@ -320,6 +387,15 @@ struct FromMsgPack {
       return;
     }
     if constexpr (std::is_same_v<T, ArrayInfo>) {
+      if (type_info.isView) {
+        assert(msg_obj.type == MSGPACK_OBJECT_BIN);
+        auto bin = msg_obj.via.bin;
+        auto res = static_cast<const SpanInfo &>(type_info).setView(
+            object, std::string_view(bin.ptr, bin.size));
+        assert(res && "bad or misaligned span payload outside an ArenaScope");
+        (void)res;
+        return;
+      }
       return from_msgpack(type_info, object, msg_obj.via.array);
     }
     if constexpr (std::is_same_v<T, ListInfo>) {
@@ -333,6 +409,13 @@ struct FromMsgPack {
       return;
     }
     if constexpr (std::is_same_v<T, DictInfo>) {
+      if (type_info.codecs && type_info.codecs->fromMsgPack) {
+        return type_info.codecs->fromMsgPack(object, msg_obj);
+      }
+      if (type_info.isStruct) {
+        return from_msgpack_struct(static_cast<const StructInfo &>(type_info),
+                                   object, msg_obj.via.map);
+      }
       auto map = msg_obj.via.map;
       auto size = map.size;
       for (size_t idx = 0; idx < size; ++idx) {
@@ -365,28 +448,99 @@ void from_msgpack(const ArrayInfo &arrayInfo, void *object,
                   msgpack_object_array array) {
   auto size = array.size;
   arrayInfo.resize(object, size);
+  if (impl::with_scalar_type(arrayInfo.childInfo, [&](auto tag) {
+        using ElemT = typename decltype(tag)::type;
+        impl::unpack_scalar_array(
+            array.ptr, size,
+            reinterpret_cast<ElemT *>(arrayInfo.getChildBegin(object)));
+      })) {
+    return;
+  }
   return type_info_dispatch<FromMsgPackArray>(
       arrayInfo.childInfo, arrayInfo.getChildBegin(object), size, array);
 }
 
+// Collects the packer's small writes into blocks for a Sink.
+class MsgPackSinkBuffer {
+ public:
+  explicit MsgPackSinkBuffer(Sink &sink) : sink(sink) {
+    buf.reserve(kFlushSize);
+  }
+
+  ~MsgPackSinkBuffer() { flush(); }
+
+  static int write(void *data, const char *buf, size_t len) {
+    auto &self = *static_cast<MsgPackSinkBuffer *>(data);
+    if (self.buf.size() + len > kFlushSize) {
+      self.flush();
+    }
+    if (len >= kFlushSize) {
+      self.sink.write(buf, len);
+    } else {
+      self.buf.append(buf, buf + len);
+    }
+    return 0;
+  }
+
+  void flush() {
+    if (buf.size() != 0) {
+      sink.write(buf.data(), buf.size());
+      buf.clear();
+    }
+  }
+
+ private:
+  static constexpr size_t kFlushSize = 64 * 1024;
+
+  Sink &sink;
+  fmt::memory_buffer buf;
+};
+
 }  // namespace
 
 nlohmann::json to_json(const TypeInfo &type_info, const void *object) {
+#ifdef TOPS_COTI_INSTRUMENT
+  impl::InstrumentOpScope opScope(InstrumentOp::ToJson);
+#endif
   return type_info_dispatch<ToJson>(type_info, object);
 }
 
 void from_json(const TypeInfo &type_info, void *object,
                const nlohmann::json &json) {
+#ifdef TOPS_COTI_INSTRUMENT
+  impl::InstrumentOpScope opScope(InstrumentOp::FromJson);
+#endif
   return type_info_dispatch<FromJson>(type_info, json, object);
 }
 
 void to_msgpack(const TypeInfo &type_info, const void *object,
                 msgpack_packer &packer) {
+#ifdef TOPS_COTI_INSTRUMENT
+  impl::InstrumentOpScope opScope(InstrumentOp::ToMsgPack);
+  return type_info_dispatch<ToMsgPack>(type_info, object,
+                                       opScope.countBytes(packer));
+#else
   return type_info_dispatch<ToMsgPack>(type_info, object, packer);
+#endif
+}
+
+void to_msgpack_stream(const TypeInfo &type_info, const void *object,
+                       Sink &sink) {
+  MsgPackSinkBuffer buffer(sink);
+  msgpack_packer packer{&buffer, &MsgPackSinkBuffer::write};
+  to_msgpack(type_info, object, packer);
+}
+
+int sink_packer_write(void *sink, const char *data, size_t size) {
+  static_cast<Sink *>(sink)->write(data, size);
+  return 0;
 }
 
 void from_msgpack(const TypeInfo &type_info, void *object,
                   const msgpack_object &msg_obj) {
+#ifdef TOPS_COTI_INSTRUMENT
+  impl::InstrumentOpScope opScope(InstrumentOp::FromMsgPack);
+#endif
   return type_info_dispatch<FromMsgPack>(type_info, object, msg_obj);
 }
 
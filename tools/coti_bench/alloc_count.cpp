@@ -0,0 +1,13 @@
+#include "alloc_count.h"
+
+#include "tops/coti/counted_new.h"
+
+namespace tops {
+namespace coti {
+namespace bench {
+
+size_t get_num_allocs() { return counted_new_thread_allocs(); }
+
+}  // namespace bench
+}  // namespace coti
+}  // namespace tops
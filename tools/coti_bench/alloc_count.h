@@ -0,0 +1,16 @@
+#pragma once
+
+#include <cstddef>
+
+/// Heap allocations of the calling thread, which covers the single-threaded
+/// benchmarks, as counted by the operator new replacement of counted_new.h.
+
+namespace tops {
+namespace coti {
+namespace bench {
+
+size_t get_num_allocs();
+
+}  // namespace bench
+}  // namespace coti
+}  // namespace tops
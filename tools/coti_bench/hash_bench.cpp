@@ -0,0 +1,70 @@
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "tops/coti/hash.h"
+#include "tops/coti/type_trait.h"
+
+using namespace tops::coti;
+
+namespace {
+
+template <typename HasherT>
+void BM_HashInt64Array(benchmark::State &state) {
+  auto &info = get_type_info<std::vector<int64_t>>();
+  std::vector<int64_t> vec(state.range(0));
+  for (size_t idx = 0; idx < vec.size(); ++idx) {
+    vec[idx] = int64_t(idx * 0x9e3779b97f4a7c15ull);
+  }
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(hash_with<HasherT>(info, &vec));
+  }
+  state.SetBytesProcessed(state.iterations() * vec.size() * sizeof(int64_t));
+  state.SetItemsProcessed(state.iterations());
+}
+
+template <typename HasherT>
+void BM_HashDoubleArray(benchmark::State &state) {
+  auto &info = get_type_info<std::vector<double>>();
+  std::vector<double> vec(state.range(0));
+  for (size_t idx = 0; idx < vec.size(); ++idx) {
+    vec[idx] = double(idx) * 0.5;
+  }
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(hash_with<HasherT>(info, &vec));
+  }
+  state.SetBytesProcessed(state.iterations() * vec.size() * sizeof(double));
+  state.SetItemsProcessed(state.iterations());
+}
+
+// Strings aren't contiguous, so this measures the buffered per-element path.
+template <typename HasherT>
+void BM_HashStringArray(benchmark::State &state) {
+  auto &info = get_type_info<std::vector<std::string>>();
+  std::vector<std::string> vec(state.range(0));
+  size_t numBytes = 0;
+  for (size_t idx = 0; idx < vec.size(); ++idx) {
+    vec[idx] = "key_" + std::to_string(idx);
+    numBytes += vec[idx].size();
+  }
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(hash_with<HasherT>(info, &vec));
+  }
+  state.SetBytesProcessed(state.iterations() * numBytes);
+  state.SetItemsProcessed(state.iterations());
+}
+
+}  // namespace
+
+BENCHMARK_TEMPLATE(BM_HashInt64Array, SHA3_256Hasher)->Range(1 << 10, 1 << 24);
+BENCHMARK_TEMPLATE(BM_HashInt64Array, XXH3_64Hasher)->Range(1 << 10, 1 << 24);
+BENCHMARK_TEMPLATE(BM_HashInt64Array, XXH3_128Hasher)->Range(1 << 10, 1 << 24);
+BENCHMARK_TEMPLATE(BM_HashDoubleArray, SHA3_256Hasher)->Range(1 << 10, 1 << 24);
+BENCHMARK_TEMPLATE(BM_HashDoubleArray, XXH3_64Hasher)->Range(1 << 10, 1 << 24);
+BENCHMARK_TEMPLATE(BM_HashDoubleArray, XXH3_128Hasher)
+    ->Range(1 << 10, 1 << 24);
+BENCHMARK_TEMPLATE(BM_HashStringArray, SHA3_256Hasher)->Range(1 << 10, 1 << 20);
+BENCHMARK_TEMPLATE(BM_HashStringArray, XXH3_64Hasher)->Range(1 << 10, 1 << 20);
+BENCHMARK_TEMPLATE(BM_HashStringArray, XXH3_128Hasher)
+    ->Range(1 << 10, 1 << 20);
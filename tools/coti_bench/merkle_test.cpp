@@ -0,0 +1,169 @@
+#include <cstdint>
+#include <memory_resource>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "tops/coti/merkle.h"
+#include "tops/coti/pmr.h"
+
+/// HashedObject::hash() has to equal a fresh merkle_hash() after any edit
+/// reported with markDirty(). A small leaf weight splits every container into
+/// several Run and Interior nodes, so that the edits move node boundaries.
+
+using namespace tops::coti;
+
+namespace {
+
+constexpr size_t kLeafWeight = 4;
+
+using Row = std::pmr::vector<int64_t>;
+using Table = std::pmr::map<std::pmr::string, Row>;
+using Doc = std::pmr::map<std::pmr::string, std::pmr::vector<Table>>;
+
+Doc make_doc() {
+  Doc doc;
+  for (int64_t key = 0; key < 3; ++key) {
+    auto &tables = doc[std::pmr::string("t" + std::to_string(key))];
+    tables.resize(4);
+    for (size_t idx = 0; idx < tables.size(); ++idx) {
+      for (int64_t col = 0; col < 5; ++col) {
+        auto &row = tables[idx][std::pmr::string("c" + std::to_string(col))];
+        row.assign(col * 3, key * 1000 + int64_t(idx) * 10 + col);
+      }
+    }
+  }
+  return doc;
+}
+
+class MerkleTest : public ::testing::Test {
+ protected:
+  void expectFresh() {
+    auto fresh = merkle_hash(doc, WorkStealingPool::getDefault(), kLeafWeight);
+    EXPECT_EQ(hashed.hash(), fresh.getDigest());
+  }
+
+  Doc doc = make_doc();
+  HashedObject hashed{doc, WorkStealingPool::getDefault(), kLeafWeight};
+};
+
+TEST_F(MerkleTest, MatchesWithoutEdits) {
+  expectFresh();
+  expectFresh();
+}
+
+TEST_F(MerkleTest, SetsScalars) {
+  expectFresh();
+  doc["t1"][2]["c4"][5] = -1;
+  hashed.markDirty(Path().key("t1").index(2).key("c4").index(5));
+  expectFresh();
+}
+
+TEST_F(MerkleTest, ResizesScalarArrays) {
+  expectFresh();
+  doc["t0"][1]["c4"].resize(40, 7);
+  hashed.markDirty(Path().key("t0").index(1).key("c4"));
+  expectFresh();
+  doc["t0"][1]["c4"].resize(2);
+  doc["t2"][3]["c1"].clear();
+  hashed.markDirty(Path().key("t0").index(1).key("c4"));
+  hashed.markDirty(Path().key("t2").index(3).key("c1"));
+  expectFresh();
+}
+
+TEST_F(MerkleTest, InsertsAndErasesDictKeys) {
+  expectFresh();
+  doc["t1"][0]["a"] = Row{1, 2, 3};
+  hashed.markDirty(Path().key("t1").index(0).key("a"));
+  expectFresh();
+  doc["t1"][0].erase("c2");
+  hashed.markDirty(Path().key("t1").index(0).key("c2"));
+  expectFresh();
+  doc.erase("t0");
+  doc["u"].emplace_back()["c0"] = Row{4};
+  hashed.markDirty(Path().key("t0"));
+  hashed.markDirty(Path().key("u"));
+  expectFresh();
+}
+
+TEST_F(MerkleTest, InsertsAndErasesListElements) {
+  expectFresh();
+  auto &tables = doc["t2"];
+  tables.insert(tables.begin() + 1, tables[3]);
+  hashed.markDirty(Path().key("t2").index(1));
+  expectFresh();
+  tables.erase(tables.begin());
+  tables.pop_back();
+  hashed.markDirty(Path().key("t2").index(0));
+  hashed.markDirty(Path().key("t2").index(tables.size()));
+  expectFresh();
+  // Same size as before, so the moved elements aren't noticed on their own.
+  tables.insert(tables.begin(), tables.back());
+  tables.pop_back();
+  hashed.markDirty(Path().key("t2"));
+  expectFresh();
+}
+
+TEST_F(MerkleTest, RandomEdits) {
+  expectFresh();
+  std::mt19937_64 rng(42);
+  auto pick = [&](size_t size) { return size_t(rng() % size); };
+  for (int step = 0; step < 300; ++step) {
+    auto tablesIter = std::next(doc.begin(), pick(doc.size()));
+    auto &tables = tablesIter->second;
+    Path path;
+    path.key(tablesIter->first);
+    // Inserts and erases mark the whole list, since several of them may leave
+    // its size unchanged before the next hash().
+    switch (pick(6)) {
+      case 0: {
+        size_t idx = pick(tables.size() + 1);
+        tables.emplace(tables.begin() + idx);
+        break;
+      }
+      case 1:
+        if (!tables.empty()) {
+          size_t idx = pick(tables.size());
+          tables.erase(tables.begin() + idx);
+        }
+        break;
+      default: {
+        if (tables.empty()) {
+          tables.emplace_back();
+          break;
+        }
+        size_t idx = pick(tables.size());
+        auto &table = tables[idx];
+        path.index(idx);
+        auto key = std::pmr::string("c" + std::to_string(pick(8)));
+        path.key(key);
+        auto &row = table[key];
+        switch (pick(4)) {
+          case 0:
+            table.erase(key);
+            break;
+          case 1:
+            row.resize(pick(3 * kLeafWeight), int64_t(step));
+            break;
+          default:
+            if (!row.empty()) {
+              size_t elem = pick(row.size());
+              row[elem] = int64_t(rng());
+              path.index(elem);
+            }
+            break;
+        }
+        break;
+      }
+    }
+    hashed.markDirty(path);
+    // Several edits per hash() too.
+    if (step % 3 != 0) {
+      expectFresh();
+    }
+  }
+  expectFresh();
+}
+
+}  // namespace
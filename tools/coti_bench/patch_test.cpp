@@ -0,0 +1,100 @@
+#include <cstdint>
+#include <memory_resource>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "msgpack.h"
+#include "tops/coti/patch.h"
+#include "tops/coti/pmr.h"
+
+/// apply_patch(a, diff(a, b)) has to turn `a` into `b` for every kind of op,
+/// and reject malformed patches without touching more than it has applied.
+
+using namespace tops::coti;
+
+namespace {
+
+using Row = std::pmr::vector<int64_t>;
+using Table = std::pmr::map<std::pmr::string, Row>;
+using Doc = std::pmr::vector<Table>;
+
+int append_to_string(void *data, const char *buf, size_t len) {
+  static_cast<std::string *>(data)->append(buf, len);
+  return 0;
+}
+
+std::string make_patch(const Doc &a, const Doc &b) {
+  std::string patch;
+  msgpack_packer packer{&patch, append_to_string};
+  diff(a, b, packer);
+  return patch;
+}
+
+Doc make_doc() {
+  Doc doc(3);
+  for (size_t idx = 0; idx < doc.size(); ++idx) {
+    for (int64_t key = 0; key < 4; ++key) {
+      auto &row = doc[idx][std::pmr::string("k" + std::to_string(key))];
+      row.assign(key + 1, int64_t(idx) * 100 + key);
+    }
+  }
+  return doc;
+}
+
+void expect_round_trip(const Doc &a, const Doc &b) {
+  auto patched = a;
+  ASSERT_TRUE(apply_patch(patched, make_patch(a, b)));
+  EXPECT_EQ(patched, b);
+}
+
+TEST(PatchTest, EqualObjectsGiveAnEmptyPatch) {
+  auto a = make_doc();
+  auto patched = a;
+  ASSERT_TRUE(apply_patch(patched, make_patch(a, a)));
+  EXPECT_EQ(patched, a);
+}
+
+TEST(PatchTest, SetsChangedScalars) {
+  auto a = make_doc();
+  auto b = a;
+  b[1]["k2"][1] = -7;
+  expect_round_trip(a, b);
+}
+
+TEST(PatchTest, InsertsAndErasesDictKeys) {
+  auto a = make_doc();
+  auto b = a;
+  b[0].erase("k1");
+  b[2]["new"] = Row{1, 2, 3};
+  expect_round_trip(a, b);
+}
+
+TEST(PatchTest, ResizesArrays) {
+  auto a = make_doc();
+  auto b = a;
+  b[0]["k3"].resize(1);
+  b[1]["k0"].resize(40, 5);
+  b.emplace_back()["k0"] = Row{9};
+  expect_round_trip(a, b);
+  expect_round_trip(b, a);
+}
+
+TEST(PatchTest, RejectsForgedResize) {
+  Doc doc(1);
+  // [[1, [], 2^40]]: grows the root to 2^40 elements.
+  std::string patch("\x91\x93\x01\x90\xcf\x00\x00\x01\x00\x00\x00\x00\x00",
+                    13);
+  EXPECT_FALSE(apply_patch(doc, patch));
+  EXPECT_EQ(doc.size(), 1u);
+}
+
+TEST(PatchTest, RejectsMissingPathKeys) {
+  Doc doc(1);
+  // [[0, [0, "a", 0], 1]]: "a" doesn't exist and isn't the last element.
+  std::string patch("\x91\x93\x00\x93\x00\xa1" "a" "\x00\x01", 9);
+  EXPECT_FALSE(apply_patch(doc, patch));
+  EXPECT_TRUE(doc[0].empty());
+}
+
+}  // namespace
@@ -0,0 +1,192 @@
+#include <cstdint>
+#include <string>
+
+#include "alloc_count.h"
+#include "benchmark/benchmark.h"
+#include "msgpack.h"
+#include "shapes.h"
+#include "tops/coti/hash.h"
+#include "tops/coti/msgpack_reader.h"
+#include "tops/coti/utils.h"
+
+/// to_json/from_json/to_msgpack/from_msgpack/hash over a few object shapes.
+/// Every case reports bytes/s of the msgpack encoding of the object, items/s
+/// counting every value in it (containers included) and allocs/op.
+
+using namespace tops::coti;
+using namespace tops::coti::bench;
+
+namespace {
+
+size_t count_values(const TypeInfo &type_info, const void *object) {
+  switch (type_info.kind) {
+    case OK_Array: {
+      auto &arrayInfo = static_cast<const ArrayInfo &>(type_info);
+      size_t numChilds = arrayInfo.getNumChilds(object);
+      auto &childInfo = arrayInfo.childInfo;
+      if (childInfo.kind == OK_Bool || childInfo.kind == OK_Int ||
+          childInfo.kind == OK_Float) {
+        return 1 + numChilds;
+      }
+      auto *childPtr =
+          static_cast<const char *>(arrayInfo.getChildBegin(object));
+      size_t count = 1;
+      for (size_t idx = 0; idx < numChilds; ++idx) {
+        count += count_values(childInfo, childPtr);
+        childPtr += childInfo.cppByteSize;
+      }
+      return count;
+    }
+    case OK_List: {
+      auto &listInfo = static_cast<const ListInfo &>(type_info);
+      size_t count = 1;
+      for (size_t idx = 0, numChilds = listInfo.getNumChilds(object);
+           idx < numChilds; ++idx) {
+        auto child = listInfo.getChildAt(object, idx);
+        count += count_values(*child.type_info, child.ptr);
+      }
+      return count;
+    }
+    case OK_Dict: {
+      auto &dictInfo = static_cast<const DictInfo &>(type_info);
+      size_t count = 1;
+      auto *iter = dictInfo.beginIter(object);
+      while (!dictInfo.isEndIter(object, iter)) {
+        auto value = dictInfo.getValueAtIter(object, iter);
+        count += count_values(*value.type_info, value.ptr);
+        iter = dictInfo.nextIter(object, iter);
+      }
+      dictInfo.finishIter(object, iter);
+      return count;
+    }
+    default:
+      return 1;
+  }
+}
+
+// Builds the object of a case and its msgpack encoding, and reports the
+// counters once the loop is done.
+template <typename ShapeT>
+class Case {
+ public:
+  using ObjT = typename ShapeT::ObjT;
+
+  explicit Case(benchmark::State &state)
+      : state(state), object(ShapeT::make(state.range(0))) {
+    msgpack_sbuffer_init(&buffer);
+    msgpack_packer packer{&buffer, msgpack_sbuffer_write};
+    to_msgpack(object, packer);
+    numValues = count_values(get_type_info(object), &object);
+    startAllocs = bench::get_num_allocs();
+  }
+
+  ~Case() {
+    size_t numAllocs = bench::get_num_allocs() - startAllocs;
+    state.SetBytesProcessed(state.iterations() * buffer.size);
+    state.SetItemsProcessed(state.iterations() * numValues);
+    state.counters["allocs/op"] = benchmark::Counter(
+        double(numAllocs), benchmark::Counter::kAvgIterations);
+    msgpack_sbuffer_destroy(&buffer);
+  }
+
+  // Leaves setup done after construction out of allocs/op.
+  void restartAllocCount() { startAllocs = bench::get_num_allocs(); }
+
+  const ObjT &getObject() const { return object; }
+
+  std::string_view getMsgpack() const { return {buffer.data, buffer.size}; }
+
+ private:
+  benchmark::State &state;
+  ObjT object;
+  msgpack_sbuffer buffer;
+  size_t numValues;
+  size_t startAllocs;
+};
+
+template <typename ShapeT>
+void BM_ToJson(benchmark::State &state) {
+  Case<ShapeT> bmCase(state);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(to_json(bmCase.getObject()));
+  }
+}
+
+template <typename ShapeT>
+void BM_FromJson(benchmark::State &state) {
+  Case<ShapeT> bmCase(state);
+  auto json = to_json(bmCase.getObject());
+  bmCase.restartAllocCount();
+  for (auto _ : state) {
+    typename ShapeT::ObjT object;
+    from_json(get_type_info(object), &object, json);
+    benchmark::DoNotOptimize(object);
+  }
+}
+
+template <typename ShapeT>
+void BM_ToMsgpack(benchmark::State &state) {
+  Case<ShapeT> bmCase(state);
+  msgpack_sbuffer buffer;
+  msgpack_sbuffer_init(&buffer);
+  for (auto _ : state) {
+    msgpack_sbuffer_clear(&buffer);
+    msgpack_packer packer{&buffer, msgpack_sbuffer_write};
+    to_msgpack(bmCase.getObject(), packer);
+    benchmark::DoNotOptimize(buffer.data);
+  }
+  msgpack_sbuffer_destroy(&buffer);
+}
+
+// Includes unpacking the bytes into a msgpack_object tree.
+template <typename ShapeT>
+void BM_FromMsgpack(benchmark::State &state) {
+  Case<ShapeT> bmCase(state);
+  auto bytes = bmCase.getMsgpack();
+  for (auto _ : state) {
+    msgpack_unpacked unpacked;
+    msgpack_unpacked_init(&unpacked);
+    size_t offset = 0;
+    msgpack_unpack_next(&unpacked, bytes.data(), bytes.size(), &offset);
+    typename ShapeT::ObjT object;
+    from_msgpack(get_type_info(object), &object, unpacked.data);
+    benchmark::DoNotOptimize(object);
+    msgpack_unpacked_destroy(&unpacked);
+  }
+}
+
+template <typename ShapeT>
+void BM_FromMsgpackReader(benchmark::State &state) {
+  Case<ShapeT> bmCase(state);
+  auto bytes = bmCase.getMsgpack();
+  for (auto _ : state) {
+    MsgPackReader reader(bytes);
+    typename ShapeT::ObjT object;
+    benchmark::DoNotOptimize(from_msgpack(reader, object));
+    benchmark::DoNotOptimize(object);
+  }
+}
+
+template <typename ShapeT>
+void BM_Hash(benchmark::State &state) {
+  Case<ShapeT> bmCase(state);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(hash(bmCase.getObject()));
+  }
+}
+
+}  // namespace
+
+#define COTI_BENCH_SHAPE(Shape, lo, hi)                                 \
+  BENCHMARK_TEMPLATE(BM_ToJson, Shape)->Range(lo, hi);                  \
+  BENCHMARK_TEMPLATE(BM_FromJson, Shape)->Range(lo, hi);                \
+  BENCHMARK_TEMPLATE(BM_ToMsgpack, Shape)->Range(lo, hi);               \
+  BENCHMARK_TEMPLATE(BM_FromMsgpack, Shape)->Range(lo, hi);             \
+  BENCHMARK_TEMPLATE(BM_FromMsgpackReader, Shape)->Range(lo, hi);       \
+  BENCHMARK_TEMPLATE(BM_Hash, Shape)->Range(lo, hi)
+
+COTI_BENCH_SHAPE(DeepDict, 2, 4);
+COTI_BENCH_SHAPE(WideDict, 1 << 6, 1 << 16);
+COTI_BENCH_SHAPE(ScalarVector, 1 << 10, 1 << 22);
+COTI_BENCH_SHAPE(StringArray, 1 << 10, 1 << 18);
+COTI_BENCH_SHAPE(HeteroList, 1 << 8, 1 << 16);
@@ -0,0 +1,153 @@
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+#include <memory_resource>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "tops/coti/pmr.h"
+#include "tops/coti/type_trait.h"
+
+/// The object shapes shared by the benchmarks and the tests that check the
+/// decoders agree on them. The argument of every make() is the shape's
+/// fan-out or number of children.
+
+namespace tops {
+namespace coti {
+namespace bench {
+
+// ListInfo of a std::tuple, to have a List whose children differ in type.
+template <typename TupleT>
+struct TupleInfo : ListInfo {
+  static constexpr size_t kSize = std::tuple_size_v<TupleT>;
+
+  TupleInfo() : ListInfo(sizeof(TupleT)) {}
+
+  size_t getNumChilds(const void *) const override { return kSize; }
+
+  void resize(const void *, size_t newNumChild) const override {
+    assert(newNumChild == kSize && "std::tuple has a fixed size");
+  }
+
+  TypedPtr getChildAt(const void *object, size_t childIdx) const override {
+    return getChildAt(object, childIdx, std::make_index_sequence<kSize>());
+  }
+
+ private:
+  template <size_t... Idx>
+  static TypedPtr getChildAt(const void *object, size_t childIdx,
+                             std::index_sequence<Idx...>) {
+    auto &tuple = *const_cast<TupleT *>(static_cast<const TupleT *>(object));
+    TypedPtr childs[] = {
+        {&std::get<Idx>(tuple),
+         &get_type_info<std::tuple_element_t<Idx, TupleT>>()}...};
+    return childs[childIdx];
+  }
+};
+
+}  // namespace bench
+
+template <typename... Ts>
+struct TypeTrait<std::tuple<Ts...>> {
+  static const ListInfo &type_info() {
+    static const bench::TupleInfo<std::tuple<Ts...>> info;
+    return info;
+  }
+};
+
+namespace bench {
+
+template <int Depth>
+struct DeepDictType {
+  using type =
+      std::pmr::map<std::pmr::string, typename DeepDictType<Depth - 1>::type>;
+};
+
+template <>
+struct DeepDictType<0> {
+  using type = int64_t;
+};
+
+template <int Depth>
+void fill_deep_dict(typename DeepDictType<Depth>::type &dict, int64_t fanout,
+                    int64_t &next) {
+  if constexpr (Depth == 0) {
+    dict = next++;
+  } else {
+    for (int64_t idx = 0; idx < fanout; ++idx) {
+      auto key = "node_" + std::to_string(idx);
+      fill_deep_dict<Depth - 1>(dict[std::pmr::string(key)], fanout, next);
+    }
+  }
+}
+
+struct DeepDict {
+  using ObjT = DeepDictType<8>::type;
+
+  static ObjT make(int64_t fanout) {
+    ObjT object;
+    int64_t next = 0;
+    fill_deep_dict<8>(object, fanout, next);
+    return object;
+  }
+};
+
+struct WideDict {
+  using ObjT = std::pmr::map<std::pmr::string, int64_t>;
+
+  static ObjT make(int64_t size) {
+    ObjT object;
+    for (int64_t idx = 0; idx < size; ++idx) {
+      object[std::pmr::string("field_" + std::to_string(idx))] = idx;
+    }
+    return object;
+  }
+};
+
+struct ScalarVector {
+  using ObjT = std::vector<double>;
+
+  static ObjT make(int64_t size) {
+    ObjT object(size);
+    for (int64_t idx = 0; idx < size; ++idx) {
+      object[idx] = double(idx) * 0.25;
+    }
+    return object;
+  }
+};
+
+struct StringArray {
+  using ObjT = std::vector<std::string>;
+
+  // Mixes strings that fit in the small string buffer with longer ones.
+  static ObjT make(int64_t size) {
+    ObjT object(size);
+    for (int64_t idx = 0; idx < size; ++idx) {
+      object[idx] = std::string(idx % 64, 'x') + std::to_string(idx);
+    }
+    return object;
+  }
+};
+
+struct HeteroList {
+  using RecordT =
+      std::tuple<int64_t, double, std::string, std::vector<int32_t>, bool>;
+  using ObjT = std::vector<RecordT>;
+
+  static ObjT make(int64_t size) {
+    ObjT object(size);
+    for (int64_t idx = 0; idx < size; ++idx) {
+      object[idx] = {idx, idx * 0.5, "item_" + std::to_string(idx),
+                     std::vector<int32_t>(idx % 16, int32_t(idx)),
+                     idx % 3 == 0};
+    }
+    return object;
+  }
+};
+
+}  // namespace bench
+}  // namespace coti
+}  // namespace tops
@@ -0,0 +1,123 @@
+#include <algorithm>
+#include <cstring>
+#include <string_view>
+
+#include "gtest/gtest.h"
+#include "msgpack.h"
+#include "shapes.h"
+#include "tops/coti/msgpack_reader.h"
+#include "tops/coti/utils.h"
+
+/// The MsgPackReader based from_msgpack() has to decode every bench shape to
+/// the same object as the msgpack_object based one, from a buffer and from
+/// chunks alike.
+
+using namespace tops::coti;
+using namespace tops::coti::bench;
+
+namespace {
+
+template <typename ShapeT>
+class ShapesTest : public ::testing::Test {
+ protected:
+  using ObjT = typename ShapeT::ObjT;
+
+  void SetUp() override {
+    msgpack_sbuffer_init(&buffer);
+    msgpack_packer packer{&buffer, msgpack_sbuffer_write};
+    to_msgpack(object, packer);
+  }
+
+  void TearDown() override { msgpack_sbuffer_destroy(&buffer); }
+
+  std::string_view getMsgpack() const { return {buffer.data, buffer.size}; }
+
+  ObjT fromMsgpackObject() const {
+    msgpack_unpacked unpacked;
+    msgpack_unpacked_init(&unpacked);
+    size_t offset = 0;
+    EXPECT_EQ(msgpack_unpack_next(&unpacked, buffer.data, buffer.size, &offset),
+              MSGPACK_UNPACK_SUCCESS);
+    auto res = from_msgpack<ObjT>(unpacked.data);
+    msgpack_unpacked_destroy(&unpacked);
+    return res;
+  }
+
+  // Small enough to run quickly, large enough for 16/32-bit msgpack headers.
+  ObjT object = ShapeT::make(ShapeT::kTestSize);
+  msgpack_sbuffer buffer;
+};
+
+struct DeepDictCase : DeepDict {
+  static constexpr int64_t kTestSize = 3;
+};
+
+struct WideDictCase : WideDict {
+  static constexpr int64_t kTestSize = 1 << 16;
+};
+
+struct ScalarVectorCase : ScalarVector {
+  static constexpr int64_t kTestSize = 1 << 16;
+};
+
+struct StringArrayCase : StringArray {
+  static constexpr int64_t kTestSize = 1 << 12;
+};
+
+struct HeteroListCase : HeteroList {
+  static constexpr int64_t kTestSize = 1 << 10;
+};
+
+using Shapes = ::testing::Types<DeepDictCase, WideDictCase, ScalarVectorCase,
+                                StringArrayCase, HeteroListCase>;
+TYPED_TEST_SUITE(ShapesTest, Shapes);
+
+TYPED_TEST(ShapesTest, BufferMatchesMsgpackObject) {
+  typename TestFixture::ObjT object;
+  MsgPackReader reader(this->getMsgpack());
+  ASSERT_TRUE(from_msgpack(reader, object));
+  EXPECT_TRUE(reader.atEnd());
+  EXPECT_EQ(object, this->fromMsgpackObject());
+  EXPECT_EQ(object, this->object);
+}
+
+TYPED_TEST(ShapesTest, ChunksMatchMsgpackObject) {
+  auto bytes = this->getMsgpack();
+  size_t offset = 0;
+  // Odd-sized chunks, so that headers and payloads straddle them.
+  MsgPackReader reader(
+      [&](char *buf, size_t size) {
+        size = std::min({size, bytes.size() - offset, size_t(97)});
+        std::memcpy(buf, bytes.data() + offset, size);
+        offset += size;
+        return size;
+      },
+      64);
+  typename TestFixture::ObjT object;
+  ASSERT_TRUE(from_msgpack(reader, object));
+  EXPECT_TRUE(reader.atEnd());
+  EXPECT_EQ(object, this->fromMsgpackObject());
+}
+
+TYPED_TEST(ShapesTest, InPlaceChunksMatchMsgpackObject) {
+  auto bytes = this->getMsgpack();
+  size_t offset = 0;
+  MsgPackReader reader([&]() {
+    auto chunk = bytes.substr(offset, 97);
+    offset += chunk.size();
+    return chunk;
+  });
+  typename TestFixture::ObjT object;
+  ASSERT_TRUE(from_msgpack(reader, object));
+  EXPECT_TRUE(reader.atEnd());
+  EXPECT_EQ(object, this->fromMsgpackObject());
+}
+
+TYPED_TEST(ShapesTest, TruncatedInputFails) {
+  auto bytes = this->getMsgpack();
+  typename TestFixture::ObjT object;
+  MsgPackReader reader(bytes.substr(0, bytes.size() - 1));
+  EXPECT_FALSE(from_msgpack(reader, object));
+}
+
+}  // namespace
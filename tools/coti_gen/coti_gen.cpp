@@ -1,58 +1,460 @@
+#include <algorithm>
+#include <map>
+#include <optional>
+#include <string>
+#include <vector>
+
 #include "clang/AST/AST.h"
 #include "clang/AST/ASTConsumer.h"
+#include "clang/AST/QualTypeNames.h"
+#include "clang/AST/RecordLayout.h"
 #include "clang/AST/RecursiveASTVisitor.h"
 #include "clang/Frontend/CompilerInstance.h"
 #include "clang/Frontend/FrontendPluginRegistry.h"
+#include "inja/inja.hpp"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Path.h"
 #include "llvm/Support/raw_ostream.h"
+#include "tops/coti/struct_info.h"
 
 using namespace clang;
 using namespace llvm;
 
-class ConfigObjectTypeInfoGenConsumer : public ASTConsumer {
+namespace {
+
+struct FieldDesc {
+  std::string name;
+  // Fully qualified cpp type, used as `get_type_info<type>`.
+  std::string type;
+  uint64_t offset;
+  uint64_t size;
+  // flatName of the record if the field is a struct generated in the same
+  // header, empty otherwise.
+  std::string nested;
+};
+
+struct RecordDesc {
+  // Fully qualified name with a leading `::`.
+  std::string qualName;
+  // Qualified name with `::` replaced by `_`, prefix of the generated names.
+  std::string flatName;
+  uint64_t size;
+  bool isStandardLayout;
+  std::vector<FieldDesc> fields;
+  // Perfect hash of the field names, see tops::coti::struct_key_hash.
+  uint32_t seed;
+  std::vector<int32_t> slots;
+};
+
+// Finds a seed for which struct_key_hash sends every field to its own slot.
+// The table starts at twice the number of fields and doubles if no seed is
+// found quickly.
+void buildPerfectHash(RecordDesc &record) {
+  uint32_t numSlots = 1;
+  while (numSlots < record.fields.size() * 2) {
+    numSlots *= 2;
+  }
+  for (;; numSlots *= 2) {
+    for (uint32_t seed = 0; seed < (1u << 16); ++seed) {
+      std::vector<int32_t> slots(numSlots, -1);
+      bool collided = false;
+      for (size_t idx = 0; idx < record.fields.size() && !collided; ++idx) {
+        auto &slot = slots[tops::coti::struct_key_hash(record.fields[idx].name,
+                                                       seed) &
+                           (numSlots - 1)];
+        collided = slot >= 0;
+        slot = static_cast<int32_t>(idx);
+      }
+      if (!collided) {
+        record.seed = seed;
+        record.slots = std::move(slots);
+        return;
+      }
+    }
+  }
+}
+
+// The generated header. For every struct it emits the StructInfo tables, the
+// straight-line codecs registered on it, and the TypeTrait specialization.
+// Fields of another struct of the same header call its codecs directly.
+// When run on a header it includes it; for a source file the user includes
+// the generated header after the record definitions instead.
+constexpr const char kHeaderTemplate[] = R"inja(// Generated by coti_gen, do not edit.
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+## if include_main_file
+#include "{{ main_file }}"
+## endif
+#include "msgpack.h"
+#include "nlohmann/json.hpp"
+#include "tops/coti/gen_support.h"
+#include "tops/coti/hash.h"
+#include "tops/coti/struct_info.h"
+#include "tops/coti/type_trait.h"
+
+namespace tops {
+namespace coti {
+
+## for record in records
+namespace gen {
+inline void {{ record.flat_name }}_to_msgpack(const void *object,
+    msgpack_packer &packer) {
+  auto &obj = *static_cast<const {{ record.qual_name }} *>(object);
+  msgpack_pack_map(&packer, {{ record.num_fields }});
+## for field in record.fields
+  msgpack_pack_str_with_body(&packer, "{{ field.name }}", {{ field.name_size }});
+## if field.has_nested
+  {{ field.nested }}_to_msgpack(&obj.{{ field.name }}, packer);
+## else
+  gen_support::pack(obj.{{ field.name }}, packer);
+## endif
+## endfor
+}
+
+inline void {{ record.flat_name }}_from_msgpack(void *object,
+    const msgpack_object &msg_obj) {
+  auto &obj = *static_cast<{{ record.qual_name }} *>(object);
+  assert(msg_obj.type == MSGPACK_OBJECT_MAP);
+  auto map = msg_obj.via.map;
+  SeenFields seen({{ record.num_fields }});
+  for (uint32_t idx = 0; idx < map.size; ++idx) {
+    auto &keyVal = map.ptr[idx];
+    assert(keyVal.key.type == MSGPACK_OBJECT_STR);
+    std::string_view key(keyVal.key.via.str.ptr, keyVal.key.via.str.size);
+    switch (struct_key_hash(key, {{ record.seed }}u) & {{ record.slot_mask }}u) {
+## for field in record.fields
+      case {{ field.slot }}:
+        if (key == "{{ field.name }}") {
+          seen.set({{ field.index }});
+## if field.has_nested
+          {{ field.nested }}_from_msgpack(&obj.{{ field.name }}, keyVal.val);
+## else
+          gen_support::unpack(obj.{{ field.name }}, keyVal.val);
+## endif
+          continue;
+        }
+        break;
+## endfor
+      default:
+        break;
+    }
+    // A key of a newer schema, skipped.
+  }
+## for field in record.fields
+  if (!seen.test({{ field.index }})) {
+    {{ field.set_default }}(&obj.{{ field.name }});
+  }
+## endfor
+}
+
+inline nlohmann::json {{ record.flat_name }}_to_json(const void *object) {
+  auto &obj = *static_cast<const {{ record.qual_name }} *>(object);
+  nlohmann::json json(nlohmann::json::value_t::object);
+## for field in record.fields
+## if field.has_nested
+  json.emplace("{{ field.name }}", {{ field.nested }}_to_json(&obj.{{ field.name }}));
+## else
+  json.emplace("{{ field.name }}", gen_support::to_json_value(obj.{{ field.name }}));
+## endif
+## endfor
+  return json;
+}
+
+// Same encoding as the generic hash, so fields are visited sorted by name.
+inline void {{ record.flat_name }}_hash(const void *object, Hasher &hasher) {
+  auto &obj = *static_cast<const {{ record.qual_name }} *>(object);
+  hasher.update(static_cast<uint8_t>(OK_Dict));
+  hasher.update(static_cast<uint64_t>({{ record.num_fields }}));
+## for field in record.sorted_fields
+  hasher.update(static_cast<uint64_t>({{ field.name_size }}));
+  hasher.update("{{ field.name }}", {{ field.name_size }});
+## if field.has_nested
+  {{ field.nested }}_hash(&obj.{{ field.name }}, hasher);
+## else
+  gen_support::hash_value(obj.{{ field.name }}, hasher);
+## endif
+## endfor
+}
+
+struct {{ record.flat_name }}_Info final : StructInfo {
+  static constexpr FieldInfo kFields[] = {
+## for field in record.fields
+      {"{{ field.name }}", {{ field.offset }}, {{ field.size }}, &get_type_info<{{ field.type }}>,
+       {{ field.get_set_default }}},
+## endfor
+  };
+  static constexpr int32_t kSlots[] = { {{ record.slots }} };
+  static constexpr DictCodecs kCodecs = {
+      &{{ record.flat_name }}_to_msgpack, &{{ record.flat_name }}_from_msgpack,
+      &{{ record.flat_name }}_to_json, &{{ record.flat_name }}_hash};
+
+  {{ record.flat_name }}_Info()
+      : StructInfo({{ record.size }}, kFields, {{ record.num_fields }}, kSlots, {{ record.num_slots }}, {{ record.seed }}u) {
+    setCodecs(&kCodecs);
+  }
+};
+
+static_assert(sizeof({{ record.qual_name }}) == {{ record.size }});
+## if record.is_standard_layout
+## for field in record.fields
+static_assert(offsetof({{ record.qual_name }}, {{ field.name }}) == {{ field.offset }});
+## endfor
+## endif
+}  // namespace gen
+
+template <>
+struct TypeTrait<{{ record.qual_name }}> {
+  static const gen::{{ record.flat_name }}_Info& type_info() {
+    static const gen::{{ record.flat_name }}_Info info;
+    return info;
+  }
+};
+
+## endfor
+}  // namespace coti
+}  // namespace tops
+)inja";
+
+inja::json fieldToJson(const FieldDesc &field, const RecordDesc &record,
+                       size_t idx) {
+  inja::json json;
+  json["name"] = field.name;
+  json["name_size"] = field.name.size();
+  json["type"] = field.type;
+  json["offset"] = field.offset;
+  json["size"] = field.size;
+  json["has_nested"] = !field.nested.empty();
+  json["nested"] = field.nested;
+  json["index"] = idx;
+  auto defaultArgs = "<" + record.qualName + ", " + field.type + ", &" +
+                     record.qualName + "::" + field.name + ">";
+  json["set_default"] = "set_default_field" + defaultArgs;
+  json["get_set_default"] = "get_set_default_field" + defaultArgs + "()";
+  auto slot = std::find(record.slots.begin(), record.slots.end(),
+                        static_cast<int32_t>(idx));
+  json["slot"] = slot - record.slots.begin();
+  return json;
+}
+
+inja::json recordToJson(const RecordDesc &record) {
+  inja::json json;
+  json["qual_name"] = record.qualName;
+  json["flat_name"] = record.flatName;
+  json["size"] = record.size;
+  json["is_standard_layout"] = record.isStandardLayout;
+  json["num_fields"] = record.fields.size();
+  json["seed"] = record.seed;
+  json["num_slots"] = record.slots.size();
+  json["slot_mask"] = record.slots.size() - 1;
+  std::string slots;
+  for (size_t idx = 0; idx < record.slots.size(); ++idx) {
+    slots += (idx == 0 ? "" : ", ") + std::to_string(record.slots[idx]);
+  }
+  json["slots"] = slots;
+
+  std::vector<size_t> order(record.fields.size());
+  for (size_t idx = 0; idx < order.size(); ++idx) {
+    json["fields"].push_back(fieldToJson(record.fields[idx], record, idx));
+    order[idx] = idx;
+  }
+  std::sort(order.begin(), order.end(), [&](size_t lhs, size_t rhs) {
+    return record.fields[lhs].name < record.fields[rhs].name;
+  });
+  for (auto idx : order) {
+    json["sorted_fields"].push_back(
+        fieldToJson(record.fields[idx], record, idx));
+  }
+  return json;
+}
+
+}  // namespace
+
+class ConfigObjectTypeInfoGenConsumer
+    : public ASTConsumer,
+      public RecursiveASTVisitor<ConfigObjectTypeInfoGenConsumer> {
   CompilerInstance &CI;
+  std::string outputPath;
+  std::vector<RecordDesc> records;
+  // Records generated so far, so later ones can call their codecs directly.
+  std::map<const RecordDecl *, std::string> flatNames;
+
+  void warnSkipped(RecordDecl *recDecl, StringRef reason) {
+    auto &diag = CI.getDiagnostics();
+    unsigned diagID = diag.getCustomDiagID(
+        DiagnosticsEngine::Warning, "coti_gen: skipping '%0': %1");
+    diag.Report(recDecl->getLocation(), diagID)
+        << recDecl->getQualifiedNameAsString() << reason;
+  }
+
+  std::optional<RecordDesc> describeRecord(RecordDecl *recDecl) {
+    auto &astCtx = CI.getASTContext();
+    PrintingPolicy policy(CI.getLangOpts());
+    policy.SuppressTagKeyword = true;
+    auto &layout = astCtx.getASTRecordLayout(recDecl);
+    auto *cxxDecl = dyn_cast<CXXRecordDecl>(recDecl);
+
+    // The generated code names the record from the global namespace.
+    if (recDecl->isInAnonymousNamespace()) {
+      warnSkipped(recDecl, "records in anonymous namespaces can't be named");
+      return std::nullopt;
+    }
+    // Only the record's own fields are reflected, base members would be lost.
+    if (cxxDecl && cxxDecl->getNumBases() != 0) {
+      warnSkipped(recDecl, "base class members aren't reflected");
+      return std::nullopt;
+    }
+
+    RecordDesc record;
+    record.qualName = "::" + recDecl->getQualifiedNameAsString();
+    record.flatName = recDecl->getQualifiedNameAsString();
+    for (size_t pos = 0;
+         (pos = record.flatName.find("::", pos)) != std::string::npos;) {
+      record.flatName.replace(pos, 2, "_");
+    }
+    record.size = layout.getSize().getQuantity();
+    record.isStandardLayout = !cxxDecl || cxxDecl->isStandardLayout();
 
-  void exportConfigObjectTypeInfo(RecordDecl *recDecl) {
-    LangOptions refLangOpt;
-    PrintingPolicy refPrintPolicy{refLangOpt};
     for (auto *fieldDecl : recDecl->fields()) {
-      fieldDecl->printName(outs(), refPrintPolicy);
+      if (fieldDecl->isBitField()) {
+        warnSkipped(recDecl, "bit-fields have no address");
+        return std::nullopt;
+      }
+      if (!fieldDecl->getIdentifier()) {
+        warnSkipped(recDecl, "unnamed fields have no key");
+        return std::nullopt;
+      }
+      auto fieldType = fieldDecl->getType();
+      if (fieldType->isReferenceType()) {
+        warnSkipped(recDecl, "reference fields are not objects");
+        return std::nullopt;
+      }
+      // The generated codecs access and assign fields from outside the
+      // record.
+      if (fieldDecl->getAccess() == AS_private ||
+          fieldDecl->getAccess() == AS_protected) {
+        warnSkipped(recDecl, "non-public fields are not accessible");
+        return std::nullopt;
+      }
+      if (fieldType->isArrayType()) {
+        warnSkipped(recDecl, "C array fields can't be assigned");
+        return std::nullopt;
+      }
+      if (fieldType.isConstQualified()) {
+        warnSkipped(recDecl, "const fields can't be assigned");
+        return std::nullopt;
+      }
+      FieldDesc field;
+      field.name = fieldDecl->getName().str();
+      field.type = TypeName::getFullyQualifiedName(
+          fieldType.getUnqualifiedType(), astCtx, policy,
+          /*WithGlobalNsPrefix=*/true);
+      field.offset = astCtx.toCharUnitsFromBits(
+                               layout.getFieldOffset(fieldDecl->getFieldIndex()))
+                         .getQuantity();
+      field.size = astCtx.getTypeSizeInChars(fieldType).getQuantity();
+      if (auto *fieldRec = fieldType->getAsRecordDecl()) {
+        auto nested = flatNames.find(fieldRec->getCanonicalDecl());
+        if (nested != flatNames.end()) {
+          field.nested = nested->second;
+        }
+      }
+      record.fields.push_back(std::move(field));
+    }
+    if (record.fields.empty()) {
+      warnSkipped(recDecl, "no fields");
+      return std::nullopt;
     }
+    buildPerfectHash(record);
+    return record;
   }
 
- public:
-  ConfigObjectTypeInfoGenConsumer(CompilerInstance &CI) : CI(CI) {}
+  static bool isHeaderPath(StringRef path) {
+    auto ext = sys::path::extension(path);
+    return ext == ".h" || ext == ".hh" || ext == ".hpp" || ext == ".hxx" ||
+           ext == ".inc";
+  }
 
-  bool HandleTopLevelDecl(DeclGroupRef D) override {
+  void exportConfigObjectTypeInfo(raw_ostream &os) {
     auto &srcMgr = CI.getSourceManager();
-    for (auto *decl : D) {
-      auto *recDecl = dyn_cast<RecordDecl>(decl);
-      if (!recDecl || !recDecl->isThisDeclarationADefinition()) {
-        continue;
-      }
-      auto loc = decl->getLocation();
-      auto fileId = srcMgr.getFileID(loc);
-      if (fileId != srcMgr.getMainFileID()) {
-        continue;
-      }
-      exportConfigObjectTypeInfo(recDecl);
+    auto mainFile = srcMgr.getFileEntryRefForID(srcMgr.getMainFileID());
+    inja::json data;
+    data["include_main_file"] =
+        mainFile && isHeaderPath(mainFile->getName());
+    data["main_file"] = mainFile ? mainFile->getName().str() : "";
+    data["records"] = inja::json::array();
+    for (auto &record : records) {
+      data["records"].push_back(recordToJson(record));
+    }
+    inja::Environment env;
+    os << env.render(kHeaderTemplate, data);
+  }
+
+ public:
+  ConfigObjectTypeInfoGenConsumer(CompilerInstance &CI, std::string outputPath)
+      : CI(CI), outputPath(std::move(outputPath)) {}
+
+  bool VisitRecordDecl(RecordDecl *recDecl) {
+    if (!recDecl->isThisDeclarationADefinition() || recDecl->isUnion() ||
+        !recDecl->getIdentifier() || recDecl->isDependentContext() ||
+        recDecl->getParentFunctionOrMethod() || recDecl->isInvalidDecl()) {
+      return true;
+    }
+    if (!CI.getSourceManager().isInMainFile(recDecl->getLocation())) {
+      return true;
+    }
+    if (auto record = describeRecord(recDecl)) {
+      flatNames.emplace(recDecl->getCanonicalDecl(), record->flatName);
+      records.push_back(std::move(*record));
     }
     return true;
   }
+
+  void HandleTranslationUnit(ASTContext &astCtx) override {
+    TraverseDecl(astCtx.getTranslationUnitDecl());
+    if (outputPath.empty()) {
+      exportConfigObjectTypeInfo(outs());
+      return;
+    }
+    std::error_code ec;
+    raw_fd_ostream os(outputPath, ec, sys::fs::OF_Text);
+    if (ec) {
+      auto &diag = CI.getDiagnostics();
+      unsigned diagID = diag.getCustomDiagID(
+          DiagnosticsEngine::Error, "coti_gen: cannot open '%0': %1");
+      diag.Report(diagID) << outputPath << ec.message();
+      return;
+    }
+    exportConfigObjectTypeInfo(os);
+  }
 };
 
 class ConfigObjectTypeInfoGenAction : public PluginASTAction {
+  std::string outputPath;
+
   std::unique_ptr<ASTConsumer> CreateASTConsumer(CompilerInstance &CI,
                                                  StringRef InFile) override {
-    return std::make_unique<ConfigObjectTypeInfoGenConsumer>(CI);
+    return std::make_unique<ConfigObjectTypeInfoGenConsumer>(CI, outputPath);
   }
 
+  // Takes an optional `out=<path>`, the generated header goes to stdout
+  // otherwise.
   bool ParseArgs(const CompilerInstance &CI,
                  const std::vector<std::string> &args) override {
-    if (args.size() != 0) {
+    for (auto &arg : args) {
+      StringRef argRef(arg);
+      if (argRef.consume_front("out=")) {
+        outputPath = argRef.str();
+        continue;
+      }
       auto &Diag = CI.getDiagnostics();
       unsigned DiagID = Diag.getDiagnosticIDs()->getCustomDiagID(
-          DiagnosticIDs::Error, "coi_gen takes no argument");
-      Diag.Report(DiagID);
+          DiagnosticIDs::Error, "coi_gen: unknown argument '%0'");
+      Diag.Report(DiagID) << arg;
       return false;
     }
     return true;